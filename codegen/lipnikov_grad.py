@@ -0,0 +1,232 @@
+from __future__ import print_function
+from sympy import *
+import sys
+
+# Gradient of the Lipnikov quality functional with respect to the
+# position of the first vertex of the element, x0, for a metric that
+# is constant over the element (the metric at x0 when smoothing).
+#
+# The functional is q = c*v*sqrt(det(M))*F(l)/l^dim where v is the
+# area/volume, l the sum of the edge lengths in metric space and
+#   F(l) = tf^3, tf = f*(2-f), f = min(l/k, k/l)
+# with k=3 in 2D and k=6 in 3D. Only v and l depend on x0, so
+#   dq/dx0 = c*sqrt(det(M))*(dv/dx0*G(l) + v*dG/dl*dl/dx0), G = F/l^dim.
+# The geometric terms v, l and their derivatives are generated here;
+# the chain rule through the non-smooth f is written out by hand.
+
+orientation = symbols('orientation')
+
+def functional(dim):
+    x = [symbols('x%d[:%d]'%(i, dim)) for i in range(dim+1)]
+    m = symbols('m0[:%d]'%(3 if dim==2 else 6))
+    if dim==2:
+        M = Matrix([[m[0], m[1]],
+                    [m[1], m[2]]])
+    else:
+        M = Matrix([[m[0], m[1], m[2]],
+                    [m[1], m[3], m[4]],
+                    [m[2], m[4], m[5]]])
+
+    def length(a, b):
+        e = Matrix(a) - Matrix(b)
+        return sqrt((e.T*M*e)[0, 0])
+
+    l = 0
+    for i in range(dim+1):
+        for j in range(i+1, dim+1):
+            l += length(x[i], x[j])
+
+    # Same orientation convention as ElementProperty::area()/volume().
+    if dim==2:
+        v = orientation*Rational(1, 2)*((x[0][1]-x[2][1])*(x[0][0]-x[1][0]) - (x[0][1]-x[1][1])*(x[0][0]-x[2][0]))
+    else:
+        x01, y01, z01 = [x[0][i]-x[1][i] for i in range(3)]
+        x02, y02, z02 = [x[0][i]-x[2][i] for i in range(3)]
+        x03, y03, z03 = [x[0][i]-x[3][i] for i in range(3)]
+        v = orientation*Rational(1, 6)*(-x03*(z02*y01 - z01*y02) + x02*(z03*y01 - z01*y03) - x01*(z03*y02 - z02*y03))
+
+    return x, m, M, l, v
+
+def chain_rule(dim, l, f):
+    # dG/dl, with G = F(f(l))/l^dim, for one branch f of the min.
+    L = symbols('L')
+    tf = f(L)*(2-f(L))
+    G = tf**3/L**dim
+    return G.subs(L, l), diff(G, L).subs(L, l)
+
+# Lets work this out symbolically first and perform python unit test:
+# compare against a central difference of the functional, for elements
+# on both sides of the kink of min(l/k, k/l).
+
+c = {2:12*sqrt(3), 3:6**4*sqrt(2)}
+k = {2:3, 3:6}
+
+ok = True
+for dim in (2, 3):
+    x, m, M, l, v = functional(dim)
+
+    if dim==2:
+        metric = [1.3, 0.2, 0.8]
+        others = [1.0, 0.1, 0.4, 0.9]
+        points = ((0.05, -0.1), (0.3, 0.2))
+    else:
+        metric = [1.3, 0.2, 0.1, 0.8, -0.1, 1.1]
+        others = [1.0, 0.1, 0.0, 0.4, 0.9, 0.1, 0.3, 0.4, 0.8]
+        points = ((0.05, -0.1, -0.05), (0.3, 0.3, 0.3))
+
+    args = [orientation] + list(m) + [xi for X in x for xi in X]
+    l_f = lambdify(args, l)
+    v_f = lambdify(args, v)
+    dl_f = [lambdify(args, diff(l, x[0][i])) for i in range(dim)]
+    dv_f = [lambdify(args, diff(v, x[0][i])) for i in range(dim)]
+    sqrt_det = float(sqrt(M.det().subs(dict(zip(m, metric)))))
+
+    def q_f(*vals):
+        L = l_f(*vals)
+        f = min(L/k[dim], k[dim]/L)
+        return float(c[dim])*v_f(*vals)*sqrt_det*(f*(2-f))**3/L**dim
+
+    for scale in (1.0, 10.0):
+        for p in points:
+            vals = [1] + metric + [xi*scale for xi in p] + [xi*scale for xi in others]
+
+            L = l_f(*vals)
+            if L/k[dim] < k[dim]/L:
+                G, dG = chain_rule(dim, L, lambda L: L/k[dim])
+            else:
+                G, dG = chain_rule(dim, L, lambda L: k[dim]/L)
+
+            for i in range(dim):
+                grad = float(c[dim])*sqrt_det*(dv_f[i](*vals)*float(G) + v_f(*vals)*float(dG)*dl_f[i](*vals))
+
+                h = 1.0e-6*scale
+                vp = list(vals); vp[1+len(metric)+i] += h
+                vn = list(vals); vn[1+len(metric)+i] -= h
+                fd = (q_f(*vp) - q_f(*vn))/(2*h)
+
+                if abs(grad-fd) > 1.0e-6*max(1.0, abs(fd)):
+                    ok = False
+
+if ok:
+    print("pass")
+else:
+    print("fail")
+    sys.exit(-1)
+
+# Move onto code generation.
+
+pyname=sys.argv[0].split('/')[-1]
+
+# Write source file
+cxxname=pyname[:-3]+".cpp"
+
+src="""
+    /* Start of code generated by %s. Warning - be careful about modifying
+       any of the generated code directly.  Any changes/fixes should be done
+       in the code generation script generation.
+       */
+"""%(pyname)
+
+indent = "        "
+for dim in (2, 3):
+    x, m, M, l, v = functional(dim)
+
+    exprs = [l, v] + [diff(l, x[0][i]) for i in range(dim)] + [diff(v, x[0][i]) for i in range(dim)]
+    temps, exprs = cse(exprs, symbols=numbered_symbols('t'))
+
+    if dim==2:
+        src += """
+    /*! Gradient of the 2D Lipnikov functional with respect to the
+     * position of x0, for the metric m0 constant over the element.
+     */
+    inline void lipnikov_grad(int moving,
+                              const real_t *x0, const real_t *x1, const real_t *x2,
+                              const real_t *m0,
+                              double *grad)
+    {
+"""
+    else:
+        src += """
+    /*! Gradient of the 3D Lipnikov functional with respect to the
+     * position of x0, for the metric m0 constant over the element.
+     */
+    inline void lipnikov_grad(int moving,
+                              const real_t *x0, const real_t *x1, const real_t *x2, const real_t *x3,
+                              const real_t *m0,
+                              double *grad)
+    {
+"""
+    for t, e in temps:
+        src += indent+"double %s = %s;\n"%(t, ccode(e, contract=False))
+    src += "\n"
+    src += indent+"double l = %s;\n"%ccode(exprs[0], contract=False)
+    src += indent+"double v = %s;\n"%ccode(exprs[1], contract=False)
+    src += indent+"double dl[] = {%s};\n"%", ".join([ccode(e, contract=False) for e in exprs[2:2+dim]])
+    src += indent+"double dv[] = {%s};\n"%", ".join([ccode(e, contract=False) for e in exprs[2+dim:]])
+
+    if dim==2:
+        src += """
+        double invl = 1.0/l;
+
+        // f = min(l/3, 3/l) and its derivative.
+        double f, df;
+        if(l*inv3 < 3.0*invl) {
+            f = l*inv3;
+            df = inv3;
+        } else {
+            f = 3.0*invl;
+            df = -3.0*invl*invl;
+        }
+        double tf = f * (2.0 - f);
+        double F = tf*tf*tf;
+        double dF = 3.0*tf*tf*(2.0 - 2.0*f)*df;
+
+        // G = F/l^2 and its derivative.
+        double G = F*invl*invl;
+        double dG = (dF - 2.0*F*invl)*invl*invl;
+
+        double c = lipnikov_const2d*sqrt(m0[0]*m0[2] - m0[1]*m0[1]);
+        for(int i=0; i<2; i++)
+            grad[i] = c*(dv[i]*G + v*dG*dl[i]);
+
+        return;
+    }
+"""
+    else:
+        src += """
+        double invl = 1.0/l;
+
+        // f = min(l/6, 6/l) and its derivative.
+        double f, df;
+        if(l*inv6 < 6.0*invl) {
+            f = l*inv6;
+            df = inv6;
+        } else {
+            f = 6.0*invl;
+            df = -6.0*invl*invl;
+        }
+        double tf = f * (2.0 - f);
+        double F = tf*tf*tf;
+        double dF = 3.0*tf*tf*(2.0 - 2.0*f)*df;
+
+        // G = F/l^3 and its derivative.
+        double G = F*invl*invl*invl;
+        double dG = (dF - 3.0*F*invl)*invl*invl*invl;
+
+        double m00 = m0[0], m01 = m0[1], m02 = m0[2], m11 = m0[3], m12 = m0[4], m22 = m0[5];
+        double c = lipnikov_const3d*sqrt(((m11*m22 - m12*m12)*m00 - (m01*m22 - m02*m12)*m01 + (m01*m12 - m02*m11)*m02));
+        for(int i=0; i<3; i++)
+            grad[i] = c*(dv[i]*G + v*dG*dl[i]);
+
+        return;
+    }
+"""
+
+src+="""
+    /* End of code generated by %s. Warning - be careful about
+       modifying any of the generated code directly.  Any changes/fixes
+       should be done in the code generation script generation.*/\n"""%pyname
+
+cxxfile = open(cxxname, "w")
+cxxfile.write(src)
+cxxfile.close()
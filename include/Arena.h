@@ -0,0 +1,245 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <functional>
+
+/*! \brief Per-thread bump allocator for kernel temporaries.
+ *
+ * Adaptivity kernels build small temporary containers on every call.
+ * Allocating these from an Arena turns each allocation into a pointer
+ * increment; everything is released at once when the outermost
+ * ArenaScope of the thread is left. If a kernel outgrows the current
+ * buffer, further buffers are taken from the system and merged into a
+ * single larger buffer on release, so that after a warm-up the kernels
+ * no longer call malloc at all.
+ */
+class Arena
+{
+public:
+    Arena() : buffer(NULL), capacity(0), offset(0), depth(0), nmallocs(0)
+    {
+    }
+
+    ~Arena()
+    {
+        release();
+        free(buffer);
+    }
+
+    /// Arena of the calling thread.
+    static Arena &thread_arena()
+    {
+        static thread_local Arena arena;
+        return arena;
+    }
+
+    void *allocate(size_t bytes)
+    {
+        // Keep every allocation 16 byte aligned.
+        bytes = (bytes+15) & ~(size_t)15;
+        if(offset+bytes>capacity)
+            grow(bytes);
+
+        void *ptr = buffer+offset;
+        offset += bytes;
+
+        return ptr;
+    }
+
+    void enter()
+    {
+        depth++;
+    }
+
+    void leave()
+    {
+        if(--depth==0)
+            release();
+    }
+
+    /// Number of buffers requested from the system so far.
+    size_t get_number_mallocs() const
+    {
+        return nmallocs;
+    }
+
+private:
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+
+    void grow(size_t bytes)
+    {
+        if(buffer!=NULL)
+            retired.push_back(std::make_pair(buffer, capacity));
+
+        capacity = std::max(bytes, std::max(2*capacity, (size_t)4096));
+        buffer = system_allocate(capacity);
+        offset = 0;
+    }
+
+    void release()
+    {
+        if(!retired.empty()) {
+            size_t total = capacity;
+            for(size_t i=0; i<retired.size(); i++) {
+                total += retired[i].second;
+                free(retired[i].first);
+            }
+            retired.clear();
+
+            free(buffer);
+            capacity = total;
+            buffer = system_allocate(capacity);
+        }
+        offset = 0;
+    }
+
+    char *system_allocate(size_t bytes)
+    {
+        nmallocs++;
+        char *ptr = static_cast<char *>(malloc(bytes));
+        if(ptr==NULL)
+            throw std::bad_alloc();
+        return ptr;
+    }
+
+    char *buffer;
+    size_t capacity, offset;
+    int depth;
+    size_t nmallocs;
+    std::vector< std::pair<char *, size_t> > retired;
+};
+
+/*! \brief Marks the lifetime of arena allocations made by this thread.
+ *
+ * Declare one at the top of a kernel, before any arena-backed
+ * container, so that the containers are destroyed before the memory
+ * is recycled.
+ */
+class ArenaScope
+{
+public:
+    ArenaScope()
+    {
+        Arena::thread_arena().enter();
+    }
+
+    ~ArenaScope()
+    {
+        Arena::thread_arena().leave();
+    }
+
+private:
+    ArenaScope(const ArenaScope&);
+    ArenaScope& operator=(const ArenaScope&);
+};
+
+/// Standard allocator drawing from the arena of the calling thread.
+template<typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template<typename U>
+    struct rebind {
+        typedef ArenaAllocator<U> other;
+    };
+
+    ArenaAllocator()
+    {
+    }
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>&)
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(Arena::thread_arena().allocate(n*sizeof(T)));
+    }
+
+    void deallocate(T*, size_t)
+    {
+    }
+};
+
+template<typename T, typename U>
+inline bool operator==(const ArenaAllocator<T>&, const ArenaAllocator<U>&)
+{
+    return true;
+}
+
+template<typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T>&, const ArenaAllocator<U>&)
+{
+    return false;
+}
+
+// Containers for kernel temporaries. These must only live inside an ArenaScope.
+template<typename T>
+using arena_vector = std::vector<T, ArenaAllocator<T> >;
+
+template<typename T>
+using arena_deque = std::deque<T, ArenaAllocator<T> >;
+
+template<typename T>
+using arena_set = std::set<T, std::less<T>, ArenaAllocator<T> >;
+
+template<typename Key, typename T>
+using arena_map = std::map<Key, T, std::less<Key>, ArenaAllocator< std::pair<const Key, T> > >;
+
+#endif
@@ -48,6 +48,8 @@
 #include <boost/unordered_map.hpp>
 #endif
 
+#include "Arena.h"
+#include "DeferredOperations.h"
 #include "ElementProperty.h"
 #include "Mesh.h"
 
@@ -84,6 +86,9 @@ public:
         }
 
         nnodes_reserve = 0;
+        nthreads = pragmatic_nthreads();
+        def_ops = new DeferredOperations<real_t>(_mesh, nthreads, defOp_scaling_factor);
+
         delete_slivers = false;
         surface_coarsening = false;
         internal_surface_coarsening = false;
@@ -95,6 +100,8 @@ public:
     {
         if(property!=NULL)
             delete property;
+
+        delete def_ops;
     }
 
     /*! Perform coarsening.
@@ -117,31 +124,140 @@ public:
         _L_low = L_low;
         _L_max = L_max;
 
+        // Only edges which changed since the last operation are re-measured,
+        // and only with the arithmetic mean length used for coarsening.
+        _mesh->update_edges(Mesh<real_t>::EDGE_LENGTH);
+
         if(nnodes_reserve<NNodes) {
             nnodes_reserve = NNodes;
+
+            dynamic_vertex.resize(NNodes);
+            vertex_dirty.resize(NNodes, 0);
+        }
+
+        // Identify the collapse (if any) for every vertex.
+        #pragma omp parallel for num_threads(nthreads) schedule(guided)
+        for(index_t node=0; node<(index_t)NNodes; ++node) {
+            dynamic_vertex[node] = coarsen_identify_kernel(node, L_low, L_max);
         }
 
-        int ccount_ite, ccount_tot = 0;
-        for(int citerations=0; citerations<100; citerations++) {
-            ccount_ite = 0;
-            for(index_t node=0; node<NNodes; ++node) { // TODO Need to consider randomising order to avoid mesh artifacts related to numbering.
-                index_t target = coarsen_identify_kernel(node, L_low, L_max);
-                if(target>=0) {
-                    coarsen_kernel(node, target);
+        std::vector<index_t> candidates, next_candidates, touched;
+        for(index_t node=0; node<(index_t)NNodes; ++node) {
+            if(dynamic_vertex[node]>=0)
+                candidates.push_back(node);
+        }
+
+        std::vector< std::vector<index_t> > thread_touched(nthreads);
+        std::vector<char> selected;
+
+        int ccount_tot = 0;
+        while(!candidates.empty()) {
+            const size_t ncandidates = candidates.size();
+            selected.assign(ncandidates, 0);
+
+            int ccount_ite = 0;
+            #pragma omp parallel num_threads(nthreads) reduction(+:ccount_ite)
+            {
+                const int tid = pragmatic_thread_id();
+
+                // Select a set of non-conflicting collapses.
+                #pragma omp for schedule(guided)
+                for(size_t i=0; i<ncandidates; ++i) {
+                    selected[i] = is_independent(candidates[i]);
+                }
+
+                /* Collapse the selected vertices. Static scheduling keeps the
+                   order in which deferred operations are committed, and hence
+                   the resulting mesh, independent of the number of threads. */
+                #pragma omp for schedule(static)
+                for(size_t i=0; i<ncandidates; ++i) {
+                    if(!selected[i])
+                        continue;
+
+                    index_t rm_vertex = candidates[i];
+
+                    // Everything within two edges of rm_vertex has to be re-identified.
+                    thread_touched[tid].push_back(rm_vertex);
+                    for(const auto &nn : _mesh->NNList[rm_vertex]) {
+                        thread_touched[tid].push_back(nn);
+                        thread_touched[tid].insert(thread_touched[tid].end(), _mesh->NNList[nn].begin(), _mesh->NNList[nn].end());
+                    }
+
+                    coarsen_kernel(rm_vertex, dynamic_vertex[rm_vertex], tid);
                     ccount_ite++;
-                    ccount_tot++;
                 }
+
+                // Commit adjacency updates. Each virtual thread owns a disjoint set of vertices.
+                def_ops->commit();
             }
-            if(ccount_ite==0) {
-                break;
+            ccount_tot += ccount_ite;
+
+            touched.clear();
+            for(int i=0; i<nthreads; ++i) {
+                touched.insert(touched.end(), thread_touched[i].begin(), thread_touched[i].end());
+                thread_touched[i].clear();
+            }
+            std::sort(touched.begin(), touched.end());
+            touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+
+            // Candidates that were neither collapsed nor touched keep their target.
+            next_candidates.clear();
+            for(const auto &nid : touched)
+                vertex_dirty[nid] = 1;
+            for(size_t i=0; i<ncandidates; ++i) {
+                if(!selected[i] && !vertex_dirty[candidates[i]])
+                    next_candidates.push_back(candidates[i]);
             }
+
+            #pragma omp parallel for num_threads(nthreads) schedule(guided)
+            for(size_t i=0; i<touched.size(); ++i) {
+                dynamic_vertex[touched[i]] = coarsen_identify_kernel(touched[i], L_low, L_max);
+            }
+
+            for(const auto &nid : touched) {
+                vertex_dirty[nid] = 0;
+                if(dynamic_vertex[nid]>=0)
+                    next_candidates.push_back(nid);
+            }
+            std::sort(next_candidates.begin(), next_candidates.end());
+            candidates.swap(next_candidates);
         }
+
         printf("DEBUG   Number of edge collapse %d\n", ccount_tot);
         return ccount_tot;
     }
 
 private:
 
+    /*! Returns true if the collapse selected for rm_vertex does not conflict
+     * with any other selected collapse of higher priority. Two collapses
+     * conflict if the vertex removed by one is adjacent to the vertex
+     * removed by, or the target of, the other. Priorities are a hash of the
+     * vertex ID so that the selection does not follow the mesh numbering.
+     */
+    inline bool is_independent(index_t rm_vertex) const
+    {
+        const uint32_t priority = pragmatic_hash(rm_vertex);
+        const index_t target_vertex = dynamic_vertex[rm_vertex];
+
+        for(const auto &nn : _mesh->NNList[rm_vertex]) {
+            if(dynamic_vertex[nn]>=0 && pragmatic_hash(nn)>priority)
+                return false;
+
+            // Vertices collapsing onto a neighbour of rm_vertex.
+            for(const auto &mm : _mesh->NNList[nn]) {
+                if(dynamic_vertex[mm]==nn && pragmatic_hash(mm)>priority)
+                    return false;
+            }
+        }
+
+        for(const auto &nn : _mesh->NNList[target_vertex]) {
+            if(nn!=rm_vertex && dynamic_vertex[nn]>=0 && pragmatic_hash(nn)>priority)
+                return false;
+        }
+
+        return true;
+    }
 
     /*! Kernel for identifying what vertex (if any) rm_vertex should collapse onto.
      * See Figure 15; X Li et al, Comp Methods Appl Mech Engrg 194 (2005) 4915-4950
@@ -158,9 +274,11 @@ private:
         if(_mesh->is_halo_node(rm_vertex))
             return -1;
 
-        std::set<int> regions;
+        ArenaScope scope;
+
+        SmallSet<int, 8> regions;
         index_t target_vertex=-1;
-        std::set<index_t>::const_iterator ee;
+        element_set_t::const_iterator ee;
         for (ee = _mesh->NEList[rm_vertex].begin(); ee != _mesh->NEList[rm_vertex].end(); ++ee) {
             regions.insert(_mesh->get_elementTag(*ee));
         }
@@ -168,7 +286,7 @@ private:
         //
         bool delete_with_extreme_prejudice = false;
         if(delete_slivers && dim==3) {
-            std::set<index_t>::const_iterator ee=_mesh->NEList[rm_vertex].begin();
+            element_set_t::const_iterator ee=_mesh->NEList[rm_vertex].begin();
             double q_linf = _mesh->quality[*ee];
             ++ee;
     
@@ -183,19 +301,22 @@ private:
         /* Sort the edges according to length. We want to collapse the
            shortest. If it is not possible to collapse the edge then move
            onto the next shortest.*/
-        std::multimap<real_t, index_t> short_edges;
+        arena_vector< std::pair<real_t, index_t> > short_edges;
         for(const auto &nn : _mesh->NNList[rm_vertex]) {
-            double length = _mesh->calc_edge_length(rm_vertex, nn);
+            double length = _mesh->get_edge_length(rm_vertex, nn);
             if(length<L_low || delete_with_extreme_prejudice)
-                short_edges.insert(std::pair<real_t, index_t>(length, nn));
+                short_edges.push_back(std::pair<real_t, index_t>(length, nn));
         }
+        std::stable_sort(short_edges.begin(), short_edges.end(),
+                         [](const std::pair<real_t, index_t> &a, const std::pair<real_t, index_t> &b) {
+                             return a.first<b.first;
+                         });
 
         bool reject_collapse = false;
-        while(short_edges.size()) {
+        for(const auto &short_edge : short_edges) {
 
             // Get the next shortest edge.
-            target_vertex = short_edges.begin()->second;
-            short_edges.erase(short_edges.begin());
+            target_vertex = short_edge.second;
     
             // Assume the best.
             reject_collapse = false;
@@ -213,14 +334,14 @@ private:
                 }
             }
 
-            std::set<index_t>::const_iterator region_it;
+            SmallSet<int, 8>::const_iterator region_it;
             for (region_it = regions.begin(); region_it != regions.end(); ++region_it) {
 
                 int region = *region_it;
 
                 if ((surface_coarsening || internal_surface_coarsening) && boundary_id > 0) {
 
-                    std::set<index_t> compromised_boundary;
+                    SmallSet<int, 8> compromised_boundary;
                     for(const auto &element : _mesh->NEList[rm_vertex]) {
                         if (_mesh->get_elementTag(element) != region)
                             continue;
@@ -241,7 +362,7 @@ private:
 
                     if(compromised_boundary.size()==1) {
                         // Only allow this vertex to be collapsed to a vertex on the same boundary (not to an internal vertex).
-                        std::set<index_t> target_boundary;
+                        SmallSet<int, 8> target_boundary;
                         for(const auto &element : _mesh->NEList[target_vertex]) {
                             if (_mesh->get_elementTag(element) != region)
                                 continue;
@@ -261,17 +382,10 @@ private:
                                 continue;
                             }
     
-                            std::set<index_t> deleted_elements;
-                            std::set_intersection(_mesh->NEList[rm_vertex].begin(), _mesh->NEList[rm_vertex].end(),
-                                                  _mesh->NEList[target_vertex].begin(), _mesh->NEList[target_vertex].end(),
-                                                  std::inserter(deleted_elements, deleted_elements.begin()));
-
-                            std::set<index_t>::const_iterator el_it;
-                            for (el_it = deleted_elements.begin(); el_it != deleted_elements.end(); ){
-                                if (_mesh->get_elementTag(*el_it) != region)
-                                    el_it = deleted_elements.erase(el_it);
-                                else
-                                    el_it++;
+                            arena_vector<index_t> deleted_elements;
+                            for(const auto &eid : _mesh->NEList[rm_vertex]) {
+                                if(_mesh->NEList[target_vertex].count(eid) && _mesh->get_elementTag(eid) == region)
+                                    deleted_elements.push_back(eid);
                             }
     
                             if(dim==2) {
@@ -366,7 +480,7 @@ private:
                         continue;
 
                     // Create a copy of the proposed element
-                    std::vector<int> n(nloc);
+                    index_t n[nloc];
                     for(size_t i=0; i<nloc; i++) {
                         int nid = old_n[i];
                         if (nid==rm_vertex)
@@ -437,7 +551,7 @@ private:
                     for (const auto &nn : _mesh->NNList[rm_vertex]) {
                         if (target_vertex==nn)
                             continue;
-                        if (_mesh->calc_edge_length(target_vertex, nn)>L_max) {
+                        if (_mesh->get_edge_length(target_vertex, nn)>L_max) {
                             reject_collapse = true;
                             break;
                         }
@@ -474,25 +588,29 @@ private:
 
     /*! Kernel for performing coarsening.
      * See Figure 15; X Li et al, Comp Methods Appl Mech Engrg 194 (2005) 4915-4950
+     * Changes to the adjacency of any vertex other than rm_vertex are deferred.
      */
-    inline void coarsen_kernel(index_t rm_vertex, index_t target_vertex)
+    inline void coarsen_kernel(index_t rm_vertex, index_t target_vertex, int tid)
     {
-        const double * rm_crd = _mesh->get_coords(rm_vertex);
+        ArenaScope scope;
+
+        const real_t *rm_crd = _mesh->get_coords(rm_vertex);
 
         // TODO As we don't coarsen accross internal boudaries and don't create 
         //  new elements, no need to worry about element tags
 
-        std::set<index_t> deleted_elements;
+        arena_vector<index_t> deleted_elements;
         std::set_intersection(_mesh->NEList[rm_vertex].begin(), _mesh->NEList[rm_vertex].end(),
                               _mesh->NEList[target_vertex].begin(), _mesh->NEList[target_vertex].end(),
-                              std::inserter(deleted_elements, deleted_elements.begin()));
+                              std::back_inserter(deleted_elements));
 
         // Clean NEList, update boundary and spike ENList.
         for(const auto &eid : deleted_elements) {
             const index_t *n = _mesh->get_element(eid);
 
             // Find falling facet.
-            int falling_facet[ndims], pos=0;
+            index_t falling_facet[ndims];
+            int pos=0;
             int inherit_boundary_id=0;
             int target_boundary_id=0;
             for (int i=0; i<nloc; i++) {
@@ -508,23 +626,14 @@ private:
             }
 
             // Find associated element.
-            std::set<index_t> associated_elements;
-            std::set_intersection(_mesh->NEList[falling_facet[0]].begin(), _mesh->NEList[falling_facet[0]].end(),
-                                  _mesh->NEList[falling_facet[1]].begin(), _mesh->NEList[falling_facet[1]].end(),
-                                  std::inserter(associated_elements, associated_elements.begin()));
-            if (ndims==3) {
-                std::set<index_t> associated_elements3;
-                std::set_intersection(_mesh->NEList[falling_facet[2]].begin(), _mesh->NEList[falling_facet[2]].end(),
-                                      associated_elements.begin(), associated_elements.end(),
-                                      std::inserter(associated_elements3, associated_elements3.begin()));
-                associated_elements.swap(associated_elements3);
-            }
+            index_t associated_elements[2];
+            int nassociated_elements = _mesh->get_facet_elements(falling_facet, ndims, associated_elements);
 
-            if (associated_elements.size()==1 || (associated_elements.size()==2 && _mesh->is_internal_boundary(target_boundary_id))) {
+            if (nassociated_elements==1 || (nassociated_elements==2 && _mesh->is_internal_boundary(target_boundary_id))) {
                 // my falling facet is a boundary facet, 
                 // in which case the facet onto which it is falling should inherit the falling facet tag 
                 // if it is an internal facet
-                int falled_faced[ndims]; // facet opposite to rm_vertex, ie the one onto which the falling facet falls
+                index_t falled_faced[ndims]; // facet opposite to rm_vertex, ie the one onto which the falling facet falls
                 int pos = 0;
                 for (int i=0; i<nloc; i++) {
                     if (n[i]!=rm_vertex) {
@@ -536,23 +645,13 @@ private:
                 // If rm_facet should has 2 neighbors, one of which is the deleted tet, 
                 //    another one in which I must find the facet and update it boundary id
                 // Find associated elements.
-                std::set<index_t> associated_elements_falled_facet;
-                std::set_intersection(_mesh->NEList[falled_faced[0]].begin(), _mesh->NEList[falled_faced[0]].end(),
-                                      _mesh->NEList[falled_faced[1]].begin(), _mesh->NEList[falled_faced[1]].end(),
-                                      std::inserter(associated_elements_falled_facet, 
-                                      associated_elements_falled_facet.begin()));
-                if (ndims==3) {
-                    std::set<index_t> associated_elements3_falled_facet;
-                    std::set_intersection(_mesh->NEList[falled_faced[2]].begin(), _mesh->NEList[falled_faced[2]].end(),
-                                          associated_elements_falled_facet.begin(), associated_elements_falled_facet.end(),
-                                          std::inserter(associated_elements3_falled_facet, associated_elements3_falled_facet.begin()));
-                    associated_elements_falled_facet.swap(associated_elements3_falled_facet);
-                }
+                index_t associated_elements_falled_facet[2];
+                int nassociated_elements_falled_facet = _mesh->get_facet_elements(falled_faced, ndims, associated_elements_falled_facet);
                 // find element on the other side of the facet
-                if (associated_elements_falled_facet.size()==2) {
-                    int associated_element_falled_facet = *associated_elements_falled_facet.begin();
+                if (nassociated_elements_falled_facet==2) {
+                    int associated_element_falled_facet = associated_elements_falled_facet[0];
                     if (associated_element_falled_facet == eid) {
-                        associated_element_falled_facet = *associated_elements_falled_facet.rbegin();
+                        associated_element_falled_facet = associated_elements_falled_facet[1];
                     }
                     // find facet in the element
                     const index_t *m = _mesh->get_element(associated_element_falled_facet);
@@ -570,10 +669,10 @@ private:
                     _mesh->boundary[associated_element_falled_facet*nloc+iFacet] = inherit_boundary_id;
                 }
             }
-            else if (associated_elements.size()==2) {
-                int associated_element = *associated_elements.begin();
+            else if (nassociated_elements==2) {
+                int associated_element = associated_elements[0];
                 if (associated_element==eid) {
-                    associated_element = *associated_elements.rbegin();
+                    associated_element = associated_elements[1];
                 }
 
                 // Locate falling facet on this element.
@@ -595,7 +694,10 @@ private:
                 }
             }
             for(size_t i=0; i<nloc; ++i) {
-                _mesh->NEList[n[i]].erase(eid);
+                if(n[i]==rm_vertex)
+                    _mesh->NEList[rm_vertex].erase(eid);
+                else
+                    def_ops->remNE(n[i], eid, tid);
             }
 
             // Remove element from mesh.
@@ -603,7 +705,7 @@ private:
         }
 
         // For all adjacent elements, replace rm_vertex with target_vertex in ENList and update quality.
-        std::vector<index_t> new_edges;
+        arena_vector<index_t> new_edges;
         for(const auto& eid : _mesh->NEList[rm_vertex]) {
             assert(_mesh->_ENList[nloc*eid]!=-1);
 
@@ -618,20 +720,21 @@ private:
             _mesh->template update_quality<dim>(eid);
 
             // Add element to target_vertex's NEList.
-            _mesh->NEList[target_vertex].insert(eid);
+            def_ops->addNE(target_vertex, eid, tid);
         }
 
         // Update surrounding NNList.
         for(const auto& nid : _mesh->NNList[rm_vertex]) {
-            auto it = std::find(_mesh->NNList[nid].begin(), _mesh->NNList[nid].end(), rm_vertex);
-            _mesh->NNList[nid].erase(it);
+            def_ops->remNN(nid, rm_vertex, tid);
         }
+        std::sort(new_edges.begin(), new_edges.end());
+        new_edges.erase(std::unique(new_edges.begin(), new_edges.end()), new_edges.end());
         for(const auto &nid : new_edges) {
             if(std::find(_mesh->NNList[nid].begin(), _mesh->NNList[nid].end(), target_vertex)==_mesh->NNList[nid].end())
-                _mesh->NNList[nid].push_back(target_vertex);
+                def_ops->addNN(nid, target_vertex, tid);
 
             if(std::find(_mesh->NNList[target_vertex].begin(), _mesh->NNList[target_vertex].end(), nid)==_mesh->NNList[target_vertex].end())
-                _mesh->NNList[target_vertex].push_back(nid);
+                def_ops->addNN(target_vertex, nid, tid);
         }
         _mesh->erase_vertex(rm_vertex);
     }
@@ -641,6 +744,14 @@ private:
 
     size_t nnodes_reserve;
 
+    // Collapse target of each vertex; negative if the vertex cannot be collapsed.
+    std::vector<index_t> dynamic_vertex;
+    std::vector<char> vertex_dirty;
+
+    DeferredOperations<real_t>* def_ops;
+    static const int defOp_scaling_factor = 32;
+    int nthreads;
+
     real_t _L_low, _L_max;
     bool delete_slivers, surface_coarsening, internal_surface_coarsening, quality_constrained;
 
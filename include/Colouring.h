@@ -0,0 +1,243 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef COLOURING_H
+#define COLOURING_H
+
+#include <algorithm>
+#include <vector>
+
+#include "Mesh.h"
+
+/*! \brief Parallel colouring of the vertex graph (NNList).
+ *
+ * Vertices of the same colour are never adjacent, so mesh kernels can
+ * process each colour class concurrently. Colours are assigned with the
+ * Jones-Plassmann algorithm using hashed vertex IDs as priorities, so the
+ * colouring does not depend on the number of threads. After the topology
+ * has changed, update() only recolours vertices which are new, have been
+ * reset (see DeferredOperations::reset_colour) or clash with a neighbour.
+ */
+template<typename real_t>
+class Colouring
+{
+public:
+    Colouring(Mesh<real_t>* mesh, const int num_threads)
+        : nthreads(num_threads)
+    {
+        _mesh = mesh;
+        ncolours = 0;
+    }
+
+    ~Colouring() {}
+
+    /// Colour all vertices from scratch.
+    void colour()
+    {
+        node_colour.assign(_mesh->get_number_nodes(), -1);
+        colour_pending();
+        create_classes();
+    }
+
+    /// Repair the colouring after the mesh topology has changed.
+    void update()
+    {
+        index_t NNodes = _mesh->get_number_nodes();
+        node_colour.resize(NNodes, -1);
+
+        // Of two neighbours sharing a colour, the one with the higher ID
+        // gives up its colour.
+        std::vector<char> clash(NNodes, 0);
+#pragma omp parallel num_threads(nthreads)
+        {
+#pragma omp for schedule(guided)
+            for(index_t i=0; i<NNodes; ++i) {
+                if(node_colour[i]<0)
+                    continue;
+
+                for(auto& nn : _mesh->NNList[i]) {
+                    if(nn<i && node_colour[nn]==node_colour[i]) {
+                        clash[i] = 1;
+                        break;
+                    }
+                }
+            }
+
+#pragma omp for schedule(static)
+            for(index_t i=0; i<NNodes; ++i) {
+                if(clash[i])
+                    node_colour[i] = -1;
+            }
+        }
+
+        colour_pending();
+        create_classes();
+    }
+
+    /// Mark vertex nid to be recoloured by the next update(). Not thread-safe;
+    /// concurrent kernels should use DeferredOperations::reset_colour instead.
+    inline void reset(index_t nid)
+    {
+        node_colour[nid] = -1;
+    }
+
+    /// Colour of each vertex, -1 if the vertex is not coloured.
+    inline int* get_node_colour()
+    {
+        return node_colour.data();
+    }
+
+    inline int get_number_of_colours() const
+    {
+        return ncolours;
+    }
+
+    /// Number of vertices in colour class c.
+    inline index_t get_class_size(int c) const
+    {
+        return colour_ptr[c+1]-colour_ptr[c];
+    }
+
+    /// Vertices of colour class c, in ascending order.
+    inline const index_t* get_colour_class(int c) const
+    {
+        return colour_members.data()+colour_ptr[c];
+    }
+
+private:
+    /// Colour all connected vertices which do not have a colour yet.
+    void colour_pending()
+    {
+        index_t NNodes = _mesh->get_number_nodes();
+
+        std::vector<index_t> pending, next_pending;
+        for(index_t i=0; i<NNodes; ++i) {
+            if(node_colour[i]<0 && !_mesh->NNList[i].empty())
+                pending.push_back(i);
+        }
+
+        std::vector<char> ready;
+        while(!pending.empty()) {
+            ready.resize(pending.size());
+
+#pragma omp parallel num_threads(nthreads)
+            {
+                // A vertex is ready once it has the highest priority
+                // among its uncoloured neighbours. Ready vertices are
+                // never adjacent, so they can pick colours concurrently.
+#pragma omp for schedule(guided)
+                for(size_t k=0; k<pending.size(); ++k) {
+                    index_t v = pending[k];
+                    ready[k] = 1;
+                    for(auto& nn : _mesh->NNList[v]) {
+                        if(node_colour[nn]<0 && priority(nn, v)) {
+                            ready[k] = 0;
+                            break;
+                        }
+                    }
+                }
+
+                std::vector<char> used;
+#pragma omp for schedule(guided)
+                for(size_t k=0; k<pending.size(); ++k) {
+                    if(!ready[k])
+                        continue;
+
+                    index_t v = pending[k];
+                    used.assign(_mesh->NNList[v].size()+1, 0);
+                    for(auto& nn : _mesh->NNList[v]) {
+                        int c = node_colour[nn];
+                        if(c>=0 && c<(int)used.size())
+                            used[c] = 1;
+                    }
+
+                    int c = 0;
+                    while(used[c])
+                        c++;
+                    node_colour[v] = c;
+                }
+            }
+
+            next_pending.clear();
+            for(size_t k=0; k<pending.size(); ++k) {
+                if(!ready[k])
+                    next_pending.push_back(pending[k]);
+            }
+            pending.swap(next_pending);
+        }
+    }
+
+    /// Group connected vertices by colour.
+    void create_classes()
+    {
+        index_t NNodes = _mesh->get_number_nodes();
+
+        ncolours = 0;
+        for(index_t i=0; i<NNodes; ++i)
+            ncolours = std::max(ncolours, node_colour[i]+1);
+
+        colour_ptr.assign(ncolours+1, 0);
+        for(index_t i=0; i<NNodes; ++i)
+            if(node_colour[i]>=0 && !_mesh->NNList[i].empty())
+                colour_ptr[node_colour[i]+1]++;
+        for(int c=0; c<ncolours; ++c)
+            colour_ptr[c+1] += colour_ptr[c];
+
+        colour_members.resize(colour_ptr[ncolours]);
+        std::vector<index_t> cnt(colour_ptr.begin(), colour_ptr.end()-1);
+        for(index_t i=0; i<NNodes; ++i)
+            if(node_colour[i]>=0 && !_mesh->NNList[i].empty())
+                colour_members[cnt[node_colour[i]]++] = i;
+    }
+
+    /// True if vertex a takes precedence over vertex b.
+    inline bool priority(index_t a, index_t b) const
+    {
+        uint32_t ha = pragmatic_hash(a), hb = pragmatic_hash(b);
+        return ha>hb || (ha==hb && a>b);
+    }
+
+    std::vector<int> node_colour;
+    std::vector<index_t> colour_ptr, colour_members;
+    int ncolours;
+
+    const int nthreads;
+
+    Mesh<real_t>* _mesh;
+};
+
+#endif
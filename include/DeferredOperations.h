@@ -36,7 +36,7 @@
 #ifndef DEFERRED_OPERATIONS_H
 #define DEFERRED_OPERATIONS_H
 
-#include <set>
+#include <algorithm>
 #include <vector>
 
 #include "Mesh.h"
@@ -58,26 +58,26 @@ public:
 
     inline void addNN(const index_t i, const index_t n, const int tid=0)
     {
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].addNN.push_back(i);
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].addNN.push_back(n);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].addNN.push_back(i);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].addNN.push_back(n);
     }
 
     inline void remNN(const index_t i, const index_t n, const int tid=0)
     {
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].remNN.push_back(i);
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].remNN.push_back(n);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].remNN.push_back(i);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].remNN.push_back(n);
     }
 
     inline void addNE(const index_t i, const index_t n, const int tid=0)
     {
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].addNE.push_back(i);
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].addNE.push_back(n);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].addNE.push_back(i);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].addNE.push_back(n);
     }
 
     inline void addNE_fix(const index_t i, const index_t n, const int tid=0)
     {
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].addNE_fix.push_back(i);
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].addNE_fix.push_back(n);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].addNE_fix.push_back(i);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].addNE_fix.push_back(n);
     }
 
     inline void repEN(const size_t pos, const index_t n, const int tid=0)
@@ -88,37 +88,70 @@ public:
 
     inline void remNE(const index_t i, const index_t n, const int tid=0)
     {
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].remNE.push_back(i);
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].remNE.push_back(n);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].remNE.push_back(i);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].remNE.push_back(n);
     }
 
     inline void propagate_coarsening(const index_t i, const int tid=0)
     {
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].coarsening_propagation.push_back(i);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].coarsening_propagation.push_back(i);
     }
 
     inline void propagate_refinement(const index_t i, const index_t n, const int tid=0)
     {
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].refinement_propagation.push_back(i);
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].refinement_propagation.push_back(n);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].refinement_propagation.push_back(i);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].refinement_propagation.push_back(n);
     }
 
     inline void propagate_swapping(const index_t i, const index_t n, const int tid=0)
     {
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].swapping_propagation.push_back(i);
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].swapping_propagation.push_back(n);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].swapping_propagation.push_back(i);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].swapping_propagation.push_back(n);
     }
 
     inline void reset_colour(const index_t i, const int tid=0)
     {
-        deferred_operations[tid][hash(i) % (defOp_scaling_factor*nthreads)].reset_colour.push_back(i);
+        deferred_operations[tid][pragmatic_hash(i) % (defOp_scaling_factor*nthreads)].reset_colour.push_back(i);
+    }
+
+    /*! Commit all queued topology updates (remNN, addNN, remNE, addNE,
+     * addNE_fix and repEN) from every thread. Shard vtid only holds
+     * updates to vertices i with hash(i)%(defOp_scaling_factor*nthreads)==vtid,
+     * so shards are committed concurrently without locking NNList or
+     * NEList. Updates of a shard are applied in thread order, which makes
+     * the result independent of scheduling. Call this from all threads of
+     * the enclosing parallel region, or from serial code. threadIdx is only
+     * needed if addNE_fix was used. If slots is given, the fixed ID of an
+     * element is looked up in slots rather than used directly.
+     */
+    inline void commit(const size_t* threadIdx=NULL, const index_t* slots=NULL)
+    {
+#pragma omp for schedule(guided)
+        for(int vtid=0; vtid<defOp_scaling_factor*nthreads; ++vtid) {
+            for(int t=0; t<nthreads; ++t)
+                commit_remNN(t, vtid);
+            for(int t=0; t<nthreads; ++t)
+                commit_addNN(t, vtid);
+            for(int t=0; t<nthreads; ++t)
+                commit_remNE(t, vtid);
+            for(int t=0; t<nthreads; ++t)
+                commit_addNE(t, vtid);
+            if(threadIdx!=NULL) {
+                for(int t=0; t<nthreads; ++t)
+                    commit_addNE_fix(threadIdx[t], slots, t, vtid);
+            }
+            for(int t=0; t<nthreads; ++t)
+                commit_repEN(t, vtid);
+        }
     }
 
     inline void commit_addNN(const int tid, const int vtid)
     {
         for(typename std::vector<index_t>::const_iterator it=deferred_operations[tid][vtid].addNN.begin();
                 it!=deferred_operations[tid][vtid].addNN.end(); it+=2) {
-            _mesh->NNList[*it].push_back(*(it+1));
+            // Several operations may introduce the same edge.
+            if(std::find(_mesh->NNList[*it].begin(), _mesh->NNList[*it].end(), *(it+1))==_mesh->NNList[*it].end())
+                _mesh->NNList[*it].push_back(*(it+1));
         }
 
         deferred_operations[tid][vtid].addNN.clear();
@@ -146,12 +179,14 @@ public:
         deferred_operations[tid][vtid].addNE.clear();
     }
 
-    inline void commit_addNE_fix(size_t threadIdx, const int tid, const int vtid)
+    inline void commit_addNE_fix(size_t threadIdx, const index_t* slots, const int tid, const int vtid)
     {
         for(typename std::vector<index_t>::const_iterator it=deferred_operations[tid][vtid].addNE_fix.begin();
                 it!=deferred_operations[tid][vtid].addNE_fix.end(); it+=2) {
             // Element was created by thread tid
             index_t fixedId = *(it+1) + threadIdx;
+            if(slots!=NULL)
+                fixedId = slots[fixedId];
             _mesh->NEList[*it].insert(fixedId);
         }
 
@@ -189,7 +224,7 @@ public:
         deferred_operations[tid][vtid].coarsening_propagation.clear();
     }
 
-    inline void commit_refinement_propagation(std::vector< std::set<index_t> >& marked_edges, const int tid, const int vtid)
+    inline void commit_refinement_propagation(std::vector<vertex_set_t>& marked_edges, const int tid, const int vtid)
     {
         for(typename std::vector<index_t>::const_iterator it=deferred_operations[tid][vtid].refinement_propagation.begin();
                 it!=deferred_operations[tid][vtid].refinement_propagation.end(); it+=2) {
@@ -199,7 +234,7 @@ public:
         deferred_operations[tid][vtid].refinement_propagation.clear();
     }
 
-    inline void commit_swapping_propagation(std::vector< std::set<index_t> >& marked_edges, const int tid, const int vtid)
+    inline void commit_swapping_propagation(std::vector<vertex_set_t>& marked_edges, const int tid, const int vtid)
     {
         for(typename std::vector<index_t>::const_iterator it=deferred_operations[tid][vtid].swapping_propagation.begin();
                 it!=deferred_operations[tid][vtid].swapping_propagation.end(); it+=2) {
@@ -213,24 +248,13 @@ public:
     {
         for(typename std::vector<index_t>::const_iterator it=deferred_operations[tid][vtid].reset_colour.begin();
                 it!=deferred_operations[tid][vtid].reset_colour.end(); ++it) {
-            node_colour[*it] = 0;
+            node_colour[*it] = -1;
         }
 
         deferred_operations[tid][vtid].reset_colour.clear();
     }
 
 private:
-    /*
-     * Park & Miller (aka Lehmer) pseudo-random number generation. Possible bug if
-     * index_t is a datatype longer than 32 bits. However, in the context of a single
-     * MPI node, it is highly unlikely that index_t will ever need to be longer.
-     * A 64-bit datatype makes sense only for global node numbers, not local.
-     */
-    inline uint32_t hash(const uint32_t id) const
-    {
-        return ((uint64_t)id * 279470273UL) % 4294967291UL;
-    }
-
     struct def_op_t {
         // Mesh
         std::vector<index_t> addNN; // addNN -> [i, n] : Add node n to NNList[i].
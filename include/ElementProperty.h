@@ -48,6 +48,9 @@
 #include <cmath>
 
 #include <cfloat>
+#include <limits>
+
+#include "PragmaticTypes.h"
 
 /*! \brief Calculates a number of element properties.
  *
@@ -210,7 +213,7 @@ public:
      * @param m metric tensor for first point.
      */
     template<int dim>
-    inline double length(const real_t x0[], const real_t x1[], const double m[]) const
+    inline double length(const real_t x0[], const real_t x1[], const real_t m[]) const
     {
         if(dim==2) {
             return length2d(x0, x1, m);
@@ -225,7 +228,7 @@ public:
      * @param x1 coordinate at finish of line segment.
      * @param m metric tensor for first point.
      */
-    static inline double length2d(const real_t x0[], const real_t x1[], const double m[])
+    static inline double length2d(const real_t x0[], const real_t x1[], const real_t m[])
     {
         double x=x0[0] - x1[0];
         double y=x0[1] - x1[1];
@@ -247,7 +250,7 @@ public:
      * @param x1 coordinate at finish of line segment.
      * @param m metric tensor for first point.
      */
-    static inline double length3d(const real_t x0[], const real_t x1[], const double m[])
+    static inline double length3d(const real_t x0[], const real_t x1[], const real_t m[])
     {
         double x=x0[0] - x1[0];
         double y=x0[1] - x1[1];
@@ -280,7 +283,7 @@ public:
      * @param m2 2x2 metric tensor for third point.
      */
     inline double lipnikov(const real_t *x0, const real_t *x1, const real_t *x2,
-                           const double *m0, const double *m1, const double *m2)
+                           const real_t *m0, const real_t *m1, const real_t *m2)
     {
         // Metric tensor averaged over the element
         double m00 = (m0[0] + m1[0] + m2[0])*inv3;
@@ -339,36 +342,6 @@ public:
         return quality;
     }
 
-    // Gradient of lipnikov functional n0 using a central difference approximation.
-    inline void lipnikov_grad(int moving,
-                              const double *x0, const double *x1, const double *x2,
-                              const double *m0,
-                              double *grad)
-    {
-        const double sqrt_eps = sqrt(DBL_EPSILON);
-
-        // df/dx, df/dy
-        for(size_t i=0; i<2; i++) {
-            double h = std::max(fabs(sqrt_eps*x0[i]), sqrt_eps);
-
-            volatile double xnh = x0[i]-h;
-            volatile double xph = x0[i]+h;
-
-            double Xn[] = {x0[0], x0[1]};
-            Xn[i] = xnh;
-            double Fxnh = lipnikov(Xn, x1, x2, m0[0], m0[1], m0[2]);
-
-            double Xp[] = {x0[0], x0[1]};
-            Xp[i] = xph;
-            double Fxph = lipnikov(Xp, x1, x2, m0[0], m0[1], m0[2]);
-
-            double two_dx = xph - xnh;
-            grad[i] = (Fxph - Fxnh)/two_dx;
-        }
-
-        return;
-    }
-
     /*! Evaluates the 3D Lipnikov functional. The description for the
      * functional is taken from: A. Agouzal, K Lipnikov,
      * Yu. Vassilevski, Adaptive generation of quasi-optimal tetrahedral
@@ -385,7 +358,7 @@ public:
      * @param m3 3x3 metric tensor for forth point.
      */
     inline double lipnikov(const real_t *x0, const real_t *x1, const real_t *x2, const real_t *x3,
-                           const double *m0, const double *m1, const double *m2, const double *m3)
+                           const real_t *m0, const real_t *m1, const real_t *m2, const real_t *m3)
     {
         // Metric tensor
         double m00 = (m0[0] + m1[0] + m2[0] + m3[0])*inv4;
@@ -458,7 +431,7 @@ public:
      * @param m0 3x3 metric tensor for first point.
      */
     inline double lipnikov(const real_t *x0, const real_t *x1, const real_t *x2, const real_t *x3,
-                           const double *m0)
+                           const real_t *m0)
     {
         // Metric tensor
         double m00 = m0[0];
@@ -519,36 +492,349 @@ public:
     }
 
 
-    // Gradient of lipnikov functional n0 using a central difference approximation.
+    /* Start of code generated by lipnikov_grad.py. Warning - be careful about modifying
+       any of the generated code directly.  Any changes/fixes should be done
+       in the code generation script generation.
+       */
+
+    /*! Gradient of the 2D Lipnikov functional with respect to the
+     * position of x0, for the metric m0 constant over the element.
+     */
     inline void lipnikov_grad(int moving,
-                              const double *x0, const double *x1, const double *x2, const double *x3,
-                              const double *m0,
+                              const real_t *x0, const real_t *x1, const real_t *x2,
+                              const real_t *m0,
                               double *grad)
     {
-        const double sqrt_eps = sqrt(DBL_EPSILON);
+        double t0 = x0[0] - x1[0];
+        double t1 = x0[1] - x1[1];
+        double t2 = m0[0]*t0 + m0[1]*t1;
+        double t3 = m0[1]*t0 + m0[2]*t1;
+        double t4 = sqrt(t0*t2 + t1*t3);
+        double t5 = -x2[0];
+        double t6 = t5 + x0[0];
+        double t7 = -x2[1];
+        double t8 = t7 + x0[1];
+        double t9 = m0[0]*t6 + m0[1]*t8;
+        double t10 = m0[1]*t6 + m0[2]*t8;
+        double t11 = sqrt(t10*t8 + t6*t9);
+        double t12 = t5 + x1[0];
+        double t13 = t7 + x1[1];
+        double t14 = (1.0/2.0)*orientation;
+        double t15 = 1.0/t4;
+        double t16 = 1.0/t11;
+
+        double l = t11 + t4 + sqrt(t12*(m0[0]*t12 + m0[1]*t13) + t13*(m0[1]*t12 + m0[2]*t13));
+        double v = t14*(t0*t8 - t1*t6);
+        double dl[] = {t15*t2 + t16*t9, t10*t16 + t15*t3};
+        double dv[] = {t13*t14, -t12*t14};
+
+        double invl = 1.0/l;
+
+        // f = min(l/3, 3/l) and its derivative.
+        double f, df;
+        if(l*inv3 < 3.0*invl) {
+            f = l*inv3;
+            df = inv3;
+        } else {
+            f = 3.0*invl;
+            df = -3.0*invl*invl;
+        }
+        double tf = f * (2.0 - f);
+        double F = tf*tf*tf;
+        double dF = 3.0*tf*tf*(2.0 - 2.0*f)*df;
+
+        // G = F/l^2 and its derivative.
+        double G = F*invl*invl;
+        double dG = (dF - 2.0*F*invl)*invl*invl;
 
-        // df/dx, df/dy, df/dz
-        for(size_t i=0; i<3; i++) {
-            double h = std::max(fabs(sqrt_eps*x0[i]), sqrt_eps);
+        double c = lipnikov_const2d*sqrt(m0[0]*m0[2] - m0[1]*m0[1]);
+        for(int i=0; i<2; i++)
+            grad[i] = c*(dv[i]*G + v*dG*dl[i]);
 
-            volatile double xnh = x0[i]-h;
-            volatile double xph = x0[i]+h;
+        return;
+    }
 
-            double Xn[] = {x0[0], x0[1], x0[2]};
-            Xn[i] = xnh;
-            double Fxnh = lipnikov(Xn, x1, x2, x3, m0);
+    /*! Gradient of the 3D Lipnikov functional with respect to the
+     * position of x0, for the metric m0 constant over the element.
+     */
+    inline void lipnikov_grad(int moving,
+                              const real_t *x0, const real_t *x1, const real_t *x2, const real_t *x3,
+                              const real_t *m0,
+                              double *grad)
+    {
+        double t0 = x0[0] - x1[0];
+        double t1 = x0[1] - x1[1];
+        double t2 = x0[2] - x1[2];
+        double t3 = m0[0]*t0 + m0[1]*t1 + m0[2]*t2;
+        double t4 = m0[1]*t0 + m0[3]*t1 + m0[4]*t2;
+        double t5 = m0[2]*t0 + m0[4]*t1 + m0[5]*t2;
+        double t6 = sqrt(t0*t3 + t1*t4 + t2*t5);
+        double t7 = -x2[0];
+        double t8 = t7 + x0[0];
+        double t9 = -x2[1];
+        double t10 = t9 + x0[1];
+        double t11 = -x2[2];
+        double t12 = t11 + x0[2];
+        double t13 = m0[0]*t8 + m0[1]*t10 + m0[2]*t12;
+        double t14 = m0[1]*t8 + m0[3]*t10 + m0[4]*t12;
+        double t15 = m0[2]*t8 + m0[4]*t10 + m0[5]*t12;
+        double t16 = sqrt(t10*t14 + t12*t15 + t13*t8);
+        double t17 = -x3[0];
+        double t18 = t17 + x0[0];
+        double t19 = -x3[1];
+        double t20 = t19 + x0[1];
+        double t21 = -x3[2];
+        double t22 = t21 + x0[2];
+        double t23 = m0[0]*t18 + m0[1]*t20 + m0[2]*t22;
+        double t24 = m0[1]*t18 + m0[3]*t20 + m0[4]*t22;
+        double t25 = m0[2]*t18 + m0[4]*t20 + m0[5]*t22;
+        double t26 = sqrt(t18*t23 + t20*t24 + t22*t25);
+        double t27 = t7 + x1[0];
+        double t28 = t9 + x1[1];
+        double t29 = t11 + x1[2];
+        double t30 = t17 + x1[0];
+        double t31 = t19 + x1[1];
+        double t32 = t21 + x1[2];
+        double t33 = t17 + x2[0];
+        double t34 = t19 + x2[1];
+        double t35 = t21 + x2[2];
+        double t36 = -t18;
+        double t37 = t1*t12 - t10*t2;
+        double t38 = t2*t20;
+        double t39 = t10*t22 - t12*t20;
+        double t40 = (1.0/6.0)*orientation;
+        double t41 = 1.0/t6;
+        double t42 = 1.0/t16;
+        double t43 = 1.0/t26;
+
+        double l = t16 + t26 + t6 + sqrt(t27*(m0[0]*t27 + m0[1]*t28 + m0[2]*t29) + t28*(m0[1]*t27 + m0[3]*t28 + m0[4]*t29) + t29*(m0[2]*t27 + m0[4]*t28 + m0[5]*t29)) + sqrt(t30*(m0[0]*t30 + m0[1]*t31 + m0[2]*t32) + t31*(m0[1]*t30 + m0[3]*t31 + m0[4]*t32) + t32*(m0[2]*t30 + m0[4]*t31 + m0[5]*t32)) + sqrt(t33*(m0[0]*t33 + m0[1]*t34 + m0[2]*t35) + t34*(m0[1]*t33 + m0[3]*t34 + m0[4]*t35) + t35*(m0[2]*t33 + m0[4]*t34 + m0[5]*t35));
+        double v = t40*(-t0*t39 + t36*t37 + t8*(t1*t22 - t38));
+        double dl[] = {t13*t42 + t23*t43 + t3*t41, t14*t42 + t24*t43 + t4*t41, t15*t42 + t25*t43 + t41*t5};
+        double dv[] = {t40*(t1*t22 - t37 - t38 - t39), t40*(-t0*t35 + t29*t36 + t32*t8), t40*(t0*t34 - t28*t36 - t31*t8)};
 
-            double Xp[] = {x0[0], x0[1], x0[2]};
-            Xp[i] = xph;
-            double Fxph = lipnikov(Xp, x1, x2, x3, m0);
+        double invl = 1.0/l;
 
-            double two_dx = xph - xnh;
-            grad[i] = (Fxph - Fxnh)/two_dx;
+        // f = min(l/6, 6/l) and its derivative.
+        double f, df;
+        if(l*inv6 < 6.0*invl) {
+            f = l*inv6;
+            df = inv6;
+        } else {
+            f = 6.0*invl;
+            df = -6.0*invl*invl;
         }
+        double tf = f * (2.0 - f);
+        double F = tf*tf*tf;
+        double dF = 3.0*tf*tf*(2.0 - 2.0*f)*df;
+
+        // G = F/l^3 and its derivative.
+        double G = F*invl*invl*invl;
+        double dG = (dF - 3.0*F*invl)*invl*invl*invl;
+
+        double m00 = m0[0], m01 = m0[1], m02 = m0[2], m11 = m0[3], m12 = m0[4], m22 = m0[5];
+        double c = lipnikov_const3d*sqrt(((m11*m22 - m12*m12)*m00 - (m01*m22 - m02*m12)*m01 + (m01*m12 - m02*m11)*m02));
+        for(int i=0; i<3; i++)
+            grad[i] = c*(dv[i]*G + v*dG*dl[i]);
 
         return;
     }
 
+    /* End of code generated by lipnikov_grad.py. Warning - be careful about
+       modifying any of the generated code directly.  Any changes/fixes
+       should be done in the code generation script generation.*/
+
+    /// Number of elements evaluated together by the batched functionals.
+    static const int batch_size = 16;
+
+    /*! Evaluates the 2D Lipnikov functional for a range of triangles.
+     * The coordinates and averaged metric of batch_size elements at a
+     * time are gathered into contiguous arrays so that the functional
+     * itself is evaluated across the batch in SIMD lanes. The result for
+     * each element is the same as that of lipnikov().
+     *
+     * @param nelements number of elements to evaluate.
+     * @param ENList element-node list of the first element in the range.
+     * @param coords vertex coordinates, two per vertex.
+     * @param metric vertex metric tensors, three per vertex.
+     * @param quality output, one value per element. Erased elements
+     * (negative first vertex) are given a quality of zero.
+     */
+    void lipnikov_batch_2d(size_t nelements, const index_t *ENList,
+                           const real_t *coords, const real_t *metric, double *quality) const
+    {
+        const double c_inv2 = orientation*inv2;
+        const double c_inv3 = inv3;
+        const double c_lipnikov = lipnikov_const2d;
+
+        for(size_t b=0; b<nelements; b+=batch_size) {
+            const int nb = std::min((size_t)batch_size, nelements-b);
+
+            double x01[batch_size], y01[batch_size], x02[batch_size], y02[batch_size], x21[batch_size], y21[batch_size];
+            double m00[batch_size], m01[batch_size], m11[batch_size];
+            double q[batch_size];
+            bool erased[batch_size];
+
+            // Gather. Lanes which are past the end of the range or hold an
+            // erased element get an equilateral triangle in the unit metric.
+            for(int k=0; k<batch_size; k++) {
+                erased[k] = k>=nb || ENList[(b+k)*3]<0;
+                if(erased[k]) {
+                    x01[k] = -1.0; y01[k] = 0.0;
+                    x02[k] = -0.5; y02[k] = -0.86602540378443865;
+                    x21[k] = -0.5; y21[k] = 0.86602540378443865;
+                    m00[k] = 1.0; m01[k] = 0.0; m11[k] = 1.0;
+                    continue;
+                }
+
+                const index_t *n = ENList+(b+k)*3;
+                const real_t *x0 = coords+n[0]*2;
+                const real_t *x1 = coords+n[1]*2;
+                const real_t *x2 = coords+n[2]*2;
+                const real_t *mt0 = metric+n[0]*3;
+                const real_t *mt1 = metric+n[1]*3;
+                const real_t *mt2 = metric+n[2]*3;
+
+                x01[k] = x0[0] - x1[0];
+                y01[k] = x0[1] - x1[1];
+                x02[k] = x0[0] - x2[0];
+                y02[k] = x0[1] - x2[1];
+                x21[k] = x2[0] - x1[0];
+                y21[k] = x2[1] - x1[1];
+
+                m00[k] = (mt0[0] + mt1[0] + mt2[0])*c_inv3;
+                m01[k] = (mt0[1] + mt1[1] + mt2[1])*c_inv3;
+                m11[k] = (mt0[2] + mt1[2] + mt2[2])*c_inv3;
+            }
+
+            // Evaluate, as in lipnikov().
+#pragma omp simd
+            for(int k=0; k<batch_size; k++) {
+                double l =
+                    sqrt(y01[k]*(y01[k]*m11[k] + x01[k]*m01[k]) +
+                         x01[k]*(y01[k]*m01[k] + x01[k]*m00[k]))+
+                    sqrt(y02[k]*(y02[k]*m11[k] + x02[k]*m01[k]) +
+                         x02[k]*(y02[k]*m01[k] + x02[k]*m00[k]))+
+                    sqrt(y21[k]*(y21[k]*m11[k] + x21[k]*m01[k]) +
+                         x21[k]*(y21[k]*m01[k] + x21[k]*m00[k]));
+
+                double invl = 1.0/l;
+
+                double a = c_inv2*(y02[k]*x01[k] - y01[k]*x02[k]);
+                double a_m = a*sqrt(m00[k]*m11[k] - m01[k]*m01[k]);
+
+                double f = std::min(l*c_inv3, 3.0*invl);
+                double tf = f * (2.0 - f);
+                double F = tf*tf*tf;
+                q[k] = c_lipnikov*a_m*F*invl*invl;
+            }
+
+            for(int k=0; k<nb; k++)
+                quality[b+k] = erased[k] ? 0.0 : q[k];
+        }
+    }
+
+    /*! Evaluates the 3D Lipnikov functional for a range of tetrahedra,
+     * batched in the same way as lipnikov_batch_2d().
+     *
+     * @param nelements number of elements to evaluate.
+     * @param ENList element-node list of the first element in the range.
+     * @param coords vertex coordinates, three per vertex.
+     * @param metric vertex metric tensors, six per vertex.
+     * @param quality output, one value per element. Erased elements
+     * (negative first vertex) are given a quality of zero.
+     */
+    void lipnikov_batch_3d(size_t nelements, const index_t *ENList,
+                           const real_t *coords, const real_t *metric, double *quality) const
+    {
+        const double c_inv4 = inv4;
+        const double c_inv6 = inv6;
+        const double c_orientation = orientation;
+        const double c_lipnikov = lipnikov_const3d;
+
+        for(size_t b=0; b<nelements; b+=batch_size) {
+            const int nb = std::min((size_t)batch_size, nelements-b);
+
+            // Edge vectors 01, 12, 02, 03, 13, 23.
+            double ex[6][batch_size], ey[6][batch_size], ez[6][batch_size];
+            double m[6][batch_size];
+            double q[batch_size];
+            bool erased[batch_size];
+
+            // Gather. Lanes which are past the end of the range or hold an
+            // erased element get a unit right-angled corner tetrahedron in the
+            // unit metric.
+            for(int k=0; k<batch_size; k++) {
+                erased[k] = k>=nb || ENList[(b+k)*4]<0;
+                if(erased[k]) {
+                    static const double unit[6][3] = {{-1, 0, 0}, {1, -1, 0}, {0, -1, 0},
+                                                      {0, 0, -1}, {1, 0, -1}, {0, 1, -1}};
+                    for(int e=0; e<6; e++) {
+                        ex[e][k] = unit[e][0];
+                        ey[e][k] = unit[e][1];
+                        ez[e][k] = unit[e][2];
+                    }
+                    m[0][k] = 1.0; m[1][k] = 0.0; m[2][k] = 0.0;
+                    m[3][k] = 1.0; m[4][k] = 0.0; m[5][k] = 1.0;
+                    continue;
+                }
+
+                const index_t *n = ENList+(b+k)*4;
+                const real_t *x[] = {coords+n[0]*3, coords+n[1]*3, coords+n[2]*3, coords+n[3]*3};
+                static const int edges[6][2] = {{0, 1}, {1, 2}, {0, 2}, {0, 3}, {1, 3}, {2, 3}};
+                for(int e=0; e<6; e++) {
+                    const real_t *xa = x[edges[e][0]];
+                    const real_t *xb = x[edges[e][1]];
+                    ex[e][k] = (xa[0] - xb[0]);
+                    ey[e][k] = (xa[1] - xb[1]);
+                    ez[e][k] = (xa[2] - xb[2]);
+                }
+
+                const real_t *mt0 = metric+n[0]*6;
+                const real_t *mt1 = metric+n[1]*6;
+                const real_t *mt2 = metric+n[2]*6;
+                const real_t *mt3 = metric+n[3]*6;
+                for(int j=0; j<6; j++)
+                    m[j][k] = (mt0[j] + mt1[j] + mt2[j] + mt3[j])*c_inv4;
+            }
+
+            // Evaluate, as in lipnikov().
+#pragma omp simd
+            for(int k=0; k<batch_size; k++) {
+                double m00 = m[0][k], m01 = m[1][k], m02 = m[2][k];
+                double m11 = m[3][k], m12 = m[4][k], m22 = m[5][k];
+
+                double x01 = ex[0][k], y01 = ey[0][k], z01 = ez[0][k];
+                double x12 = ex[1][k], y12 = ey[1][k], z12 = ez[1][k];
+                double x02 = ex[2][k], y02 = ey[2][k], z02 = ez[2][k];
+                double x03 = ex[3][k], y03 = ey[3][k], z03 = ez[3][k];
+                double x13 = ex[4][k], y13 = ey[4][k], z13 = ez[4][k];
+                double x23 = ex[5][k], y23 = ey[5][k], z23 = ez[5][k];
+
+                double dl0 = (z01*(z01*m22 + y01*m12 + x01*m02) + y01*(z01*m12 + y01*m11 + x01*m01) + x01*(z01*m02 + y01*m01 + x01*m00));
+                double dl1 = (z12*(z12*m22 + y12*m12 + x12*m02) + y12*(z12*m12 + y12*m11 + x12*m01) + x12*(z12*m02 + y12*m01 + x12*m00));
+                double dl2 = (z02*(z02*m22 + y02*m12 + x02*m02) + y02*(z02*m12 + y02*m11 + x02*m01) + x02*(z02*m02 + y02*m01 + x02*m00));
+                double dl3 = (z03*(z03*m22 + y03*m12 + x03*m02) + y03*(z03*m12 + y03*m11 + x03*m01) + x03*(z03*m02 + y03*m01 + x03*m00));
+                double dl4 = (z13*(z13*m22 + y13*m12 + x13*m02) + y13*(z13*m12 + y13*m11 + x13*m01) + x13*(z13*m02 + y13*m01 + x13*m00));
+                double dl5 = (z23*(z23*m22 + y23*m12 + x23*m02) + y23*(z23*m12 + y23*m11 + x23*m01) + x23*(z23*m02 + y23*m01 + x23*m00));
+
+                double l = sqrt(dl0)+sqrt(dl1)+sqrt(dl2)+sqrt(dl3)+sqrt(dl4)+sqrt(dl5);
+                double invl = 1.0/l;
+
+                double v = c_orientation*c_inv6*(-x03*(z02*y01 - z01*y02) + x02*(z03*y01 - z01*y03) - x01*(z03*y02 - z02*y03));
+
+                double v_m = v*sqrt(((m11*m22 - m12*m12)*m00 - (m01*m22 - m02*m12)*m01 + (m01*m12 - m02*m11)*m02));
+
+                double f = std::min(l*c_inv6, 6*invl);
+                double tf = f * (2.0 - f);
+                double F = tf*tf*tf;
+                q[k] = c_lipnikov * v_m * F *invl*invl*invl;
+            }
+
+            for(int k=0; k<nb; k++)
+                quality[b+k] = erased[k] ? 0.0 : q[k];
+        }
+    }
+
     /*! Evaluates the sliver functional. Taken from Computer Methods in
      * Applied Mechanics and Engineering Volume 194, Issues 48-49, 15
      * November 2005, Pages 4915-4950
@@ -563,7 +849,7 @@ public:
      * @param m3 3x3 metric tensor for forth point.
      */
     inline real_t sliver(const real_t *x0, const real_t *x1, const real_t *x2, const real_t *x3,
-                         const double *m0, const double *m1, const double *m2, const double *m3)
+                         const real_t *m0, const real_t *m1, const real_t *m2, const real_t *m3)
     {
         // Metric tensor
         double m00 = (m0[0] + m1[0] + m2[0] + m3[0])*inv4;
@@ -632,7 +918,7 @@ public:
      * @param m2 2x2 metric tensor for third point.
      */
     inline double condition(const real_t *x0, const real_t *x1, const real_t *x2,
-                            const double *m0, const double *m1, const double *m2)
+                            const real_t *m0, const real_t *m1, const real_t *m2)
     {
         // Metric tensor averaged over the element
         double m00 = (m0[0] + m1[0] + m2[0])*inv3;
@@ -704,7 +990,7 @@ public:
      * @param m3 3x3 metric tensor for forth point.
      */
     inline double condition(const real_t *x0, const real_t *x1, const real_t *x2, const real_t *x3,
-                            const double *m0, const double *m1, const double *m2, const double *m3)
+                            const real_t *m0, const real_t *m1, const real_t *m2, const real_t *m3)
     {
         // Metric tensor
         double m00 = (m0[0] + m1[0] + m2[0] + m3[0])*inv4;
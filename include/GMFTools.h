@@ -244,7 +244,7 @@ private:
     {
         int                  tag;
         std::vector<real_t>  x, y;
-        std::vector<int>     ENList;
+        std::vector<index_t> ENList;
         index_t              NNodes, NElements, NFacets, bufTri[3], bufFac[2];
         std::vector<index_t> facets, ids, regions;
         double               bufDbl[2];
@@ -316,7 +316,7 @@ private:
     {
         int                  tag;
         std::vector<real_t>  x, y, z;
-        std::vector<int>     ENList;
+        std::vector<index_t> ENList;
         index_t              NNodes, NElements, NFacets, bufTet[4], bufFac[3];
         std::vector<index_t> facets, ids, regions;
         double               bufDbl[3];
@@ -0,0 +1,93 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef HILBERTCURVE_H
+#define HILBERTCURVE_H
+
+#include <stdint.h>
+
+/*! \brief Position of a point along a Hilbert curve.
+ *
+ * X holds the integer coordinates of the point, each in [0, 2^bits).
+ * The point's transposed Hilbert index is computed in place following
+ * J. Skilling, "Programming the Hilbert curve", AIP Conf. Proc. 707
+ * (2004) 381-387, and its bits are then interleaved into a single key.
+ * Points which are close along the curve are close in space, so
+ * sorting vertices or elements by key gives a numbering with good
+ * locality. dim*bits must not exceed 64.
+ */
+template<int dim>
+uint64_t hilbert_key(uint32_t X[dim], int bits)
+{
+    const uint32_t M = 1u << (bits-1);
+
+    // Inverse undo.
+    for(uint32_t Q=M; Q>1; Q>>=1) {
+        uint32_t P = Q-1;
+        for(int i=0; i<dim; i++) {
+            if(X[i] & Q) {
+                X[0] ^= P;
+            } else {
+                uint32_t t = (X[0]^X[i]) & P;
+                X[0] ^= t;
+                X[i] ^= t;
+            }
+        }
+    }
+
+    // Gray encode.
+    for(int i=1; i<dim; i++)
+        X[i] ^= X[i-1];
+    uint32_t t = 0;
+    for(uint32_t Q=M; Q>1; Q>>=1) {
+        if(X[dim-1] & Q)
+            t ^= Q-1;
+    }
+    for(int i=0; i<dim; i++)
+        X[i] ^= t;
+
+    // Interleave, most significant bit first.
+    uint64_t key = 0;
+    for(int b=bits-1; b>=0; b--) {
+        for(int i=0; i<dim; i++)
+            key = (key<<1) | ((X[i]>>b) & 1);
+    }
+
+    return key;
+}
+
+#endif
@@ -39,10 +39,12 @@
 #define MESH_H
 
 #include <algorithm>
+#include <iterator>
 #include <vector>
 #include <set>
 #include <stack>
 #include <cmath>
+#include <limits>
 #include <stdint.h>
 
 #ifdef HAVE_BOOST_UNORDERED_MAP_HPP
@@ -52,8 +54,10 @@
 #include "mpi_tools.h"
 
 #include "PragmaticTypes.h"
+#include "PragmaticMinis.h"
 
 #include "ElementProperty.h"
+#include "HilbertCurve.h"
 #include "MetricTensor.h"
 #include "HaloExchange.h"
 
@@ -92,7 +96,7 @@ public:
      * @param mpi_comm the mpi communicator.
      */
     Mesh(int NNodes, int NElements, const index_t *ENList,
-         const real_t *x, const real_t *y, const index_t *lnn2gnn,
+         const real_t *x, const real_t *y, const gnn_t *lnn2gnn,
          index_t NPNodes, MPI_Comm mpi_comm)
     {
         _mpi_comm = mpi_comm;
@@ -128,7 +132,7 @@ public:
      * @param mpi_comm the mpi communicator.
      */
     Mesh(int NNodes, int NElements, const index_t *ENList,
-         const real_t *x, const real_t *y, const real_t *z, const index_t *lnn2gnn,
+         const real_t *x, const real_t *y, const real_t *z, const gnn_t *lnn2gnn,
          index_t NPNodes, MPI_Comm mpi_comm)
     {
         _mpi_comm = mpi_comm;
@@ -145,13 +149,13 @@ public:
         std::set<int> neigbor_elements;
         for (int i = 0; i < NVer; ++i) {
             int iVer = ver[i];
-            std::set<index_t>::const_iterator it;
+            element_set_t::const_iterator it;
             for (it= meshini.NEList[iVer].begin(); it!=meshini.NEList[iVer].end(); ++it) {
                 const int * elm = meshini.get_element(*it);
-                const double *x0 = meshini.get_coords(elm[0]);
-                const double *x1 = meshini.get_coords(elm[1]);
-                const double *x2 = meshini.get_coords(elm[2]);
-                const double *x3 = meshini.get_coords(elm[3]);
+                const real_t *x0 = meshini.get_coords(elm[0]);
+                const real_t *x1 = meshini.get_coords(elm[1]);
+                const real_t *x2 = meshini.get_coords(elm[2]);
+                const real_t *x3 = meshini.get_coords(elm[3]);
                 neigbor_elements.insert(*it);
             }
         } 
@@ -218,7 +222,7 @@ public:
 
 
     /// Add a new vertex
-    index_t append_vertex(const real_t *x, const double *m)
+    index_t append_vertex(const real_t *x, const real_t *m)
     {
         for(size_t i=0; i<ndims; i++)
             _coords[ndims*NNodes+i] = x[i];
@@ -243,12 +247,8 @@ public:
     /// Add a new element
     index_t append_element(const index_t *n)
     {
-        if(_ENList.size() < (NElements+1)*nloc) {
-            _ENList.resize(2*NElements*nloc);
-            boundary.resize(2*NElements*nloc);
-            regions.resize(2*NElements);
-            quality.resize(2*NElements);
-        }
+        if(_ENList.size() < (NElements+1)*nloc)
+            resize_elements(2*NElements);
 
         for(size_t i=0; i<nloc; i++)
             _ENList[nloc*NElements+i] = n[i];
@@ -269,70 +269,31 @@ public:
         boundary.resize(NElements*nloc);
         std::fill(boundary.begin(), boundary.end(), -2);
 
-        if(ndims==2) {
-            // Check neighbourhood of each element
-            for(size_t i=0; i<NElements; i++) {
-                if(_ENList[i*3]==-1)
-                    continue;
+        std::vector<index_t> EEList;
+        calculate_EEList(EEList);
 
-                for(int j=0; j<3; j++) {
-                    int n1 = _ENList[i*3+(j+1)%3];
-                    int n2 = _ENList[i*3+(j+2)%3];
-
-                    if(is_owned_node(n1)||is_owned_node(n2)) {
-                        std::set<int> neighbours;
-                        set_intersection(NEList[n1].begin(), NEList[n1].end(),
-                                         NEList[n2].begin(), NEList[n2].end(),
-                                         inserter(neighbours, neighbours.begin()));
-
-                        if(neighbours.size()==2) {
-                            if(*neighbours.begin()==(int)i)
-                                boundary[i*3+j] = *neighbours.rbegin();
-                            else
-                                boundary[i*3+j] = *neighbours.begin();
-                        }
-                    } else {
-                        // This is a halo facet.
-                        boundary[i*3+j] = -1;
+        // Check neighbourhood of each element
+        for(size_t i=0; i<NElements; i++) {
+            if(_ENList[i*nloc]==-1)
+                continue;
+
+            for(size_t j=0; j<nloc; j++) {
+                bool halo_facet = true;
+                for(size_t k=1; k<nloc; k++) {
+                    if(is_owned_node(_ENList[i*nloc+(j+k)%nloc])) {
+                        halo_facet = false;
+                        break;
                     }
                 }
-            }
-        } else { // ndims==3
-            // Check neighbourhood of each element
-            for(size_t i=0; i<NElements; i++) {
-                if(_ENList[i*4]==-1)
-                    continue;
 
-                for(int j=0; j<4; j++) {
-                    int n1 = _ENList[i*4+(j+1)%4];
-                    int n2 = _ENList[i*4+(j+2)%4];
-                    int n3 = _ENList[i*4+(j+3)%4];
-
-                    if(is_owned_node(n1)||is_owned_node(n2)||is_owned_node(n3)) {
-                        std::set<int> edge_neighbours;
-                        set_intersection(NEList[n1].begin(), NEList[n1].end(),
-                                         NEList[n2].begin(), NEList[n2].end(),
-                                         inserter(edge_neighbours, edge_neighbours.begin()));
-
-                        std::set<int> neighbours;
-                        set_intersection(NEList[n3].begin(), NEList[n3].end(),
-                                         edge_neighbours.begin(), edge_neighbours.end(),
-                                         inserter(neighbours, neighbours.begin()));
-
-                        if(neighbours.size()==2) {
-                            if(*neighbours.begin()==(int)i)
-                                boundary[i*4+j] = *neighbours.rbegin();
-                            else
-                                boundary[i*4+j] = *neighbours.begin();
-                        }
-                    } else {
-                        // This is a halo facet.
-                        boundary[i*4+j] = -1;
-                    }
+                if(halo_facet) {
+                    boundary[i*nloc+j] = -1;
+                } else if(EEList[i*nloc+j]>=0) {
+                    boundary[i*nloc+j] = EEList[i*nloc+j];
                 }
             }
         }
-        
+
         for(std::vector<int>::iterator it=boundary.begin(); it!=boundary.end(); ++it) {
             if(*it==-2)
                 *it = 1;
@@ -415,10 +376,21 @@ public:
     ///   and try to preserver them.
     void set_internal_boundaries()
     {
-        if (ndims == 2)
-            set_internal_boundaries_2d();
-        else
-            set_internal_boundaries_3d();
+        std::vector<index_t> EEList;
+        calculate_EEList(EEList);
+
+        // Tag every facet between elements of different regions.
+        size_t NElements = get_number_elements();
+        for(size_t i=0; i<NElements; i++) {
+            if(_ENList[i*nloc]==-1)
+                continue;
+
+            for(size_t j=0; j<nloc; j++) {
+                index_t neigh = EEList[i*nloc+j];
+                if(neigh>=0 && regions[neigh]!=regions[i])
+                    boundary[i*nloc+j] = max_bdry_tag+1;
+            }
+        }
     }
 
 
@@ -497,6 +469,77 @@ public:
         _ENList[eid*nloc] = -1;
     }
 
+    /*! Collects the slots of erased vertices and elements into
+     * free_vertices and free_elements, in ascending order, so that Refine
+     * and Swapping fill them before appending to the end of the arrays.
+     * Erased slots at the end of the arrays are dropped instead.
+     */
+    void update_free_slots()
+    {
+        while(NElements>0 && _ENList[(NElements-1)*nloc]<0)
+            NElements--;
+        while(NNodes>0 && NNList[NNodes-1].empty() && NEList[NNodes-1].empty())
+            NNodes--;
+
+        int nthreads = pragmatic_nthreads();
+        std::vector< std::vector<index_t> > thread_elements(nthreads), thread_vertices(nthreads);
+
+#pragma omp parallel num_threads(nthreads)
+        {
+            const int tid = pragmatic_thread_id();
+
+            // Static scheduling hands out contiguous ranges in thread order.
+#pragma omp for schedule(static)
+            for(index_t i=0; i<(index_t)NElements; i++) {
+                if(_ENList[i*nloc]<0)
+                    thread_elements[tid].push_back(i);
+            }
+
+#pragma omp for schedule(static)
+            for(index_t i=0; i<(index_t)NNodes; i++) {
+                if(NNList[i].empty() && NEList[i].empty())
+                    thread_vertices[tid].push_back(i);
+            }
+        }
+
+        free_elements.clear();
+        free_vertices.clear();
+        for(int t=0; t<nthreads; t++) {
+            free_elements.insert(free_elements.end(), thread_elements[t].begin(), thread_elements[t].end());
+            free_vertices.insert(free_vertices.end(), thread_vertices[t].begin(), thread_vertices[t].end());
+        }
+    }
+
+    /// Make sure the vertex arrays can hold at least capacity vertices.
+    void resize_vertices(size_t capacity)
+    {
+        if(_coords.size() < capacity*ndims)
+            _coords.resize(capacity*ndims);
+        if(metric.size() < capacity*msize)
+            metric.resize(capacity*msize);
+        if(NNList.size() < capacity)
+            NNList.resize(capacity);
+        if(NEList.size() < capacity)
+            NEList.resize(capacity);
+        if(node_owner.size() < capacity)
+            node_owner.resize(capacity);
+        if(lnn2gnn.size() < capacity)
+            lnn2gnn.resize(capacity);
+    }
+
+    /// Make sure the element arrays can hold at least capacity elements.
+    void resize_elements(size_t capacity)
+    {
+        if(_ENList.size() < capacity*nloc)
+            _ENList.resize(capacity*nloc);
+        if(boundary.size() < capacity*nloc)
+            boundary.resize(capacity*nloc);
+        if(regions.size() < capacity)
+            regions.resize(capacity);
+        if(quality.size() < capacity)
+            quality.resize(capacity);
+    }
+
     /// Flip orientation of element.
     void invert_element(size_t eid)
     {
@@ -566,7 +609,7 @@ public:
     }
 
     /// Return metric at that vertex.
-    inline const double *get_metric(index_t nid) const
+    inline const real_t *get_metric(index_t nid) const
     {
         assert(metric.size()>0);
         assert(nid < NNodes);
@@ -574,7 +617,7 @@ public:
     }
 
     /// Return copy of metric.
-    inline void get_metric(index_t nid, double *m) const
+    inline void get_metric(index_t nid, real_t *m) const
     {
         assert(metric.size()>0);
         assert(nid < NNodes);
@@ -664,7 +707,7 @@ public:
     }
     
     /// Returns global node numbering offset.
-    inline int get_gnn_offset()
+    inline gnn_t get_gnn_offset()
     {
         if (num_processes > 1)
             return gnn_offset;
@@ -673,7 +716,7 @@ public:
     }
     
     /// Returns the global node numbering of a local node numbering number
-    inline int get_global_numbering(index_t nid)
+    inline gnn_t get_global_numbering(index_t nid)
     {
         if (num_processes > 1)
             return lnn2gnn[nid];
@@ -687,6 +730,10 @@ public:
         for (int i=0; i<metric.size(); ++i) {
             metric[i] *= alpha;
         }
+
+        // Cached edge lengths and qualities were measured with the old metric.
+        invalidate_edges();
+        update_quality(0, NElements);
     }
 
     /// Get the mean edge length metric space.
@@ -694,7 +741,7 @@ public:
     {
         int NNodes = get_number_nodes();
         double total_length=0;
-        int nedges=0;
+        gnn_t nedges=0;
 
         for(int i=0; i<NNodes; i++) {
             if(is_owned_node(i) && (NNList[i].size()>0)) {
@@ -709,7 +756,7 @@ public:
 
         if(num_processes>1) {
             MPI_Allreduce(MPI_IN_PLACE, &total_length, 1, MPI_DOUBLE, MPI_SUM, _mpi_comm);
-            MPI_Allreduce(MPI_IN_PLACE, &nedges, 1, MPI_INT, MPI_SUM, _mpi_comm);
+            MPI_Allreduce(MPI_IN_PLACE, &nedges, 1, MPI_GNN_T, MPI_SUM, _mpi_comm);
         }
 
         double mean = total_length/nedges;
@@ -771,13 +818,10 @@ public:
                     if (std::min(node_owner[n1], node_owner[n2]) != rank)
                         continue;
 
-                    std::set<index_t> neighbours;
-                    std::set_intersection(NEList[n1].begin(),NEList[n1].end(),
-                                          NEList[n2].begin(), NEList[n2].end(),
-                                          std::inserter(neighbours, neighbours.begin()));
-                    std::set<index_t>::const_iterator neigh_it;
-                    for (neigh_it = neighbours.begin(); neigh_it != neighbours.end(); neigh_it++){
-                        if (regions[*neigh_it] == tag_region2) {
+                    index_t facet[] = {n1, n2}, neighbours[2];
+                    int nneighbours = std::min(get_facet_elements(facet, 2, neighbours), 2);
+                    for (int k=0; k<nneighbours; k++){
+                        if (regions[neighbours[k]] == tag_region2) {
                             long double dx = ((long double)_coords[n1*2  ]-(long double)_coords[n2*2  ]);
                             long double dy = ((long double)_coords[n1*2+1]-(long double)_coords[n2*2+1]);
                             total_length += std::sqrt(dx*dx+dy*dy);
@@ -798,9 +842,9 @@ public:
 
     inline long double triangle_area(index_t n1, index_t n2, index_t n3) const
     {
-        const double *x1 = get_coords(n1);
-        const double *x2 = get_coords(n2);
-        const double *x3 = get_coords(n3);
+        const real_t *x1 = get_coords(n1);
+        const real_t *x2 = get_coords(n2);
+        const real_t *x3 = get_coords(n3);
 
         if (ndims==2)
             return fabs(property->area(x1,x2,x3));
@@ -937,16 +981,10 @@ public:
                 }
 
                 // check if opposite tet has the right tag
-                std::set<index_t> neighbours_tmp, neighbours;
-                std::set_intersection(NEList[n1].begin(),NEList[n1].end(),
-                                      NEList[n2].begin(), NEList[n2].end(),
-                                      std::inserter(neighbours_tmp, neighbours_tmp.begin()));
-                std::set_intersection(neighbours_tmp.begin(),neighbours_tmp.end(),
-                                      NEList[n3].begin(), NEList[n3].end(),
-                                      std::inserter(neighbours, neighbours.begin()));
-                std::set<index_t>::const_iterator neigh_it;
-                for (neigh_it = neighbours.begin(); neigh_it != neighbours.end(); neigh_it++){
-                    if (regions[*neigh_it] == tag_region2) {
+                index_t facet[] = {n1, n2, n3}, neighbours[2];
+                int nneighbours = std::min(get_facet_elements(facet, 3, neighbours), 2);
+                for (int k=0; k<nneighbours; k++){
+                    if (regions[neighbours[k]] == tag_region2) {
                         
                         long double area = triangle_area(n1, n2, n3);
                         total_area += area;
@@ -1059,33 +1097,28 @@ public:
         return total_volume;
     }
 
-    /// Get the element mean quality in metric space.
+    /*! Get the element mean quality in metric space. This reads the
+     * cached element qualities, which are kept up to date by
+     * MetricField::update_mesh() and the adaptation kernels.
+     */
     double get_qmean() const
     {
         double sum=0;
-        int nele=0;
+        gnn_t nele=0;
 
-        for(size_t i=0; i<NElements; i++) {
-            const index_t *n=get_element(i);
-            if(n[0]<0)
+        int nthreads = pragmatic_nthreads();
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+:sum,nele)
+        for(index_t i=0; i<(index_t)NElements; i++) {
+            if(_ENList[i*nloc]<0)
                 continue;
 
-            double q;
-            if(ndims==2) {
-                q = property->lipnikov(get_coords(n[0]), get_coords(n[1]), get_coords(n[2]),
-                                       get_metric(n[0]), get_metric(n[1]), get_metric(n[2]));
-            } else {
-                q = property->lipnikov(get_coords(n[0]), get_coords(n[1]), get_coords(n[2]), get_coords(n[3]),
-                                       get_metric(n[0]), get_metric(n[1]), get_metric(n[2]), get_metric(n[3]));
-            }
-
-            sum+=q;
+            sum+=quality[i];
             nele++;
         }
 
         if(num_processes>1) {
             MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, _mpi_comm);
-            MPI_Allreduce(MPI_IN_PLACE, &nele, 1, MPI_INT, MPI_SUM, _mpi_comm);
+            MPI_Allreduce(MPI_IN_PLACE, &nele, 1, MPI_GNN_T, MPI_SUM, _mpi_comm);
         }
 
         if(nele>0)
@@ -1115,26 +1148,16 @@ public:
         }
     }
 
-    /// Get the element minimum quality in metric space.
+    /// Get the element minimum quality in metric space, from the cached element qualities.
     double get_qmin() const
-    {
-        if(ndims==2)
-            return get_qmin_2d();
-        else
-            return get_qmin_3d();
-    }
-
-    double get_qmin_2d() const
     {
         double qmin=1; // Where 1 is ideal.
 
-        for(size_t i=0; i<NElements; i++) {
-            const index_t *n=get_element(i);
-            if(n[0]<0)
-                continue;
-
-            qmin = std::min(qmin, property->lipnikov(get_coords(n[0]), get_coords(n[1]), get_coords(n[2]),
-                            get_metric(n[0]), get_metric(n[1]), get_metric(n[2])));
+        int nthreads = pragmatic_nthreads();
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(min:qmin)
+        for(index_t i=0; i<(index_t)NElements; i++) {
+            if(_ENList[i*nloc]>=0)
+                qmin = std::min(qmin, quality[i]);
         }
 
         if(num_processes>1)
@@ -1143,23 +1166,54 @@ public:
         return qmin;
     }
 
-    double get_qmin_3d() const
+    /*! Recompute the cached quality of every element and return the
+     * mean and minimum quality of the mesh. This is a single batched pass
+     * over the elements, giving the same result as updating each element
+     * and then calling get_qmean() and get_qmin(). Only needed if the
+     * coordinates or metric have been changed outside of the library.
+     */
+    void update_quality(double &qmean, double &qmin)
     {
-        double qmin=1; // Where 1 is ideal.
-
-        for(size_t i=0; i<NElements; i++) {
-            const index_t *n=get_element(i);
-            if(n[0]<0)
-                continue;
+        double sum=0;
+        gnn_t nele=0;
+        qmin=1; // Where 1 is ideal.
+
+        const index_t batch = ElementProperty<real_t>::batch_size;
+        int nthreads = pragmatic_nthreads();
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+:sum,nele) reduction(min:qmin)
+        for(index_t i=0; i<(index_t)NElements; i+=batch) {
+            index_t end = std::min(i+batch, (index_t)NElements);
+            update_quality(i, end);
+            for(index_t j=i; j<end; j++) {
+                if(_ENList[j*nloc]<0)
+                    continue;
 
-            qmin = std::min(qmin, property->lipnikov(get_coords(n[0]), get_coords(n[1]), get_coords(n[2]), get_coords(n[3]),
-                            get_metric(n[0]), get_metric(n[1]), get_metric(n[2]), get_metric(n[3])));
+                sum+=quality[j];
+                qmin = std::min(qmin, quality[j]);
+                nele++;
+            }
         }
 
-        if(num_processes>1)
+        if(num_processes>1) {
+            MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, _mpi_comm);
+            MPI_Allreduce(MPI_IN_PLACE, &nele, 1, MPI_GNN_T, MPI_SUM, _mpi_comm);
             MPI_Allreduce(MPI_IN_PLACE, &qmin, 1, MPI_DOUBLE, MPI_MIN, _mpi_comm);
+        }
 
-        return qmin;
+        if(nele>0)
+            qmean = sum/nele;
+        else
+            qmean = 0;
+    }
+
+    double get_qmin_2d() const
+    {
+        return get_qmin();
+    }
+
+    double get_qmin_3d() const
+    {
+        return get_qmin();
     }
 
     /// Return the reference length
@@ -1230,19 +1284,70 @@ public:
         return patch;
     }
 
+    /*! Finds the elements sharing a facet (an edge in 2D, a triangle in
+     * 3D) by intersecting the node-element lists of its vertices, without
+     * any temporary allocation.
+     * @param facet vertices of the facet.
+     * @param nfacet number of vertices in the facet, i.e. 2 in 2D and 3 in 3D.
+     * @param eids the first two elements found, in ascending order.
+     * @returns the number of elements sharing the facet.
+     */
+    int get_facet_elements(const index_t *facet, int nfacet, index_t *eids) const
+    {
+        int cnt = 0;
+        for(const auto &eid : NEList[facet[0]]) {
+            bool shared = true;
+            for(int k=1; k<nfacet; k++) {
+                if(NEList[facet[k]].count(eid)==0) {
+                    shared = false;
+                    break;
+                }
+            }
+            if(!shared)
+                continue;
+
+            if(cnt<2)
+                eids[cnt] = eid;
+            cnt++;
+        }
+
+        return cnt;
+    }
+
+    /*! Calculates the element-element (facet) adjacency of the current
+     * mesh: EEList[eid*nloc+i] is the element on the other side of the
+     * facet opposite vertex i of element eid, or -1 if there is none.
+     *
+     * The adjacency is not stored or maintained across topology changes.
+     * Only create_boundary() and set_internal_boundaries() need it for the
+     * whole mesh, and both run once before adaptation. The coarsening,
+     * refinement and swapping kernels look up the neighbours of the
+     * elements they touch with get_facet_elements() instead.
+     */
+    void calculate_EEList(std::vector<index_t> &EEList) const
+    {
+        size_t NElements = get_number_elements();
+        EEList.resize(NElements*nloc);
+
+        int nthreads = pragmatic_nthreads();
+        #pragma omp parallel for num_threads(nthreads) schedule(static)
+        for(size_t i=0; i<NElements; i++)
+            calculate_EEList_row(i, &(EEList[i*nloc]));
+    }
+
     /// Calculates the edge lengths in metric space.
     real_t calc_edge_length(index_t nid0, index_t nid1) const
     {
         real_t length=-1.0;
         if(ndims==2) {
-            double m[3];
+            real_t m[3];
             m[0] = (metric[nid0*3  ]+metric[nid1*3  ])*0.5;
             m[1] = (metric[nid0*3+1]+metric[nid1*3+1])*0.5;
             m[2] = (metric[nid0*3+2]+metric[nid1*3+2])*0.5;
 
             length = ElementProperty<real_t>::length2d(get_coords(nid0), get_coords(nid1), m);
         } else {
-            double m[6];
+            real_t m[6];
             m[0] = (metric[nid0*msize  ]+metric[nid1*msize  ])*0.5;
             m[1] = (metric[nid0*msize+1]+metric[nid1*msize+1])*0.5;
             m[2] = (metric[nid0*msize+2]+metric[nid1*msize+2])*0.5;
@@ -1282,6 +1387,165 @@ public:
         
     }
 
+    /*! Returns the ID of edge (nid0, nid1) in the edge table, or -1 if
+     * the edge is not in the table or either vertex has been moved or had
+     * its metric changed since the table was last updated. Edge IDs are
+     * stable until the next call to update_edges().
+     */
+    index_t get_edge_id(index_t nid0, index_t nid1) const
+    {
+        index_t i = std::min(nid0, nid1);
+        index_t j = std::max(nid0, nid1);
+
+        if((size_t)j>=edge_dirty.size() || edge_dirty[i] || edge_dirty[j])
+            return -1;
+
+        for(index_t eid=edge_head[i]; eid<edge_head[i+1]; eid++) {
+            if(edge_nid[eid]==j)
+                return eid;
+        }
+
+        return -1;
+    }
+
+    /// Edge length in metric space, cached in the edge table where possible.
+    real_t get_edge_length(index_t nid0, index_t nid1) const
+    {
+        index_t eid = get_edge_id(nid0, nid1);
+        if(eid<0 || edge_length[eid]<0)
+            return calc_edge_length(nid0, nid1);
+
+        return edge_length[eid];
+    }
+
+    /// Logarithmic mean edge length, cached in the edge table where possible.
+    real_t get_edge_length_log(index_t nid0, index_t nid1) const
+    {
+        index_t eid = get_edge_id(nid0, nid1);
+        if(eid<0 || edge_length_log[eid]<0)
+            return calc_edge_length_log(nid0, nid1);
+
+        return edge_length_log[eid];
+    }
+
+    /// Flags the edges around a vertex to be re-measured, e.g. after it has been moved.
+    void invalidate_edges(index_t nid)
+    {
+        if((size_t)nid<edge_dirty.size())
+            edge_dirty[nid] = 1;
+    }
+
+    /// Discards the whole edge table, e.g. after the metric has been replaced.
+    void invalidate_edges()
+    {
+        edge_head.clear();
+        edge_nid.clear();
+        edge_length.clear();
+        edge_length_log.clear();
+        edge_dirty.clear();
+    }
+
+    /// Lengths which update_edges() can be asked to measure.
+    static const int EDGE_LENGTH = 1;
+    static const int EDGE_LENGTH_LOG = 2;
+
+    /*! Brings the edge table up to date with the current mesh. Each edge
+     * (i, j), i<j, is stored in row i in the order it appears in NNList[i].
+     * Lengths are kept for edges which are not new and do not touch a
+     * vertex flagged by invalidate_edges(); all other edges are
+     * re-measured, but only with the lengths selected in lengths
+     * (EDGE_LENGTH, EDGE_LENGTH_LOG or both). Lengths which have not been
+     * measured are stored as -1, and are calculated on the fly by
+     * get_edge_length() and get_edge_length_log().
+     */
+    void update_edges(int lengths)
+    {
+        std::vector<index_t> old_head, old_nid;
+        std::vector<real_t> old_length, old_length_log;
+        std::vector<char> old_dirty;
+        old_head.swap(edge_head);
+        old_nid.swap(edge_nid);
+        old_length.swap(edge_length);
+        old_length_log.swap(edge_length_log);
+        old_dirty.swap(edge_dirty);
+        index_t old_NNodes = old_dirty.size();
+
+        index_t NNodes = get_number_nodes();
+        edge_head.resize(NNodes+1);
+        edge_head[0] = 0;
+
+        int nthreads = pragmatic_nthreads();
+        #pragma omp parallel num_threads(nthreads)
+        {
+            #pragma omp for schedule(static)
+            for(index_t i=0; i<NNodes; i++) {
+                index_t cnt = 0;
+                for(typename std::vector<index_t>::const_iterator it=NNList[i].begin(); it!=NNList[i].end(); ++it) {
+                    if(i<*it)
+                        cnt++;
+                }
+                edge_head[i+1] = cnt;
+            }
+
+            #pragma omp single
+            {
+                for(index_t i=0; i<NNodes; i++)
+                    edge_head[i+1] += edge_head[i];
+
+                edge_nid.resize(edge_head[NNodes]);
+                edge_length.resize(edge_head[NNodes]);
+                edge_length_log.resize(edge_head[NNodes]);
+            }
+
+            #pragma omp for schedule(guided)
+            for(index_t i=0; i<NNodes; i++) {
+                bool row_valid = i<old_NNodes && !old_dirty[i];
+
+                index_t eid = edge_head[i];
+                for(typename std::vector<index_t>::const_iterator it=NNList[i].begin(); it!=NNList[i].end(); ++it) {
+                    index_t j = *it;
+                    if(j<i)
+                        continue;
+
+                    edge_nid[eid] = j;
+
+                    index_t old_eid = -1;
+                    if(row_valid && j<old_NNodes && !old_dirty[j]) {
+                        for(index_t k=old_head[i]; k<old_head[i+1]; k++) {
+                            if(old_nid[k]==j) {
+                                old_eid = k;
+                                break;
+                            }
+                        }
+                    }
+
+                    if(old_eid<0) {
+                        edge_length[eid] = -1.0;
+                        edge_length_log[eid] = -1.0;
+                    } else {
+                        edge_length[eid] = old_length[old_eid];
+                        edge_length_log[eid] = old_length_log[old_eid];
+                    }
+
+                    if((lengths&EDGE_LENGTH) && edge_length[eid]<0)
+                        edge_length[eid] = calc_edge_length(i, j);
+                    if((lengths&EDGE_LENGTH_LOG) && edge_length_log[eid]<0)
+                        edge_length_log[eid] = calc_edge_length_log(i, j);
+
+                    eid++;
+                }
+            }
+        }
+
+        edge_dirty.assign(NNodes, 0);
+    }
+
+    /// Number of edges in the edge table.
+    size_t get_number_edges() const
+    {
+        return edge_nid.size();
+    }
+
     real_t maximal_edge_length() const
     {
         double L_max = 0.0;
@@ -1289,7 +1553,7 @@ public:
         for(index_t i=0; i<(index_t) NNodes; i++) {
             for(typename std::vector<index_t>::const_iterator it=NNList[i].begin(); it!=NNList[i].end(); ++it) {
                 if(i<*it) { // Ensure that every edge length is only calculated once.
-                    L_max = std::max(L_max, calc_edge_length(i, *it));
+                    L_max = std::max(L_max, (double)get_edge_length(i, *it));
                 }
             }
         }
@@ -1304,12 +1568,12 @@ public:
     real_t mean_edge_length() const
     {
         double L_mean = 0.0;
-        int nbrEdges = 0;
+        gnn_t nbrEdges = 0;
 
         for(index_t i=0; i<(index_t) NNodes; i++) {
             for(typename std::vector<index_t>::const_iterator it=NNList[i].begin(); it!=NNList[i].end(); ++it) {
                 if(i<*it) { // Ensure that every edge length is only calculated once.
-                    L_mean += calc_edge_length(i, *it);
+                    L_mean += get_edge_length(i, *it);
                     nbrEdges++;
                 }
             }
@@ -1317,15 +1581,30 @@ public:
 
         if(num_processes>1) {
             MPI_Allreduce(MPI_IN_PLACE, &L_mean, 1, MPI_DOUBLE, MPI_SUM, _mpi_comm);
-            MPI_Allreduce(MPI_IN_PLACE, &nbrEdges, 1, MPI_INT, MPI_SUM, _mpi_comm);
+            MPI_Allreduce(MPI_IN_PLACE, &nbrEdges, 1, MPI_GNN_T, MPI_SUM, _mpi_comm);
         }
 
         return L_mean/nbrEdges;
     }
 
+    /*! Renumber vertices and elements along a Hilbert curve whenever
+      the mesh is defragmented. After many adapt cycles the numbering no
+      longer follows the geometry, so this restores the locality of the
+      mesh data. */
+    void set_sfc_renumbering(bool enable)
+    {
+        sfc_renumbering = enable;
+    }
+
+    bool get_sfc_renumbering() const
+    {
+        return sfc_renumbering;
+    }
+
     /*! Defragment mesh. This compresses the storage of internal data
       structures. This is useful if the mesh has been significantly
-      coarsened. */
+      coarsened. If set_sfc_renumbering() is enabled the vertices and
+      elements are also sorted along a Hilbert curve. */
     void defragment()
     {
         // Discover which vertices and elements are active.
@@ -1391,11 +1670,46 @@ public:
 
         // Create a new numbering.
         index_t cnt=0;
-        for(size_t i=0; i<NNodes; i++) {
-            if(active_vertex_map[i]<0)
-                continue;
+        real_t bbox_min[3], scale=0;
+        if(sfc_renumbering) {
+            // Vertices are sorted by the Hilbert key of their coordinates.
+            real_t bbox_max[3];
+            for(size_t d=0; d<ndims; d++) {
+                bbox_min[d] = std::numeric_limits<real_t>::max();
+                bbox_max[d] = -std::numeric_limits<real_t>::max();
+            }
+            for(size_t i=0; i<NNodes; i++) {
+                if(active_vertex_map[i]<0)
+                    continue;
+
+                for(size_t d=0; d<ndims; d++) {
+                    bbox_min[d] = std::min(bbox_min[d], _coords[i*ndims+d]);
+                    bbox_max[d] = std::max(bbox_max[d], _coords[i*ndims+d]);
+                }
+            }
+            for(size_t d=0; d<ndims; d++)
+                scale = std::max(scale, bbox_max[d]-bbox_min[d]);
+            scale = scale>0?1/scale:1;
+
+            std::vector< std::pair<uint64_t, index_t> > sfc_order;
+            sfc_order.reserve(NNodes);
+            for(size_t i=0; i<NNodes; i++) {
+                if(active_vertex_map[i]<0)
+                    continue;
+
+                sfc_order.push_back(std::pair<uint64_t, index_t>(sfc_key(&_coords[i*ndims], bbox_min, scale), i));
+            }
+            std::sort(sfc_order.begin(), sfc_order.end());
 
-            active_vertex_map[i] = cnt++;
+            for(typename std::vector< std::pair<uint64_t, index_t> >::const_iterator it=sfc_order.begin(); it!=sfc_order.end(); ++it)
+                active_vertex_map[it->second] = cnt++;
+        } else {
+            for(size_t i=0; i<NNodes; i++) {
+                if(active_vertex_map[i]<0)
+                    continue;
+
+                active_vertex_map[i] = cnt++;
+            }
         }
 
         // Renumber elements
@@ -1423,13 +1737,34 @@ public:
             element_renumber.push_back(it->second);
         }
 
+        if(sfc_renumbering) {
+            // Elements are sorted by the Hilbert key of their centroid.
+            std::vector< std::pair<uint64_t, index_t> > sfc_order(element_renumber.size());
+            for(size_t i=0; i<element_renumber.size(); i++) {
+                index_t old_eid = element_renumber[i];
+                real_t centroid[3] = {0, 0, 0};
+                for(size_t j=0; j<nloc; j++) {
+                    for(size_t d=0; d<ndims; d++)
+                        centroid[d] += _coords[_ENList[old_eid*nloc+j]*ndims+d];
+                }
+                for(size_t d=0; d<ndims; d++)
+                    centroid[d] /= nloc;
+
+                sfc_order[i] = std::pair<uint64_t, index_t>(sfc_key(centroid, bbox_min, scale), old_eid);
+            }
+            std::sort(sfc_order.begin(), sfc_order.end());
+
+            for(size_t i=0; i<element_renumber.size(); i++)
+                element_renumber[i] = sfc_order[i].second;
+        }
+
         // Compress data structures.
         NNodes = cnt;
         NElements = ordered_elements.size();
 
         std::vector<index_t> defrag_ENList(NElements*nloc);
         std::vector<real_t> defrag_coords(NNodes*ndims);
-        std::vector<double> defrag_metric(NNodes*msize);
+        std::vector<real_t> defrag_metric(NNodes*msize);
         std::vector<int> defrag_boundary(NElements*nloc);
         std::vector<int> defrag_regions(NElements);
         std::vector<double> defrag_quality(NElements);
@@ -1477,11 +1812,11 @@ public:
         memcpy(&regions[0], &defrag_regions[0], NElements*sizeof(int));
         memcpy(&quality[0], &defrag_quality[0], NElements*sizeof(double));
         memcpy(&_coords[0], &defrag_coords[0], NNodes*ndims*sizeof(real_t));
-        memcpy(&metric[0], &defrag_metric[0], NNodes*msize*sizeof(double));
+        memcpy(&metric[0], &defrag_metric[0], NNodes*msize*sizeof(real_t));
 
         // Renumber halo, fix lnn2gnn and node_owner.
         if(num_processes>1) {
-            std::vector<index_t> defrag_lnn2gnn(NNodes);
+            std::vector<gnn_t> defrag_lnn2gnn(NNodes);
             std::vector<int> defrag_owner(NNodes);
 
             for(size_t old_nid=0; old_nid<active_vertex_map.size(); ++old_nid) {
@@ -1573,7 +1908,7 @@ public:
             }
 
         // Check for the correctness of NNList and NEList.
-        std::vector< std::set<index_t> > local_NEList(NNodes);
+        std::vector<element_set_t> local_NEList(NNodes);
         std::vector< std::set<index_t> > local_NNList(NNodes);
         for(size_t i=0; i<NElements; i++) {
             if(_ENList[i*nloc]<0)
@@ -1653,11 +1988,11 @@ public:
                     if(local_NEList[i]!=NEList[i]) {
                         result = "fail (local_NEList["+std::to_string(i)+"]!=NEList["+std::to_string(i)+"])\n";
                         printf("\n  local_NEList: ");
-                        for (std::set<index_t>::const_iterator it=local_NEList[i].begin(); it!=local_NEList[i].end(); ++it)
+                        for (element_set_t::const_iterator it=local_NEList[i].begin(); it!=local_NEList[i].end(); ++it)
                             printf(" %d ", *it);
                         printf("\n");
                         printf("  NEList: ");
-                        for (std::set<index_t>::const_iterator it=NEList[i].begin(); it!=NEList[i].end(); ++it)
+                        for (element_set_t::const_iterator it=NEList[i].begin(); it!=NEList[i].end(); ++it)
                             printf(" %d ", *it);
                         printf("\n");
                         state = false;
@@ -1752,15 +2087,21 @@ public:
             }
         }
 
-        double cachedq=0;
+        // get_qmean() and get_qmin() read the cached qualities, so also
+        // sum the qualities freshly evaluated from the current metric.
+        double cachedq=0, freshq=0;
+        std::vector<double> q(NElements);
+        calculate_quality(0, NElements, q.data());
         for(size_t i=0; i<NElements; i++) {
             const index_t *n=get_element(i);
             if(n[0]<0)
                 continue;
             cachedq += quality[i];
+            freshq += q[i];
         }
 
         MPI_Allreduce(MPI_IN_PLACE, &cachedq, 1, MPI_DOUBLE, MPI_SUM, get_mpi_comm());
+        MPI_Allreduce(MPI_IN_PLACE, &freshq, 1, MPI_DOUBLE, MPI_SUM, get_mpi_comm());
 
         double qmean = get_qmean();
         double qmin = get_qmin();
@@ -1768,6 +2109,7 @@ public:
             std::cout<<"VERIFY: mean quality......."<<qmean<<std::endl;
             std::cout<<"VERIFY: min quality........"<<qmin<<std::endl;
             std::cout<<"VERIFY: cached quality....."<<cachedq<<std::endl;
+            std::cout<<"VERIFY: evaluated quality.."<<freshq<<std::endl;
         }
 
         int false_cnt = state?0:1;
@@ -1830,8 +2172,8 @@ public:
         // -- Get rid of gappy global numbering and get contiguous global numbering
         create_global_node_numbering();
             
-        int NPNodes = NNodes - recv_halo.size();            
-        MPI_Scan(&NPNodes, &gnn_offset, 1, MPI_INT, MPI_SUM, get_mpi_comm());
+        gnn_t NPNodes = NNodes - recv_halo.size();
+        MPI_Scan(&NPNodes, &gnn_offset, 1, MPI_GNN_T, MPI_SUM, get_mpi_comm());
         gnn_offset-=NPNodes;
         
         // -- Get rid of shared elements: ownership of an element is defined by min(owner(vertices))
@@ -1843,6 +2185,8 @@ public:
                     owner = node_owner[_ENList[iElm*nloc+i]];
             if (owner == rank) {
                 for (int i=0; i<nloc; ++i) {
+                    // The contiguous numbering must still fit in the element list.
+                    assert(lnn2gnn[_ENList[iElm*nloc+i]]<=std::numeric_limits<index_t>::max());
                     _ENList[iElm_new*nloc+i] = lnn2gnn[_ENList[iElm*nloc+i]];
                     boundary[iElm_new*nloc+i] = boundary[iElm*nloc+i];
                 }
@@ -1862,37 +2206,37 @@ public:
         FILE * logfile = fopen(filename.c_str(), "w");
 
         for (int iVer=0; iVer<get_number_nodes(); ++iVer){
-            const double * coords = get_coords(iVer);
+            const real_t * coords = get_coords(iVer);
             if (ndims==2) 
-                fprintf(logfile, "DBG(%d)  vertex[%d (%d)]  %1.2f %1.2f owned by: %d  - metric: %1.3f %1.3f %1.3f\n", 
-                   rank, iVer, get_global_numbering(iVer), coords[0], coords[1], node_owner[iVer],
+                fprintf(logfile, "DBG(%d)  vertex[%d (%lld)]  %1.2f %1.2f owned by: %d  - metric: %1.3f %1.3f %1.3f\n", 
+                   rank, iVer, (long long)get_global_numbering(iVer), coords[0], coords[1], node_owner[iVer],
                    metric[msize*iVer], metric[msize*iVer+1], metric[msize*iVer+2]);
             else 
-                fprintf(logfile, "DBG(%d)  vertex[%d (%d)]  %1.2f %1.2f %1.2f owned by: %d  - metric: %1.3f %1.3f %1.3f %1.3f %1.3f %1.3f\n", 
-                   rank, iVer, get_global_numbering(iVer), coords[0], coords[1], coords[2], node_owner[iVer],
+                fprintf(logfile, "DBG(%d)  vertex[%d (%lld)]  %1.2f %1.2f %1.2f owned by: %d  - metric: %1.3f %1.3f %1.3f %1.3f %1.3f %1.3f\n", 
+                   rank, iVer, (long long)get_global_numbering(iVer), coords[0], coords[1], coords[2], node_owner[iVer],
                    metric[msize*iVer], metric[msize*iVer+1], metric[msize*iVer+2], metric[msize*iVer+3], metric[msize*iVer+4], metric[msize*iVer+5]);
         }
         for (int iElm=0; iElm<get_number_elements(); ++iElm){
             const int * elm = get_element(iElm);
             if (ndims==2) 
-                fprintf(logfile, "DBG(%d)  triangle[%d]  %d %d %d  (gnn: %d %d %d)  quality: %1.2f  boundary: %d %d %d\n", 
-                    rank, iElm, elm[0], elm[1], elm[2], lnn2gnn[elm[0]], lnn2gnn[elm[1]], lnn2gnn[elm[2]], 
+                fprintf(logfile, "DBG(%d)  triangle[%d]  %d %d %d  (gnn: %lld %lld %lld)  quality: %1.2f  boundary: %d %d %d\n", 
+                    rank, iElm, elm[0], elm[1], elm[2], (long long)lnn2gnn[elm[0]], (long long)lnn2gnn[elm[1]], (long long)lnn2gnn[elm[2]], 
                     quality[iElm], boundary[nloc*iElm], boundary[nloc*iElm+1], boundary[nloc*iElm+2]);
             else
-                fprintf(logfile, "DBG(%d)  tet[%d]  %d %d %d %d  (gnn: %d %d %d %d)  quality: %1.2f  boundary: %d %d %d %d\n", 
+                fprintf(logfile, "DBG(%d)  tet[%d]  %d %d %d %d  (gnn: %lld %lld %lld %lld)  quality: %1.2f  boundary: %d %d %d %d\n", 
                     rank, iElm, elm[0], elm[1], elm[2], elm[3], 
-                    lnn2gnn[elm[0]], lnn2gnn[elm[1]], lnn2gnn[elm[2]], lnn2gnn[elm[3]], quality[iElm], 
+                    (long long)lnn2gnn[elm[0]], (long long)lnn2gnn[elm[1]], (long long)lnn2gnn[elm[2]], (long long)lnn2gnn[elm[3]], quality[iElm], 
                     boundary[nloc*iElm], boundary[nloc*iElm+1], boundary[nloc*iElm+2], boundary[nloc*iElm+3]);
         }
 
         fprintf(logfile, "DBG(%d)  Adjacency:\n", rank);
         for (int iVer=0; iVer<get_number_nodes(); ++iVer){
-            fprintf(logfile, "DBG(%d)  vertex[%d (%d)] ", rank, iVer, lnn2gnn[iVer]);
+            fprintf(logfile, "DBG(%d)  vertex[%d (%lld)] ", rank, iVer, (long long)lnn2gnn[iVer]);
             fprintf(logfile, "  Neighboring nodes: ");
             for (int i=0; i<NNList[iVer].size(); ++i) 
-                fprintf(logfile, "%d (%d) ", NNList[iVer][i], lnn2gnn[NNList[iVer][i]]);
+                fprintf(logfile, "%d (%lld) ", NNList[iVer][i], (long long)lnn2gnn[NNList[iVer][i]]);
             fprintf(logfile, "  Neighboring elements: ");
-            for (std::set<index_t>::const_iterator it=NEList[iVer].begin(); it!=NEList[iVer].end(); ++it)
+            for (element_set_t::const_iterator it=NEList[iVer].begin(); it!=NEList[iVer].end(); ++it)
                 fprintf(logfile, " %d ", *it); 
             fprintf(logfile, "\n");
         }
@@ -1907,8 +2251,8 @@ public:
         printf("DBG(%d)  %s\n", rank, text);
 
         for (int iVer=0; iVer<get_number_nodes(); ++iVer){
-          const double * coords = get_coords(iVer);
-          printf("DBG(%d)  vertex[%d (%d)]  %1.2f %1.2f\n", rank, iVer, get_global_numbering(iVer), coords[0], coords[1]);
+          const real_t * coords = get_coords(iVer);
+          printf("DBG(%d)  vertex[%d (%lld)]  %1.2f %1.2f\n", rank, iVer, (long long)get_global_numbering(iVer), coords[0], coords[1]);
         }
         for (int iTri=0; iTri<get_number_elements(); ++iTri){
             const int * tri = get_element(iTri);
@@ -1930,15 +2274,15 @@ public:
         printf("DBG(%d)  recv_map:\n", rank);
         for (int i=0; i<recv_map.size(); ++i){
             printf("DBG(%d)           [%d]", rank, i);
-            for (std::map<index_t,index_t>::const_iterator it=recv_map[i].begin(); it!=recv_map[i].end(); ++it)
-                printf("  %d->%d", it->first, it->second);
+            for (auto it=recv_map[i].begin(); it!=recv_map[i].end(); ++it)
+                printf("  %lld->%d", (long long)it->first, it->second);
             printf("\n");
         }
         printf("DBG(%d)  send_map:\n", rank);
         for (int i=0; i<send_map.size(); ++i){
             printf("DBG(%d)           [%d]", rank, i);
-            for (std::map<index_t,index_t>::const_iterator it=send_map[i].begin(); it!=send_map[i].end(); ++it)
-                printf("  %d->%d", it->first, it->second);
+            for (auto it=send_map[i].begin(); it!=send_map[i].end(); ++it)
+                printf("  %lld->%d", (long long)it->first, it->second);
             printf("\n");
         }
         printf("DBG(%d)  recv_halo:\n", rank);
@@ -1971,13 +2315,13 @@ public:
 
     void compute_print_NNodes_global()
     {   
-        int NNodes_loc = 0;
+        gnn_t NNodes_loc = 0;
         for (int iVer=0; iVer<NNodes; ++iVer) {
             if (node_owner[iVer] == rank)
                 NNodes_loc++;
         }
 
-        MPI_Allreduce(MPI_IN_PLACE, &NNodes_loc, 1, MPI_INT, MPI_SUM, get_mpi_comm());
+        MPI_Allreduce(MPI_IN_PLACE, &NNodes_loc, 1, MPI_GNN_T, MPI_SUM, get_mpi_comm());
 
         if(rank==0) {
             std::cout<<"INFO: num nodes..............."<<NNodes_loc<<std::endl;
@@ -1992,14 +2336,33 @@ private:
     template<typename _real_t, int _dim> friend class Coarsen;
     template<typename _real_t, int _dim> friend class Refine;
     template<typename _real_t> friend class DeferredOperations;
+    template<typename _real_t> friend class Colouring;
     template<typename _real_t> friend class VTKTools;
 
+    /// Computes row eid of the element-element adjacency into row[0..nloc).
+    void calculate_EEList_row(index_t eid, index_t *row) const
+    {
+        for(size_t j=0; j<nloc; j++) {
+            row[j] = -1;
+            if(_ENList[eid*nloc]==-1)
+                continue;
+
+            index_t facet[3], eids[2];
+            for(size_t k=1; k<nloc; k++)
+                facet[k-1] = _ENList[eid*nloc+(j+k)%nloc];
+
+            if(get_facet_elements(facet, nloc-1, eids)==2)
+                row[j] = (eids[0]==eid)?eids[1]:eids[0];
+        }
+    }
+
     void _init(int _NNodes, int _NElements, const index_t *ENList,
                const real_t *x, const real_t *y, const real_t *z,
-               const index_t *lnn2gnn, index_t NPNodes)
+               const gnn_t *lnn2gnn, index_t NPNodes)
     {
         num_processes = 1;
         rank=0;
+        sfc_renumbering = false;
 
         NElements = _NElements;
         NNodes = _NNodes;
@@ -2007,9 +2370,11 @@ private:
         MPI_Comm_size(_mpi_comm, &num_processes);
         MPI_Comm_rank(_mpi_comm, &rank);
 
-        // Assign the correct MPI data type to MPI_INDEX_T and MPI_REAL_T
+        // Assign the correct MPI data type to MPI_INDEX_T, MPI_GNN_T and MPI_REAL_T
         mpi_type_wrapper<index_t> mpi_index_t_wrapper;
         MPI_INDEX_T = mpi_index_t_wrapper.mpi_type;
+        mpi_type_wrapper<gnn_t> mpi_gnn_t_wrapper;
+        MPI_GNN_T = mpi_gnn_t_wrapper.mpi_type;
         mpi_type_wrapper<real_t> mpi_real_t_wrapper;
         MPI_REAL_T = mpi_real_t_wrapper.mpi_type;
 
@@ -2025,9 +2390,9 @@ private:
 
         // From the (local) ENList, create the halo.
 #ifdef HAVE_BOOST_UNORDERED_MAP_HPP
-        boost::unordered_map<index_t, index_t> gnn2lnn;
+        boost::unordered_map<gnn_t, index_t> gnn2lnn;
 #else
-        std::map<index_t, index_t> gnn2lnn;
+        std::map<gnn_t, index_t> gnn2lnn;
 #endif
         if(num_processes>1) {
             assert(lnn2gnn!=NULL);
@@ -2035,17 +2400,17 @@ private:
                 gnn2lnn[lnn2gnn[i]] = i;
             }
 
-            std::vector<index_t> owner_range(num_processes+1);
-            index_t bufIn = NPNodes;
-            MPI_Allgather(&bufIn, 1, MPI_INDEX_T, owner_range.data()+1, 1, MPI_INDEX_T, _mpi_comm);
+            std::vector<gnn_t> owner_range(num_processes+1);
+            gnn_t bufIn = NPNodes;
+            MPI_Allgather(&bufIn, 1, MPI_GNN_T, owner_range.data()+1, 1, MPI_GNN_T, _mpi_comm);
             for(int i=1;i<=num_processes;i++) {
                 owner_range[i]+=owner_range[i-1];
             }
 
-            std::vector< std::set<index_t> > recv_set(num_processes);
+            std::vector< std::set<gnn_t> > recv_set(num_processes);
             for(size_t i=0; i<(size_t)NElements*nloc; i++) {
                 index_t lnn = ENList[i];
-                index_t gnn = lnn2gnn[lnn];
+                gnn_t gnn = lnn2gnn[lnn];
                 for(int j=0; j<num_processes; j++) {
                     if(gnn<owner_range[j+1]) {
                         if(j!=rank)
@@ -2054,14 +2419,14 @@ private:
                     }
                 }
             }
+            // Exchange the global numbers of the halo, then translate them to local numbers.
+            std::vector< std::vector<gnn_t> > recv_gnn(num_processes), send_gnn(num_processes);
             std::vector<int> recv_size(num_processes);
             recv.resize(num_processes);
             recv_map.resize(num_processes);
             for(int j=0; j<num_processes; j++) {
-                for(typename std::set<int>::const_iterator it=recv_set[j].begin(); it!=recv_set[j].end(); ++it) {
-                    recv[j].push_back(*it);
-                }
-                recv_size[j] = recv[j].size();
+                recv_gnn[j].assign(recv_set[j].begin(), recv_set[j].end());
+                recv_size[j] = recv_gnn[j].size();
             }
             std::vector<int> send_size(num_processes);
             MPI_Alltoall(recv_size.data(), 1, MPI_INT,
@@ -2075,8 +2440,8 @@ private:
                 if((i==rank)||(send_size[i]==0)) {
                     request[i] =  MPI_REQUEST_NULL;
                 } else {
-                    send[i].resize(send_size[i]);
-                    MPI_Irecv(&(send[i][0]), send_size[i], MPI_INDEX_T, i, 0, _mpi_comm, &(request[i]));
+                    send_gnn[i].resize(send_size[i]);
+                    MPI_Irecv(&(send_gnn[i][0]), send_size[i], MPI_GNN_T, i, 0, _mpi_comm, &(request[i]));
                 }
             }
 
@@ -2085,7 +2450,7 @@ private:
                 if((i==rank)||(recv_size[i]==0)) {
                     request[num_processes+i] =  MPI_REQUEST_NULL;
                 } else {
-                    MPI_Isend(&(recv[i][0]), recv_size[i], MPI_INDEX_T, i, 0, _mpi_comm, &(request[num_processes+i]));
+                    MPI_Isend(&(recv_gnn[i][0]), recv_size[i], MPI_GNN_T, i, 0, _mpi_comm, &(request[num_processes+i]));
                 }
             }
 
@@ -2094,15 +2459,17 @@ private:
             MPI_Waitall(num_processes, &(request[num_processes]), &(status[num_processes]));
 
             for(int j=0; j<num_processes; j++) {
+                recv[j].resize(recv_size[j]);
                 for(int k=0; k<recv_size[j]; k++) {
-                    index_t gnn = recv[j][k];
+                    gnn_t gnn = recv_gnn[j][k];
                     index_t lnn = gnn2lnn[gnn];
                     recv_map[j][gnn] = lnn;
                     recv[j][k] = lnn;
                 }
 
+                send[j].resize(send_size[j]);
                 for(int k=0; k<send_size[j]; k++) {
-                    index_t gnn = send[j][k];
+                    gnn_t gnn = send_gnn[j][k];
                     index_t lnn = gnn2lnn[gnn];
                     send_map[j][gnn] = lnn;
                     send[j][k] = lnn;
@@ -2112,6 +2479,7 @@ private:
         }
 
         _ENList.resize(NElements*nloc);
+        regions.resize(NElements);
         quality.resize(NElements);
         _coords.resize(NNodes*ndims);
         metric.resize(NNodes*msize);
@@ -2207,139 +2575,85 @@ private:
     /// Create required adjacency lists.
     void create_adjacency()
     {
+        invalidate_edges();
+
         NNList.clear();
         NNList.resize(NNodes);
         NEList.clear();
         NEList.resize(NNodes);
 
-        for(size_t i=0; i<NElements; i++) {
-            if(_ENList[i*nloc]<0)
-                continue;
-
-            for(size_t j=0; j<nloc; j++) {
-                index_t nid_j = _ENList[i*nloc+j];
-                assert(nid_j<NNodes);
-                NEList[nid_j].insert(NEList[nid_j].end(), i);
-                for(size_t k=0; k<nloc; k++) {
-                    if(j!=k) {
-                        index_t nid_k = _ENList[i*nloc+k];
-                        assert(nid_k<NNodes);
-                        NNList[nid_j].push_back(nid_k);
-                    }
-                }
-            }
-        }
-
-        // Finalise
-        for(size_t i=0; i<NNodes; i++) {
-            if(NNList[i].empty())
-                continue;
+        int nthreads = pragmatic_nthreads();
 
-            std::vector<index_t> *nnset = new std::vector<index_t>();
+        // Node-element adjacency is first assembled in compressed row
+        // storage: count the elements around each node, prefix-sum the
+        // counts into offsets and scatter the element IDs.
+        std::vector<index_t> NEcount(NNodes+1, 0);
+        std::vector<index_t> NEflat;
 
-            std::sort(NNList[i].begin(),NNList[i].end());
-            std::unique_copy(NNList[i].begin(), NNList[i].end(), std::inserter(*nnset, nnset->begin()));
+#pragma omp parallel num_threads(nthreads)
+        {
+#pragma omp for schedule(static)
+            for(size_t i=0; i<NElements; i++) {
+                if(_ENList[i*nloc]<0)
+                    continue;
 
-            NNList[i].swap(*nnset);
-            delete nnset;
-        }
-    }
+                for(size_t j=0; j<nloc; j++) {
+                    index_t nid_j = _ENList[i*nloc+j];
+                    assert(nid_j<NNodes);
+#pragma omp atomic update
+                    NEcount[nid_j+1]++;
+                }
+            }
 
+#pragma omp single
+            {
+                for(size_t i=0; i<NNodes; i++)
+                    NEcount[i+1] += NEcount[i];
 
-    void set_internal_boundaries_2d()
-    {
+                NEflat.resize(NEcount[NNodes]);
+            }
 
-        // loop over edges through vertex connectivity
-        for (int iVer = 0; iVer < NNodes; ++iVer) {
-            for (int i=0; i<NNList[iVer].size(); ++i) {
-                int iVer2 = NNList[iVer][i];
-                if (iVer2 < iVer)
+            // NEcount[i] is used as the insertion cursor for node i. Once the
+            // scatter is complete it has moved on to the start of node i+1.
+#pragma omp for schedule(static)
+            for(size_t i=0; i<NElements; i++) {
+                if(_ENList[i*nloc]<0)
                     continue;
 
-                std::set<index_t> neighbour_elements;
-                std::set_intersection(NEList[iVer].begin(), NEList[iVer].end(),
-                                      NEList[iVer2].begin(), NEList[iVer2].end(),
-                                      std::inserter(neighbour_elements, neighbour_elements.begin()));
-
-                typename std::set<index_t>::const_iterator elm_it;
-                int region_tag = -10;
-                bool one_region = true;
-                for(elm_it=neighbour_elements.begin(); elm_it!=neighbour_elements.end(); ++elm_it) {
-                    if (region_tag < 0)
-                        region_tag = regions[*elm_it];
-                    else {
-                        if (region_tag != regions[*elm_it]) {
-                            one_region = false;
-                            break;
-                        }
-                    }
-                }
-                // Now locate the edge in each element and set a boundary tag
-                if (!one_region) {
-                    for(elm_it=neighbour_elements.begin(); elm_it!=neighbour_elements.end(); ++elm_it) {
-                        const index_t *elm = get_element(*elm_it);
-                        for (int i=0; i<nloc; ++i) {
-                            if (elm[i]!=iVer && elm[i]!=iVer2) {
-                                boundary[nloc*(*elm_it)+i] = max_bdry_tag+1;
-                            }
-                        }
-                    }
+                for(size_t j=0; j<nloc; j++) {
+                    index_t nid_j = _ENList[i*nloc+j];
+                    index_t pos;
+#pragma omp atomic capture
+                    pos = NEcount[nid_j]++;
+                    NEflat[pos] = i;
                 }
             }
-        }
-    }
-
-
-    void set_internal_boundaries_3d()
-    {
-
-        // loop over facets through vertex connectivity
-        for (int iVer = 0; iVer < NNodes; ++iVer) {
-            for (int i=0; i<NNList[iVer].size(); ++i) {
-                int iVer2 = NNList[iVer][i];
-                if (iVer2 < iVer) continue;
-                for (int j=0; j<NNList[iVer].size(); ++j) {
-                    if (i==j) continue;
-                    int iVer3 = NNList[iVer][j];
-                    if (iVer3 < iVer2) continue;
 
-                    std::set<index_t> neighbour_elements1, neighbour_elements2, neighbour_elements;
-                    std::set_intersection(NEList[iVer].begin(), NEList[iVer].end(),
-                                          NEList[iVer2].begin(), NEList[iVer2].end(),
-                                          std::inserter(neighbour_elements1, neighbour_elements1.begin()));
-                    std::set_intersection(NEList[iVer].begin(), NEList[iVer].end(),
-                                          NEList[iVer3].begin(), NEList[iVer3].end(),
-                                          std::inserter(neighbour_elements2, neighbour_elements2.begin()));
-                    std::set_intersection(neighbour_elements1.begin(), neighbour_elements1.end(),
-                                          neighbour_elements2.begin(), neighbour_elements2.end(),
-                                          std::inserter(neighbour_elements, neighbour_elements.begin()));
+            // Finalise. The element order within a row depends on thread
+            // timing, so sort each row before creating the lists.
+            std::vector<index_t> patch;
+#pragma omp for schedule(guided)
+            for(size_t i=0; i<NNodes; i++) {
+                index_t begin = (i==0)?0:NEcount[i-1];
+                index_t end = NEcount[i];
+                if(begin==end)
+                    continue;
 
-                    typename std::set<index_t>::const_iterator elm_it;
-                    int region_tag = -10;
-                    bool one_region = true;
-                    for(elm_it=neighbour_elements.begin(); elm_it!=neighbour_elements.end(); ++elm_it) {
-                        if (region_tag < 0)
-                            region_tag = regions[*elm_it];
-                        else {
-                            if (region_tag != regions[*elm_it]) {
-                                one_region = false;
-                                break;
-                            }
-                        }
-                    }
+                std::sort(NEflat.begin()+begin, NEflat.begin()+end);
+                NEList[i].insert(NEflat.begin()+begin, NEflat.begin()+end);
 
-                    // Now locate the edge in each element and set a boundary tag
-                    if (!one_region) {
-                        for(elm_it=neighbour_elements.begin(); elm_it!=neighbour_elements.end(); ++elm_it) {
-                            const index_t *elm = get_element(*elm_it);
-                            for (int i=0; i<nloc; ++i) {
-                                if (elm[i]!=iVer && elm[i]!=iVer2 && elm[i]!=iVer3) {
-                                    boundary[nloc*(*elm_it)+i] = max_bdry_tag+1;
-                                }
-                            }
-                        }
+                patch.clear();
+                for(index_t k=begin; k<end; k++) {
+                    const index_t *n = &(_ENList[NEflat[k]*nloc]);
+                    for(size_t j=0; j<nloc; j++) {
+                        if(n[j]!=(index_t)i)
+                            patch.push_back(n[j]);
                     }
                 }
+                std::sort(patch.begin(), patch.end());
+                patch.erase(std::unique(patch.begin(), patch.end()), patch.end());
+
+                NNList[i].assign(patch.begin(), patch.end());
             }
         }
     }
@@ -2357,16 +2671,16 @@ private:
 
             std::vector<index_t> recv_temp;
 #ifdef HAVE_BOOST_UNORDERED_MAP_HPP
-            boost::unordered_map<index_t, index_t> recv_map_temp;
+            boost::unordered_map<gnn_t, index_t> recv_map_temp;
 #else
-            std::map<index_t, index_t> recv_map_temp;
+            std::map<gnn_t, index_t> recv_map_temp;
 #endif
 
             for(typename std::vector<index_t>::const_iterator vit = recv[i].begin(); vit != recv[i].end(); ++vit) {
                 // For each vertex, traverse a copy of the vertex's NEList.
                 // We need a copy because erase_element modifies the original NEList.
-                std::set<index_t> NEList_copy = NEList[*vit];
-                for(typename std::set<index_t>::const_iterator eit = NEList_copy.begin(); eit != NEList_copy.end(); ++eit) {
+                element_set_t NEList_copy = NEList[*vit];
+                for(typename element_set_t::const_iterator eit = NEList_copy.begin(); eit != NEList_copy.end(); ++eit) {
                     // Check whether all vertices comprising the element belong to another MPI process.
                     std::vector<index_t> n(nloc);
                     get_element(*eit, &n[0]);
@@ -2438,9 +2752,9 @@ private:
 
             std::vector<index_t> send_temp;
 #ifdef HAVE_BOOST_UNORDERED_MAP_HPP
-            boost::unordered_map<index_t, index_t> send_map_temp;
+            boost::unordered_map<gnn_t, index_t> send_map_temp;
 #else
-            std::map<index_t, index_t> send_map_temp;
+            std::map<gnn_t, index_t> send_map_temp;
 #endif
 
             for(typename std::vector<index_t>::const_iterator vit = send[i].begin(); vit != send[i].end(); ++vit) {
@@ -2471,9 +2785,9 @@ private:
         
         if(num_processes>1) {
             // Calculate the global numbering offset for this partition.
-            int gnn_offset;
-            int NPNodes = NNodes - recv_halo.size();
-            MPI_Scan(&NPNodes, &gnn_offset, 1, MPI_INT, MPI_SUM, get_mpi_comm());
+            gnn_t gnn_offset;
+            gnn_t NPNodes = NNodes - recv_halo.size();
+            MPI_Scan(&NPNodes, &gnn_offset, 1, MPI_GNN_T, MPI_SUM, get_mpi_comm());
             gnn_offset-=NPNodes;
 
             // Write global node numbering and ownership for nodes assigned to local process.
@@ -2487,7 +2801,7 @@ private:
             }
 
             // Update GNN's for the halo nodes.
-            halo_update<int, 1>(_mpi_comm, send, recv, lnn2gnn);
+            halo_update<gnn_t, 1>(_mpi_comm, send, recv, lnn2gnn);
             
             // Finish writing node ownerships.
             for(int i=0; i<num_processes; i++) {
@@ -2507,8 +2821,8 @@ private:
     {
         // We expect to have NElements_predict/2 nodes in the partition,
         // so let's reserve 10 times more space for global node numbers.
-        index_t gnn_reserve = 5*pNElements;
-        MPI_Scan(&gnn_reserve, &gnn_offset, 1, MPI_INDEX_T, MPI_SUM, _mpi_comm);
+        gnn_t gnn_reserve = 5*pNElements;
+        MPI_Scan(&gnn_reserve, &gnn_offset, 1, MPI_GNN_T, MPI_SUM, _mpi_comm);
         gnn_offset -= gnn_reserve;
 
         for(size_t i=0; i<NNodes; ++i) {
@@ -2518,7 +2832,7 @@ private:
                 lnn2gnn[i] = -1;
         }
 
-        halo_update<int, 1>(_mpi_comm, send, recv, lnn2gnn);
+        halo_update<gnn_t, 1>(_mpi_comm, send, recv, lnn2gnn);
 
         for(int i=0; i<num_processes; i++) {
             send_map[i].clear();
@@ -2541,18 +2855,18 @@ private:
         std::vector<MPI_Request> request(num_processes*2);
 
         // Setup non-blocking receives.
-        std::vector< std::vector<index_t> > recv_buff(num_processes);
+        std::vector< std::vector<gnn_t> > recv_buff(num_processes);
         for(int i=0; i<num_processes; i++) {
             if(recv_cnt[i]==0) {
                 request[i] =  MPI_REQUEST_NULL;
             } else {
                 recv_buff[i].resize(recv_cnt[i]);
-                MPI_Irecv(&(recv_buff[i][0]), recv_buff[i].size(), MPI_INDEX_T, i, 0, _mpi_comm, &(request[i]));
+                MPI_Irecv(&(recv_buff[i][0]), recv_buff[i].size(), MPI_GNN_T, i, 0, _mpi_comm, &(request[i]));
             }
         }
 
         // Non-blocking sends.
-        std::vector< std::vector<index_t> > send_buff(num_processes);
+        std::vector< std::vector<gnn_t> > send_buff(num_processes);
         for(int i=0; i<num_processes; i++) {
             if(send_cnt[i]==0) {
                 request[num_processes+i] = MPI_REQUEST_NULL;
@@ -2560,7 +2874,7 @@ private:
                 for(typename std::vector<index_t>::const_iterator it=send[i].end()-send_cnt[i]; it!=send[i].end(); ++it)
                     send_buff[i].push_back(lnn2gnn[*it]);
 
-                MPI_Isend(&(send_buff[i][0]), send_buff[i].size(), MPI_INDEX_T, i, 0, _mpi_comm, &(request[num_processes+i]));
+                MPI_Isend(&(send_buff[i][0]), send_buff[i].size(), MPI_GNN_T, i, 0, _mpi_comm, &(request[num_processes+i]));
             }
         }
 
@@ -2582,17 +2896,17 @@ private:
         // Compute bounding box locally
         double bbox_loc[] = {DBL_MAX, -DBL_MAX, DBL_MAX, -DBL_MAX, DBL_MAX, -DBL_MAX};
         for (int iVer = 0; iVer < NNodes; ++iVer) {
-            const double *x = &_coords[iVer];
+            const real_t *x = &_coords[iVer];
 
-            bbox_loc[0] = std::min(bbox_loc[0], x[0]);
-            bbox_loc[1] = std::max(bbox_loc[1], x[0]);
+            bbox_loc[0] = std::min(bbox_loc[0], (double)x[0]);
+            bbox_loc[1] = std::max(bbox_loc[1], (double)x[0]);
 
-            bbox_loc[2] = std::min(bbox_loc[2], x[1]);
-            bbox_loc[3] = std::max(bbox_loc[3], x[1]);
+            bbox_loc[2] = std::min(bbox_loc[2], (double)x[1]);
+            bbox_loc[3] = std::max(bbox_loc[3], (double)x[1]);
 
             if (ndims == 3) {
-                bbox_loc[4] = std::min(bbox_loc[4], x[2]);
-                bbox_loc[5] = std::max(bbox_loc[5], x[2]);
+                bbox_loc[4] = std::min(bbox_loc[4], (double)x[2]);
+                bbox_loc[5] = std::max(bbox_loc[5], (double)x[2]);
             }
         }
 
@@ -2620,29 +2934,47 @@ private:
     }
 
 
+    /// Hilbert key of point x, scaled into the unit box by (x-bbox_min)*scale.
+    uint64_t sfc_key(const real_t *x, const real_t *bbox_min, real_t scale) const
+    {
+        const int bits = ndims==2?31:21;
+        const double max_coord = (double)((1u<<bits)-1);
+
+        uint32_t X[3];
+        for(size_t d=0; d<ndims; d++) {
+            double r = std::min(std::max((double)((x[d]-bbox_min[d])*scale), 0.0), 1.0);
+            X[d] = (uint32_t)(r*max_coord);
+        }
+
+        if(ndims==2)
+            return hilbert_key<2>(X, bits);
+        else
+            return hilbert_key<3>(X, bits);
+    }
+
     template<int dim>
     inline double calculate_quality(const index_t* n)
     {
         if(dim==2) {
-            const double *x0 = get_coords(n[0]);
-            const double *x1 = get_coords(n[1]);
-            const double *x2 = get_coords(n[2]);
+            const real_t *x0 = get_coords(n[0]);
+            const real_t *x1 = get_coords(n[1]);
+            const real_t *x2 = get_coords(n[2]);
 
-            const double *m0 = get_metric(n[0]);
-            const double *m1 = get_metric(n[1]);
-            const double *m2 = get_metric(n[2]);
+            const real_t *m0 = get_metric(n[0]);
+            const real_t *m1 = get_metric(n[1]);
+            const real_t *m2 = get_metric(n[2]);
 
             return property->lipnikov(x0, x1, x2, m0, m1, m2);
         } else {
-            const double *x0 = get_coords(n[0]);
-            const double *x1 = get_coords(n[1]);
-            const double *x2 = get_coords(n[2]);
-            const double *x3 = get_coords(n[3]);
+            const real_t *x0 = get_coords(n[0]);
+            const real_t *x1 = get_coords(n[1]);
+            const real_t *x2 = get_coords(n[2]);
+            const real_t *x3 = get_coords(n[3]);
 
-            const double *m0 = get_metric(n[0]);
-            const double *m1 = get_metric(n[1]);
-            const double *m2 = get_metric(n[2]);
-            const double *m3 = get_metric(n[3]);
+            const real_t *m0 = get_metric(n[0]);
+            const real_t *m1 = get_metric(n[1]);
+            const real_t *m2 = get_metric(n[2]);
+            const real_t *m3 = get_metric(n[3]);
 
             return property->lipnikov(x0, x1, x2, x3, m0, m1, m2, m3);
         }
@@ -2660,6 +2992,23 @@ private:
         }
     }
 
+    /*! Evaluate the quality of elements [begin, end) into q with the
+     * batched Lipnikov functional. Erased elements get a quality of 0.
+     */
+    inline void calculate_quality(index_t begin, index_t end, double *q) const
+    {
+        if(ndims==2)
+            property->lipnikov_batch_2d(end-begin, &(_ENList[begin*3]), _coords.data(), metric.data(), q);
+        else
+            property->lipnikov_batch_3d(end-begin, &(_ENList[begin*4]), _coords.data(), metric.data(), q);
+    }
+
+    /// Update the cached quality of elements [begin, end).
+    inline void update_quality(index_t begin, index_t end)
+    {
+        calculate_quality(begin, end, &(quality[begin]));
+    }
+
     size_t ndims, nloc, msize;
     std::vector<index_t> _ENList;
     std::vector<real_t> _coords;
@@ -2680,13 +3029,25 @@ private:
     std::vector<double> quality;
 
     // Adjacency lists
-    std::vector< std::set<index_t> > NEList;
+    std::vector<element_set_t> NEList;
     std::vector< std::vector<index_t> > NNList;
 
+    // Edge table: CSR rows of edges with cached metric lengths, and
+    // per-vertex flags marking edges which must be re-measured.
+    std::vector<index_t> edge_head, edge_nid;
+    std::vector<real_t> edge_length, edge_length_log;
+    std::vector<char> edge_dirty;
+
+    // Slots of erased vertices and elements, see update_free_slots().
+    std::vector<index_t> free_vertices, free_elements;
+
+    // Renumber along a Hilbert curve in defragment().
+    bool sfc_renumbering;
+
     ElementProperty<real_t> *property;
 
     // Metric tensor field.
-    std::vector<double> metric;
+    std::vector<real_t> metric;
 
     // Reference length of the domain
     double Lref;
@@ -2695,19 +3056,20 @@ private:
     int rank, num_processes;
     std::vector< std::vector<index_t> > send, recv;
 #ifdef HAVE_BOOST_UNORDERED_MAP_HPP
-    std::vector< boost::unordered_map<index_t, index_t> > send_map, recv_map;
+    std::vector< boost::unordered_map<gnn_t, index_t> > send_map, recv_map;
 #else
-    std::vector< std::map<index_t, index_t> > send_map, recv_map;
+    std::vector< std::map<gnn_t, index_t> > send_map, recv_map;
 #endif
     std::set<index_t> send_halo, recv_halo;
     std::vector<int> node_owner;
-    std::vector<index_t> lnn2gnn;
+    std::vector<gnn_t> lnn2gnn;
 
-    index_t gnn_offset;
+    gnn_t gnn_offset;
     MPI_Comm _mpi_comm;
 
-    // MPI data type for index_t and real_t
+    // MPI data type for index_t, gnn_t and real_t
     MPI_Datatype MPI_INDEX_T;
+    MPI_Datatype MPI_GNN_T;
     MPI_Datatype MPI_REAL_T;
 };
 
@@ -38,6 +38,7 @@
 #ifndef METRICFIELD_H
 #define METRICFIELD_H
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <map>
@@ -82,6 +83,8 @@ public:
         MPI_Comm_size(_mesh->get_mpi_comm(), &nprocs);
         MPI_Comm_rank(_mesh->get_mpi_comm(), &rank);
 
+        nthreads = pragmatic_nthreads();
+
         double bbox[dim*2];
         for(int i=0; i<dim; i++) {
             bbox[i*2] = DBL_MAX;
@@ -98,8 +101,8 @@ public:
             const real_t *x = _mesh->get_coords(i);
 
             for(int j=0; j<dim; j++) {
-                lbbox[j*2] = std::min(lbbox[j*2], x[j]);
-                lbbox[j*2+1] = std::max(lbbox[j*2+1], x[j]);
+                lbbox[j*2] = std::min(lbbox[j*2], (double)x[j]);
+                lbbox[j*2+1] = std::max(lbbox[j*2+1], (double)x[j]);
             }
         }
 
@@ -130,6 +133,7 @@ public:
 
         if(dim==2) {
             double alpha = pow(1.0/resolution_scaling_factor, 2);
+#pragma omp parallel for num_threads(nthreads) schedule(guided)
             for(int i=0; i<_NNodes; i++)
             {
                 real_t m[3];
@@ -143,6 +147,7 @@ public:
             }
         } else {
             double alpha = pow(1.0/resolution_scaling_factor, 2);
+#pragma omp parallel for num_threads(nthreads) schedule(guided)
             for(int i=0; i<_NNodes; i++)
             {
                 real_t m[6];
@@ -373,6 +378,7 @@ public:
             exit(-1);
         } else {
             std::vector<double> SteinerMetricField(_NElements*6);
+#pragma omp parallel for num_threads(nthreads) schedule(static)
             for(int i=0; i<_NElements; i++) {
                 const index_t *n=_mesh->get_element(i);
 
@@ -385,12 +391,13 @@ public:
             }
 
             double alpha = pow(1.0/resolution_scaling_factor, 2);
+#pragma omp parallel for num_threads(nthreads) schedule(guided)
             for(int i=0; i<_NNodes; i++) {
                 double sm[6];
                 for(int j=0; j<6; j++)
                     sm[j] = 0.0;
 
-                for(typename std::set<index_t>::const_iterator ie=_mesh->NEList[i].begin(); ie!=_mesh->NEList[i].end(); ++ie) {
+                for(typename element_set_t::const_iterator ie=_mesh->NEList[i].begin(); ie!=_mesh->NEList[i].end(); ++ie) {
                     for(int j=0; j<6; j++)
                         sm[j]+=SteinerMetricField[(*ie)*6+j];
                 }
@@ -489,7 +496,7 @@ public:
 
         size_t pNElements = (size_t)predict_nelements_part();
 
-        // We don't really know how much addition space we'll need so this was set after some experimentation.
+        // We don't really know how many global numbers we'll need so this was set after some experimentation.
         size_t fudge = 5;
 
         if(pNElements > _mesh->NElements) {
@@ -504,24 +511,15 @@ public:
             pNElements = _mesh->NElements * fudge;
         }
 
-        // In 2D, the number of nodes is ~ 1/2 the number of elements.
-        // In 3D, the number of nodes is ~ 1/6 the number of elements.
-        size_t pNNodes = pNElements/(dim==2?2:6);
-
-        _mesh->_ENList.resize(pNElements*(dim+1));
-        _mesh->boundary.resize(pNElements*(dim+1));
-        _mesh->quality.resize(pNElements);
-        _mesh->_coords.resize(pNNodes*dim);
-        _mesh->metric.resize(pNNodes*(dim==2?3:6));
-        _mesh->NNList.resize(pNNodes);
-        _mesh->NEList.resize(pNNodes);
-        _mesh->node_owner.resize(pNNodes, -1);
-        _mesh->lnn2gnn.resize(pNNodes, -1);
+        // The mesh arrays grow on demand as vertices and elements are
+        // created, reusing erased slots first, so only global node
+        // numbers are reserved up front.
 
         // At this point we can establish a new, gappy global numbering system
         if(nprocs>1)
             _mesh->create_gappy_global_numbering(pNElements);
 
+#pragma omp parallel for num_threads(nthreads) schedule(static)
         for(int i=0; i<_NNodes; i++) {
             double M[dim==2?3:6];
             _metric[i].get_metric(M);
@@ -531,7 +529,17 @@ public:
         }
 
         // Halo update if parallel
-        halo_update<double, (dim==2?3:6)>(_mesh->get_mpi_comm(), _mesh->send, _mesh->recv, _mesh->metric);
+        halo_update<real_t, (dim==2?3:6)>(_mesh->get_mpi_comm(), _mesh->send, _mesh->recv, _mesh->metric);
+
+        // The cached element qualities were evaluated with the old metric.
+        const int batch = ElementProperty<real_t>::batch_size;
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+        for(int i=0; i<_NElements; i+=batch) {
+            _mesh->update_quality(i, std::min(i+batch, _NElements));
+        }
+
+        // Every edge length changes with the metric.
+        _mesh->invalidate_edges();
     }
 
 
@@ -542,7 +550,7 @@ public:
 
         size_t pNElements = (size_t)predict_nelements_part();
 
-        // We don't really know how much addition space we'll need so this was set after some experimentation.
+        // We don't really know how many global numbers we'll need so this was set after some experimentation.
         size_t fudge = 5;
 
         if(pNElements > _mesh->NElements) {
@@ -557,35 +565,33 @@ public:
             pNElements = _mesh->NElements * fudge;
         }
 
-        // In 2D, the number of nodes is ~ 1/2 the number of elements.
-        // In 3D, the number of nodes is ~ 1/6 the number of elements.
-        size_t pNNodes = std::max(pNElements/(dim==2?2:6), _mesh->get_number_nodes());
-
-        _mesh->_ENList.resize(pNElements*(dim+1));
-        _mesh->boundary.resize(pNElements*(dim+1));
-        _mesh->regions.resize(pNElements);
-        _mesh->quality.resize(pNElements);
-        _mesh->_coords.resize(pNNodes*dim);
-        _mesh->metric.resize(pNNodes*(dim==2?3:6));
-        _mesh->NNList.resize(pNNodes);
-        _mesh->NEList.resize(pNNodes);
-        _mesh->node_owner.resize(pNNodes, -1);
-        _mesh->lnn2gnn.resize(pNNodes, -1);
+        // The mesh arrays grow on demand as vertices and elements are
+        // created, reusing erased slots first, so only global node
+        // numbers are reserved up front.
 
         // At this point we can establish a new, gappy global numbering system
         if(nprocs>1)
             _mesh->create_gappy_global_numbering(pNElements);
 
+#pragma omp parallel for num_threads(nthreads) schedule(static)
         for(int i=0; i<_NNodes; i++) {
             _metric[i].get_metric(&(_mesh->metric[i*(dim==2?3:6)]));
         }
 
-        for(int i=0; i<_NElements; i++) {
-            _mesh->template update_quality<dim>(i);
+        // Halo update if parallel
+        halo_update<real_t, (dim==2?3:6)>(_mesh->get_mpi_comm(), _mesh->send, _mesh->recv, _mesh->metric);
+
+        // Element qualities are evaluated a batch at a time by the
+        // vectorised functional, once the halo metric is up to date, and
+        // cached for Mesh::get_qmean() and Mesh::get_qmin().
+        const int batch = ElementProperty<real_t>::batch_size;
+#pragma omp parallel for num_threads(nthreads) schedule(static)
+        for(int i=0; i<_NElements; i+=batch) {
+            _mesh->update_quality(i, std::min(i+batch, _NElements));
         }
 
-        // Halo update if parallel
-        halo_update<double, (dim==2?3:6)>(_mesh->get_mpi_comm(), _mesh->send, _mesh->recv, _mesh->metric);
+        // Every edge length changes with the metric.
+        _mesh->invalidate_edges();
     }
 
     /*! Add the contribution from the metric field from a new field with a target linear interpolation error.
@@ -597,6 +603,22 @@ public:
      * pp. 179-204.
      */
     void add_field(const real_t* psi, const real_t target_error, int p_norm=-1)
+    {
+        add_fields(&psi, 1, &target_error, p_norm);
+    }
+
+    /*! Add the contribution to the metric field from several fields at
+     * once, each with its own target error. The result is the same as
+     * calling add_field() for each field in turn, but the least squares
+     * system at each vertex is assembled and factorised only once for all
+     * of the fields, and the metrics of the fields are intersected in the
+     * same pass.
+     * @param psi fields whose curvature is to be considered.
+     * @param nfields number of fields.
+     * @param target_errors target error for each field.
+     * @param p_norm as for add_field().
+     */
+    void add_fields(const real_t* psi[], int nfields, const real_t* target_errors, int p_norm=-1)
     {
         bool add_to=true;
         if(_metric==NULL) {
@@ -604,75 +626,32 @@ public:
             _metric = new MetricTensor<real_t,dim>[_NNodes];
         }
 
-        real_t eta = 1.0/target_error;
+        if(patch_head.empty())
+            build_patches();
 
-        // Calculate Hessian at each point.
-        double h[dim==2?3:6];
+        // Calculate Hessian at each point. The recovery at each vertex
+        // only reads psi and the mesh, so vertices are independent.
+#pragma omp parallel num_threads(nthreads)
+        {
+            std::vector<real_t> h(nfields*(dim==2?3:6));
 
-        if(p_norm>0) {
+#pragma omp for schedule(guided)
             for(int i=0; i<_NNodes; i++) {
-                hessian_qls_kernel(psi, i, h);
+                hessian_qls_kernel(psi, nfields, i, h.data());
 
-                double m_det;
-                if(dim==2) {
-                    /*|h[0] h[1]|
-                      |h[1] h[2]|*/
-                    m_det = fabs(h[0]*h[2]-h[1]*h[1]);
-                } else if(dim==3) {
-                    /*|h[0] h[1] h[2]|
-                      |h[1] h[3] h[4]|
-                      |h[2] h[4] h[5]|
-
-                      sympy
-                      h0,h1,h2,h3,h4,h5 = symbols("h[0], h[1], h[2], h[3], h[4], h[5]")
-                      M = Matrix([[h0, h1, h2],
-                      [h1, h3, h4],
-                      [h2, h4, h5]])
-                      print_ccode(det(M))
-                      */
-                    m_det = fabs(h[0]*h[3]*h[5] - h[0]*pow(h[4], 2) - pow(h[1], 2)*h[5] + 2*h[1]*h[2]*h[4] - pow(h[2], 2)*h[3]);
-                }
+                for(int f=0; f<nfields; f++) {
+                    real_t *hf = &(h[f*(dim==2?3:6)]);
 
-                double scaling_factor = eta * pow(m_det+DBL_EPSILON, -1.0 / (2.0 * p_norm + dim));
+                    real_t eta = 1.0/target_errors[f];
+                    scale_hessian(hf, eta, p_norm);
 
-                if(std::isnormal(scaling_factor)) {
-                    for(int j=0; j<(dim==2?3:6); j++)
-                        h[j] *= scaling_factor;
-                } else {
-                    if(dim==2) {
-                        h[0] = min_eigenvalue;
-                        h[1] = 0.0;
-                        h[2] = min_eigenvalue;
+                    if(add_to || f>0) {
+                        // Merge this metric with the existing metric field.
+                        _metric[i].constrain(hf);
                     } else {
-                        h[0] = min_eigenvalue;
-                        h[1] = 0.0;
-                        h[2] = 0.0;
-                        h[3] = min_eigenvalue;
-                        h[4] = 0.0;
-                        h[5] = min_eigenvalue;
+                        _metric[i].set_metric(hf);
                     }
                 }
-
-                if(add_to) {
-                    // Merge this metric with the existing metric field.
-                    _metric[i].constrain(h);
-                } else {
-                    _metric[i].set_metric(h);
-                }
-            }
-        } else {
-            for(int i=0; i<_NNodes; i++) {
-                hessian_qls_kernel(psi, i, h);
-
-                for(int j=0; j<(dim==2?3:6); j++)
-                    h[j] *= eta;
-
-                if(add_to) {
-                    // Merge this metric with the existing metric field.
-                    _metric[i].constrain(h);
-                } else {
-                    _metric[i].set_metric(h);
-                }
             }
         }
     }
@@ -698,6 +677,7 @@ public:
             M[5] = m;
         }
 
+#pragma omp parallel for num_threads(nthreads) schedule(static)
         for(int i=0; i<_NNodes; i++)
             _metric[i].constrain(&(M[0]));
     }
@@ -723,6 +703,7 @@ public:
             M[5] = m;
         }
 
+#pragma omp parallel for num_threads(nthreads) schedule(static)
         for(int i=0; i<_NNodes; i++)
             _metric[i].constrain(M, false);
     }
@@ -732,9 +713,10 @@ public:
      */
     void apply_min_edge_length(const real_t *min_len)
     {
-        real_t M[dim==2?3:6];
+#pragma omp parallel for num_threads(nthreads) schedule(static)
         for(int n=0; n<_NNodes; n++)
         {
+            real_t M[dim==2?3:6];
             double m = 1.0/(min_len[n]*min_len[n]);
 
             if(dim==2) {
@@ -759,6 +741,7 @@ public:
      */
     void apply_max_aspect_ratio(real_t max_aspect_ratio)
     {
+#pragma omp parallel for num_threads(nthreads) schedule(static)
         for(int i=0; i<_NNodes; i++)
             _metric[i].limit_aspect_ratio(max_aspect_ratio);
     }
@@ -792,6 +775,7 @@ public:
         if(dim==3)
             scale_factor = pow(scale_factor, 2.0/3.0);
 
+#pragma omp parallel for num_threads(nthreads) schedule(static)
         for(int i=0; i<_NNodes; i++)
             _metric[i].scale(scale_factor);
     }
@@ -898,233 +882,276 @@ public:
 
 private:
 
-    /// Least squared Hessian recovery.
-    void hessian_qls_kernel(const real_t *psi, int i, real_t *Hessian)
+    /*! Scales a recovered Hessian by eta, the inverse of the target
+     * error, and optionally by the p-norm scaling; see add_field().
+     */
+    void scale_hessian(real_t *h, real_t eta, int p_norm) const
     {
-        int min_patch_size = (dim==2?6:15); // In 3D, 10 is the minimum but can give crappy results.
+        if(p_norm>0) {
+            double m_det;
+            if(dim==2) {
+                /*|h[0] h[1]|
+                  |h[1] h[2]|*/
+                m_det = fabs(h[0]*h[2]-h[1]*h[1]);
+            } else if(dim==3) {
+                /*|h[0] h[1] h[2]|
+                  |h[1] h[3] h[4]|
+                  |h[2] h[4] h[5]|
+
+                  sympy
+                  h0,h1,h2,h3,h4,h5 = symbols("h[0], h[1], h[2], h[3], h[4], h[5]")
+                  M = Matrix([[h0, h1, h2],
+                  [h1, h3, h4],
+                  [h2, h4, h5]])
+                  print_ccode(det(M))
+                  */
+                m_det = fabs(h[0]*h[3]*h[5] - h[0]*pow(h[4], 2) - pow(h[1], 2)*h[5] + 2*h[1]*h[2]*h[4] - pow(h[2], 2)*h[3]);
+            }
 
-        std::set<index_t> patch = _mesh->get_node_patch(i, min_patch_size);
-        patch.insert(i);
+            double scaling_factor = eta * pow(m_det+DBL_EPSILON, -1.0 / (2.0 * p_norm + dim));
 
-        if(dim==2) {
-            // Form quadratic system to be solved. The quadratic fit is:
-            // P = a0*y^2+a1*x^2+a2*x*y+a3*y+a4*x+a5
-            // A = P^TP
-            Eigen::Matrix<real_t, 6, 6> A = Eigen::Matrix<real_t, 6, 6>::Zero(6,6);
-            Eigen::Matrix<real_t, 6, 1> b = Eigen::Matrix<real_t, 6, 1>::Zero(6);
-
-            real_t x0=_mesh->_coords[i*2], y0=_mesh->_coords[i*2+1];
-
-            for(typename std::set<index_t>::const_iterator n=patch.begin(); n!=patch.end(); n++) {
-                real_t x=_mesh->_coords[(*n)*2]-x0, y=_mesh->_coords[(*n)*2+1]-y0;
-
-                A(0,0)+=y*y*y*y;
-                A(1,0)+=x*x*y*y;
-                A(1,1)+=x*x*x*x;
-                A(2,0)+=x*y*y*y;
-                A(2,1)+=x*x*x*y;
-                A(2,2)+=x*x*y*y;
-                A(3,0)+=y*y*y;
-                A(3,1)+=x*x*y;
-                A(3,2)+=x*y*y;
-                A(3,3)+=y*y;
-                A(4,0)+=x*y*y;
-                A(4,1)+=x*x*x;
-                A(4,2)+=x*x*y;
-                A(4,3)+=x*y;
-                A(4,4)+=x*x;
-                A(5,0)+=y*y;
-                A(5,1)+=x*x;
-                A(5,2)+=x*y;
-                A(5,3)+=y;
-                A(5,4)+=x;
-                A(5,5)+=1;
-
-                b[0]+=psi[*n]*y*y;
-                b[1]+=psi[*n]*x*x;
-                b[2]+=psi[*n]*x*y;
-                b[3]+=psi[*n]*y;
-                b[4]+=psi[*n]*x;
-                b[5]+=psi[*n];
+            if(std::isnormal(scaling_factor)) {
+                for(int j=0; j<(dim==2?3:6); j++)
+                    h[j] *= scaling_factor;
+            } else {
+                if(dim==2) {
+                    h[0] = min_eigenvalue;
+                    h[1] = 0.0;
+                    h[2] = min_eigenvalue;
+                } else {
+                    h[0] = min_eigenvalue;
+                    h[1] = 0.0;
+                    h[2] = 0.0;
+                    h[3] = min_eigenvalue;
+                    h[4] = 0.0;
+                    h[5] = min_eigenvalue;
+                }
             }
-            A(0,1) = A(1,0);
-            A(0,2) = A(2,0);
-            A(0,3) = A(3,0);
-            A(0,4) = A(4,0);
-            A(0,5) = A(5,0);
-            A(1,2) = A(2,1);
-            A(1,3) = A(3,1);
-            A(1,4)= A(4,1);
-            A(1,5)= A(5,1);
-            A(2,3)= A(3,2);
-            A(2,4)= A(4,2);
-            A(2,5)= A(5,2);
-            A(3,4)= A(4,3);
-            A(3,5)= A(5,3);
-            A(4,5)= A(5,4);
-
-            Eigen::Matrix<real_t, 6, 1> a = Eigen::Matrix<real_t, 6, 1>::Zero(6);
-            Eigen::JacobiSVD<Eigen::Matrix<real_t, 6, 6>, Eigen::HouseholderQRPreconditioner> svd(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
-
-            a = svd.solve(b);
-
-            Hessian[0] = 2*a[1]; // d2/dx2
-            Hessian[1] = a[2];   // d2/dxdy
-            Hessian[2] = 2*a[0]; // d2/dy2
+        } else {
+            for(int j=0; j<(dim==2?3:6); j++)
+                h[j] *= eta;
+        }
+    }
 
-        } else if(dim==3) {
-            // Form quadratic system to be solved. The quadratic fit is:
-            // P = 1 + x + y + z + x^2 + y^2 + z^2 + xy + xz + yz
-            // A = P^TP
-            Eigen::Matrix<real_t, 10, 10> A = Eigen::Matrix<real_t, 10, 10>::Zero(10,10);
-            Eigen::Matrix<real_t, 10, 1> b = Eigen::Matrix<real_t, 10, 1>::Zero(10);
-
-            real_t x0=_mesh->_coords[i*3], y0=_mesh->_coords[i*3+1], z0=_mesh->_coords[i*3+2];
-            assert(std::isfinite(x0));
-            assert(std::isfinite(y0));
-            assert(std::isfinite(z0));
-
-            for(typename std::set<index_t>::const_iterator n=patch.begin(); n!=patch.end(); n++) {
-                real_t x=_mesh->_coords[(*n)*3]-x0, y=_mesh->_coords[(*n)*3+1]-y0, z=_mesh->_coords[(*n)*3+2]-z0;
-                assert(std::isfinite(x));
-                assert(std::isfinite(y));
-                assert(std::isfinite(z));
-                assert(std::isfinite(psi[*n]));
-
-                A(0,0)+=1;
-                A(1,0)+=x;
-                A(1,1)+=x*x;
-                A(2,0)+=y;
-                A(2,1)+=x*y;
-                A(2,2)+=y*y;
-                A(3,0)+=z;
-                A(3,1)+=x*z;
-                A(3,2)+=y*z;
-                A(3,3)+=z*z;
-                A(4,0)+=x*x;
-                A(4,1)+=x*x*x;
-                A(4,2)+=x*x*y;
-                A(4,3)+=x*x*z;
-                A(4,4)+=x*x*x*x;
-                A(5,0)+=x*y;
-                A(5,1)+=x*x*y;
-                A(5,2)+=x*y*y;
-                A(5,3)+=x*y*z;
-                A(5,4)+=x*x*x*y;
-                A(5,5)+=x*x*y*y;
-                A(6,0)+=x*z;
-                A(6,1)+=x*x*z;
-                A(6,2)+=x*y*z;
-                A(6,3)+=x*z*z;
-                A(6,4)+=x*x*x*z;
-                A(6,5)+=x*x*y*z;
-                A(6,6)+=x*x*z*z;
-                A(7,0)+=y*y;
-                A(7,1)+=x*y*y;
-                A(7,2)+=y*y*y;
-                A(7,3)+=y*y*z;
-                A(7,4)+=x*x*y*y;
-                A(7,5)+=x*y*y*y;
-                A(7,6)+=x*y*y*z;
-                A(7,7)+=y*y*y*y;
-                A(8,0)+=y*z;
-                A(8,1)+=x*y*z;
-                A(8,2)+=y*y*z;
-                A(8,3)+=y*z*z;
-                A(8,4)+=x*x*y*z;
-                A(8,5)+=x*y*y*z;
-                A(8,6)+=x*y*z*z;
-                A(8,7)+=y*y*y*z;
-                A(8,8)+=y*y*z*z;
-                A(9,0)+=z*z;
-                A(9,1)+=x*z*z;
-                A(9,2)+=y*z*z;
-                A(9,3)+=z*z*z;
-                A(9,4)+=x*x*z*z;
-                A(9,5)+=x*y*z*z;
-                A(9,6)+=x*z*z*z;
-                A(9,7)+=y*y*z*z;
-                A(9,8)+=y*z*z*z;
-                A(9,9)+=z*z*z*z;
-
-                b[0]+=psi[*n]*1;
-                b[1]+=psi[*n]*x;
-                b[2]+=psi[*n]*y;
-                b[3]+=psi[*n]*z;
-                b[4]+=psi[*n]*x*x;
-                b[5]+=psi[*n]*x*y;
-                b[6]+=psi[*n]*x*z;
-                b[7]+=psi[*n]*y*y;
-                b[8]+=psi[*n]*y*z;
-                b[9]+=psi[*n]*z*z;
+    /*! Builds the least squares fitting patch of every vertex in CSR
+     * form. A patch is the ring of vertices around a vertex, grown ring
+     * by ring until it holds at least min_patch_size vertices, plus the
+     * vertex itself. The vertices of each patch are stored in ascending
+     * order.
+     */
+    void build_patches()
+    {
+        patch_head.resize(_NNodes+1);
+        patch_head[0] = 0;
+
+#pragma omp parallel num_threads(nthreads)
+        {
+            std::vector<char> mark(_NNodes, 0);
+            std::vector<index_t> patch;
+
+#pragma omp for schedule(guided)
+            for(int i=0; i<_NNodes; i++) {
+                grow_patch(i, mark, patch);
+                patch_head[i+1] = patch.size();
             }
 
-            A(0,1) = A(1,0);
-            A(0,2) = A(2,0);
-            A(0,3) = A(3,0);
-            A(0,4) = A(4,0);
-            A(0,5) = A(5,0);
-            A(0,6) = A(6,0);
-            A(0,7) = A(7,0);
-            A(0,8) = A(8,0);
-            A(0,9) = A(9,0);
-            A(1,2) = A(2,1);
-            A(1,3) = A(3,1);
-            A(1,4) = A(4,1);
-            A(1,5) = A(5,1);
-            A(1,6) = A(6,1);
-            A(1,7) = A(7,1);
-            A(1,8) = A(8,1);
-            A(1,9) = A(9,1);
-            A(2,3) = A(3,2);
-            A(2,4) = A(4,2);
-            A(2,5) = A(5,2);
-            A(2,6) = A(6,2);
-            A(2,7) = A(7,2);
-            A(2,8) = A(8,2);
-            A(2,9) = A(9,2);
-            A(3,4) = A(4,3);
-            A(3,5) = A(5,3);
-            A(3,6) = A(6,3);
-            A(3,7) = A(7,3);
-            A(3,8) = A(8,3);
-            A(3,9) = A(9,3);
-            A(4,5) = A(5,4);
-            A(4,6) = A(6,4);
-            A(4,7) = A(7,4);
-            A(4,8) = A(8,4);
-            A(4,9) = A(9,4);
-            A(5,6) = A(6,5);
-            A(5,7) = A(7,5);
-            A(5,8) = A(8,5);
-            A(5,9) = A(9,5);
-            A(6,7) = A(7,6);
-            A(6,8) = A(8,6);
-            A(6,9) = A(9,6);
-            A(7,8) = A(8,7);
-            A(7,9) = A(9,7);
-            A(8,9) = A(9,8);
-
-            Eigen::Matrix<real_t, 10, 1> a = Eigen::Matrix<real_t, 10, 1>::Zero(10);
-            Eigen::JacobiSVD<Eigen::Matrix<real_t, 10, 10>, Eigen::HouseholderQRPreconditioner> svd(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
-
-            a = svd.solve(b);
-
-            Hessian[0] = a[4]*2.0; // d2/dx2
-            Hessian[1] = a[5];     // d2/dxdy
-            Hessian[2] = a[6];     // d2/dxdz
-            Hessian[3] = a[7]*2.0; // d2/dy2
-            Hessian[4] = a[8];     // d2/dydz
-            Hessian[5] = a[9]*2.0; // d2/dz2
+#pragma omp single
+            {
+                for(int i=0; i<_NNodes; i++)
+                    patch_head[i+1] += patch_head[i];
+                patch_nodes.resize(patch_head[_NNodes]);
+            }
+
+#pragma omp for schedule(guided)
+            for(int i=0; i<_NNodes; i++) {
+                grow_patch(i, mark, patch);
+                std::copy(patch.begin(), patch.end(), patch_nodes.begin()+patch_head[i]);
+            }
+        }
+    }
+
+    /*! Grows the patch of vertex i, as described in build_patches().
+     * @param mark scratch flags, one per vertex, all zero on entry and exit.
+     * @param patch the patch of i.
+     */
+    void grow_patch(index_t i, std::vector<char> &mark, std::vector<index_t> &patch) const
+    {
+        const size_t min_patch_size = std::min(dim==2?6:15, _NNodes); // In 3D, 10 is the minimum but can give crappy results.
+
+        patch.clear();
+        for(typename std::vector<index_t>::const_iterator it=_mesh->NNList[i].begin(); it!=_mesh->NNList[i].end(); ++it) {
+            mark[*it] = 1;
+            patch.push_back(*it);
+        }
+
+        size_t front = 0;
+        while(patch.size()<min_patch_size) {
+            size_t end = patch.size();
+            for(size_t k=front; k<end; k++) {
+                for(typename std::vector<index_t>::const_iterator it=_mesh->NNList[patch[k]].begin(); it!=_mesh->NNList[patch[k]].end(); ++it) {
+                    if(!mark[*it]) {
+                        mark[*it] = 1;
+                        patch.push_back(*it);
+                    }
+                }
+            }
+
+            // The connected region around i is smaller than min_patch_size.
+            if(patch.size()==end)
+                break;
+
+            front = end;
         }
+
+        if(!mark[i])
+            patch.push_back(i);
+
+        for(size_t k=0; k<patch.size(); k++)
+            mark[patch[k]] = 0;
+
+        std::sort(patch.begin(), patch.end());
+    }
+
+    /*! Least squares Hessian recovery of one or more fields at vertex i.
+     * A quadratic is fitted to each field over the patch of i. The normal
+     * equations only depend on the patch, so they are assembled and
+     * factorised once and back-substituted for every field.
+     *
+     * The normal equations scale with the fourth power of the local edge
+     * length, so they are assembled and solved in double precision,
+     * whatever precision the mesh is stored in, and are symmetrically
+     * scaled to unit diagonal before being factorised. They are solved
+     * with LDLT unless the pivots show them to be ill-conditioned, e.g.
+     * for a patch on a flat boundary, in which case the least squares
+     * solution is found with an SVD.
+     *
+     * @param psi pointers to the nfields fields.
+     * @param nfields number of fields.
+     * @param i vertex at which the Hessian is recovered.
+     * @param Hessian upper triangle of the Hessian of each field in turn.
+     */
+    void hessian_qls_kernel(const real_t * const *psi, int nfields, int i, real_t *Hessian)
+    {
+        const int nbasis = dim==2?6:10;
+        typedef Eigen::Matrix<double, nbasis, nbasis> matrix_t;
+        typedef Eigen::Matrix<double, nbasis, 1> vector_t;
+
+        // Quadratic basis at each vertex of the patch, relative to vertex i.
+        // 2D: P = a0*y^2 + a1*x^2 + a2*x*y + a3*y + a4*x + a5
+        // 3D: P = a0 + a1*x + a2*y + a3*z + a4*x^2 + a5*x*y + a6*x*z + a7*y^2 + a8*y*z + a9*z^2
+        double x0[dim];
+        for(int d=0; d<dim; d++)
+            x0[d] = _mesh->get_coords(i)[d];
+
+        matrix_t A = matrix_t::Zero();
+        for(index_t k=patch_head[i]; k<patch_head[i+1]; k++) {
+            const real_t *xn = _mesh->get_coords(patch_nodes[k]);
+            vector_t p;
+            if(dim==2) {
+                double x=xn[0]-x0[0], y=xn[1]-x0[1];
+                p << y*y, x*x, x*y, y, x, 1.0;
+            } else {
+                double x=xn[0]-x0[0], y=xn[1]-x0[1], z=xn[2]-x0[2];
+                assert(std::isfinite(x) && std::isfinite(y) && std::isfinite(z));
+                p << 1.0, x, y, z, x*x, x*y, x*z, y*y, y*z, z*z;
+            }
+
+            for(int r=0; r<nbasis; r++)
+                for(int c=0; c<=r; c++)
+                    A(r,c) += p[r]*p[c];
+        }
+
+        // Scale to unit diagonal.
+        vector_t S;
+        bool singular = false;
+        for(int r=0; r<nbasis; r++) {
+            singular = singular || !(A(r,r)>0.0);
+            S[r] = singular ? 1.0 : 1.0/sqrt(A(r,r));
+        }
+        for(int r=0; r<nbasis; r++) {
+            for(int c=0; c<=r; c++) {
+                A(r,c) *= S[r]*S[c];
+                A(c,r) = A(r,c);
+            }
+        }
+
+        Eigen::LDLT<matrix_t> ldlt;
+        Eigen::JacobiSVD<matrix_t, Eigen::HouseholderQRPreconditioner> svd;
+        if(!singular) {
+            ldlt.compute(A);
+            vector_t D = ldlt.vectorD();
+            singular = ldlt.info()!=Eigen::Success || !(D.minCoeff()>ldlt_rcond*D.maxCoeff());
+        }
+        if(singular)
+            svd.compute(A, Eigen::ComputeFullU | Eigen::ComputeFullV);
+
+        for(int f=0; f<nfields; f++) {
+            vector_t b = vector_t::Zero();
+            for(index_t k=patch_head[i]; k<patch_head[i+1]; k++) {
+                index_t n = patch_nodes[k];
+                const real_t *xn = _mesh->get_coords(n);
+                double psin = psi[f][n];
+                assert(std::isfinite(psin));
+                if(dim==2) {
+                    double x=xn[0]-x0[0], y=xn[1]-x0[1];
+                    b[0]+=psin*y*y;
+                    b[1]+=psin*x*x;
+                    b[2]+=psin*x*y;
+                    b[3]+=psin*y;
+                    b[4]+=psin*x;
+                    b[5]+=psin;
+                } else {
+                    double x=xn[0]-x0[0], y=xn[1]-x0[1], z=xn[2]-x0[2];
+                    b[0]+=psin;
+                    b[1]+=psin*x;
+                    b[2]+=psin*y;
+                    b[3]+=psin*z;
+                    b[4]+=psin*x*x;
+                    b[5]+=psin*x*y;
+                    b[6]+=psin*x*z;
+                    b[7]+=psin*y*y;
+                    b[8]+=psin*y*z;
+                    b[9]+=psin*z*z;
+                }
+            }
+            b = b.cwiseProduct(S);
+
+            vector_t a = singular ? vector_t(svd.solve(b)) : vector_t(ldlt.solve(b));
+            a = a.cwiseProduct(S);
+
+            real_t *H = Hessian+f*(dim==2?3:6);
+            if(dim==2) {
+                H[0] = 2*a[1]; // d2/dx2
+                H[1] = a[2];   // d2/dxdy
+                H[2] = 2*a[0]; // d2/dy2
+            } else {
+                H[0] = a[4]*2.0; // d2/dx2
+                H[1] = a[5];     // d2/dxdy
+                H[2] = a[6];     // d2/dxdz
+                H[3] = a[7]*2.0; // d2/dy2
+                H[4] = a[8];     // d2/dydz
+                H[5] = a[9]*2.0; // d2/dz2
+            }
+        }
+    }
+
+    /// Least squares Hessian recovery of a single field.
+    void hessian_qls_kernel(const real_t *psi, int i, real_t *Hessian)
+    {
+        hessian_qls_kernel(&psi, 1, i, Hessian);
     }
 
 private:
+    /// Pivot ratio of the scaled normal equations below which the Hessian recovery falls back to an SVD.
+    static constexpr double ldlt_rcond = 1.0e-12;
+
     int rank, nprocs;
     int _NNodes, _NElements;
     MetricTensor<real_t,dim>* _metric;
+    std::vector<index_t> patch_head, patch_nodes;
     Mesh<real_t>* _mesh;
     double min_eigenvalue;
+    int nthreads;
 };
 
 #endif
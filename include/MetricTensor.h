@@ -38,6 +38,9 @@
 #ifndef METRICTENSOR_H
 #define METRICTENSOR_H
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
 #include <iostream>
 
 #include <Eigen/Core>
@@ -148,24 +151,14 @@ public:
     // Enforce positive definiteness
     static void positive_definiteness(treal_t* metric)
     {
-        Eigen::Matrix<treal_t, dim, dim> M;
-
-        if(dim==2) {
-            M << metric[0], metric[1],
-                 metric[1], metric[2];
-        } else if(dim==3) {
-            M << metric[0], metric[1], metric[2],
-                 metric[1], metric[3], metric[4],
-                 metric[2], metric[4], metric[5];
-        }
-
-        if(M.isZero())
+        if(is_zero(metric))
             return;
 
-        Eigen::SelfAdjointEigenSolver< Eigen::Matrix<treal_t, dim, dim> > solver(M);
+        Eigen::Matrix<treal_t, dim, 1> evalues;
+        Eigen::Matrix<treal_t, dim, dim> evectors;
+        symmetric_eigen(metric, evalues, evectors);
 
-        Eigen::Matrix<treal_t, dim, 1> evalues = solver.eigenvalues().real().cwiseAbs();
-        Eigen::Matrix<treal_t, dim, dim> evectors = solver.eigenvectors().real();
+        evalues = evalues.cwiseAbs();
         Eigen::Matrix<treal_t, dim, dim> Mp = evectors*evalues.asDiagonal()*evectors.transpose();
 
         if(dim==2) {
@@ -184,6 +177,96 @@ public:
         return;
     }
 
+    /*! Eigenvalues and eigenvectors of a symmetric tensor. The 2x2 case
+     * is diagonalised by a single Jacobi rotation and the 3x3 case by
+     * cyclic Jacobi sweeps, both in double precision. Off-diagonal terms
+     * are annihilated until they are negligible relative to the diagonal,
+     * so that small eigenvalues of strongly anisotropic tensors keep
+     * their relative accuracy. Eigen::SelfAdjointEigenSolver is only used
+     * if the sweeps fail to converge, e.g. for non-finite input.
+     *
+     * @param metric upper triangle of the tensor.
+     * @param evalues eigenvalues, in ascending order.
+     * @param evectors unit eigenvectors, stored as columns.
+     */
+    static void symmetric_eigen(const treal_t *metric, Eigen::Matrix<treal_t, dim, 1> &evalues,
+                                Eigen::Matrix<treal_t, dim, dim> &evectors)
+    {
+        double A[dim][dim], V[dim][dim];
+        if(dim==2) {
+            A[0][0] = metric[0]; A[0][1] = metric[1];
+            A[1][0] = metric[1]; A[1][1] = metric[2];
+        } else {
+            A[0][0] = metric[0]; A[0][1] = metric[1]; A[0][2] = metric[2];
+            A[1][0] = metric[1]; A[1][1] = metric[3]; A[1][2] = metric[4];
+            A[2][0] = metric[2]; A[2][1] = metric[4]; A[2][2] = metric[5];
+        }
+
+        for(int i=0; i<dim; i++)
+            for(int j=0; j<dim; j++)
+                V[i][j] = (i==j)?1.0:0.0;
+
+        bool converged = false;
+        for(int sweep=0; sweep<max_sweeps; sweep++) {
+            bool rotated = false;
+            for(int p=0; p<dim-1; p++) {
+                for(int q=p+1; q<dim; q++) {
+                    if(A[p][q]*A[p][q]<=DBL_EPSILON*DBL_EPSILON*fabs(A[p][p]*A[q][q]))
+                        continue;
+
+                    jacobi_rotate(A, V, p, q);
+                    rotated = true;
+                }
+            }
+
+            if(!rotated) {
+                converged = true;
+                break;
+            }
+        }
+
+        for(int i=0; i<dim; i++)
+            converged = converged && std::isfinite(A[i][i]);
+
+        if(!converged) {
+            Eigen::Matrix<treal_t, dim, dim> M;
+            for(int i=0; i<dim; i++)
+                for(int j=0; j<dim; j++)
+                    M(i,j) = metric[i<=j?index(i,j):index(j,i)];
+
+            Eigen::SelfAdjointEigenSolver< Eigen::Matrix<treal_t, dim, dim> > solver(M);
+            evalues = solver.eigenvalues().real();
+            evectors = solver.eigenvectors().real();
+            return;
+        }
+
+        // Order the eigenpairs by ascending eigenvalue.
+        int order[dim];
+        for(int i=0; i<dim; i++)
+            order[i] = i;
+        for(int i=1; i<dim; i++)
+            for(int j=i; j>0 && A[order[j]][order[j]]<A[order[j-1]][order[j-1]]; j--)
+                std::swap(order[j], order[j-1]);
+
+        for(int k=0; k<dim; k++) {
+            evalues[k] = A[order[k]][order[k]];
+            for(int i=0; i<dim; i++)
+                evectors(i,k) = V[i][order[k]];
+        }
+    }
+
+    /// As above, for a tensor which is already held as a full matrix.
+    static void symmetric_eigen(const Eigen::Matrix<treal_t, dim, dim> &M, Eigen::Matrix<treal_t, dim, 1> &evalues,
+                                Eigen::Matrix<treal_t, dim, dim> &evectors)
+    {
+        treal_t metric[dim==2?3:6];
+        for(int i=0; i<dim; i++)
+            for(int j=i; j<dim; j++)
+                metric[index(i,j)] = M(i,j);
+
+        symmetric_eigen(metric, evalues, evectors);
+    }
+
     /*! By default this calculates the superposition of two metrics where by default small
      * edge lengths are preserved. If the optional argument perserved_small_edges==false
      * then large edge lengths are perserved instead.
@@ -202,25 +285,11 @@ public:
         MetricTensor<treal_t,dim> metric(M_in);
 
         // Make the tensor with the smallest aspect ratio the reference space Mr.
-        const treal_t *Mr=_metric, *Mi=metric._metric;
-        Eigen::Matrix<treal_t, dim, dim> M1;
-        if(dim==2)
-            M1 << _metric[0], _metric[1],
-                  _metric[1], _metric[2];
-        else if(dim==3) {
-            M1(0,0) = _metric[0];
-            M1(0,1) = _metric[1];
-            M1(0,2) = _metric[2];
-            M1(1,0) = _metric[1];
-            M1(1,1) = _metric[3];
-            M1(1,2) = _metric[4];
-            M1(2,0) = _metric[2];
-            M1(2,1) = _metric[4];
-            M1(2,2) = _metric[5];
-        }
-
-        Eigen::SelfAdjointEigenSolver< Eigen::Matrix<treal_t, dim, dim> > solver1(M1);
-        Eigen::Matrix<treal_t, dim, 1> evalues1 = solver1.eigenvalues().real().cwiseAbs();
+        const treal_t *Mi=metric._metric;
+        Eigen::Matrix<treal_t, dim, 1> evalues1;
+        Eigen::Matrix<treal_t, dim, dim> evectors1;
+        symmetric_eigen(_metric, evalues1, evectors1);
+        evalues1 = evalues1.cwiseAbs();
 
         treal_t aspect_r;
         if(dim==2) {
@@ -237,28 +306,14 @@ public:
             aspect_r = std::min(std::min(evalues1[0], evalues1[1]), evalues1[2])/
                        std::max(std::max(evalues1[0], evalues1[1]), evalues1[2]);
 
-        Eigen::Matrix<treal_t, dim, dim> M2;
-        if(dim==2)
-            M2 << metric._metric[0], metric._metric[1],
-                  metric._metric[1], metric._metric[2];
-        else if(dim==3) {
-            M2(0,0) = metric._metric[0];
-            M2(0,1) = metric._metric[1];
-            M2(0,2) = metric._metric[2];
-            M2(1,0) = metric._metric[1];
-            M2(1,1) = metric._metric[3];
-            M2(1,2) = metric._metric[4];
-            M2(2,0) = metric._metric[2];
-            M2(2,1) = metric._metric[4];
-            M2(2,2) = metric._metric[5];
-        }
-
         // The input matrix could be zero if there is zero curvature in the local solution.
-        if(M2.isZero())
+        if(is_zero(metric._metric))
             return;
 
-        Eigen::SelfAdjointEigenSolver< Eigen::Matrix<treal_t, dim, dim> > solver2(M2);
-        Eigen::Matrix<treal_t, dim, 1> evalues2 = solver2.eigenvalues().real().cwiseAbs();
+        Eigen::Matrix<treal_t, dim, 1> evalues2;
+        Eigen::Matrix<treal_t, dim, dim> evectors2;
+        symmetric_eigen(metric._metric, evalues2, evectors2);
+        evalues2 = evalues2.cwiseAbs();
 
         treal_t aspect_i;
         if(dim==2)
@@ -268,25 +323,20 @@ public:
             aspect_i = std::min(std::min(evalues2[0], evalues2[1]), evalues2[2])/
                        std::max(std::max(evalues2[0], evalues2[1]), evalues2[2]);
 
+        // Map Mi to the reference space where Mr==I, reusing the
+        // decomposition of Mr from above. Mr = F^T*F with F = sqrt(D)*V^T,
+        // so that F^-1 = V*sqrt(D)^-1.
+        Eigen::Matrix<treal_t, dim, dim> F, Finv;
         if(aspect_i>aspect_r) {
             Mi=_metric;
-            Mr=metric._metric;
+            F = evalues2.cwiseSqrt().asDiagonal()*evectors2.transpose();
+            Finv = evectors2*evalues2.cwiseSqrt().cwiseInverse().asDiagonal();
+        } else {
+            F = evalues1.cwiseSqrt().asDiagonal()*evectors1.transpose();
+            Finv = evectors1*evalues1.cwiseSqrt().cwiseInverse().asDiagonal();
         }
 
-        // Map Mi to the reference space where Mr==I
-        if(dim==2)
-            M1 << Mr[0], Mr[1],
-                  Mr[1], Mr[2];
-        else if(dim==3)
-            M1 << Mr[0], Mr[1], Mr[2],
-                  Mr[1], Mr[3], Mr[4],
-                  Mr[2], Mr[4], Mr[5];
-
-        Eigen::SelfAdjointEigenSolver< Eigen::Matrix<treal_t, dim, dim> > solver(M1);
-        Eigen::Matrix<treal_t, dim, dim> F =
-            solver.eigenvalues().real().cwiseAbs().cwiseSqrt().asDiagonal()*
-            solver.eigenvectors().real();
-
+        Eigen::Matrix<treal_t, dim, dim> M2;
         if(dim==2)
             M2 << Mi[0], Mi[1],
                   Mi[1], Mi[2];
@@ -295,11 +345,12 @@ public:
                   Mi[1], Mi[3], Mi[4],
                   Mi[2], Mi[4], Mi[5];
 
-        Eigen::Matrix<treal_t, dim, dim> M = F.inverse().transpose()*M2*F.inverse();
+        Eigen::Matrix<treal_t, dim, dim> M = Finv.transpose()*M2*Finv;
 
-        Eigen::SelfAdjointEigenSolver< Eigen::Matrix<treal_t, dim, dim> > solver3(M);
-        Eigen::Matrix<treal_t, dim, 1> evalues = solver3.eigenvalues().real().cwiseAbs();
-        Eigen::Matrix<treal_t, dim, dim> evectors = solver3.eigenvectors().real();
+        Eigen::Matrix<treal_t, dim, 1> evalues;
+        Eigen::Matrix<treal_t, dim, dim> evectors;
+        symmetric_eigen(M, evalues, evectors);
+        evalues = evalues.cwiseAbs();
 
         if(perserved_small_edges)
             for(size_t i=0; i<dim; i++)
@@ -331,26 +382,10 @@ public:
      */
     void limit_aspect_ratio(treal_t max_ratio)
     {
-        Eigen::Matrix<treal_t, dim, dim> M1;
-        if(dim==2)
-            M1 << _metric[0], _metric[1],
-                  _metric[1], _metric[2];
-        else if(dim==3) {
-            M1(0,0) = _metric[0];
-            M1(0,1) = _metric[1];
-            M1(0,2) = _metric[2];
-            M1(1,0) = _metric[1];
-            M1(1,1) = _metric[3];
-            M1(1,2) = _metric[4];
-            M1(2,0) = _metric[2];
-            M1(2,1) = _metric[4];
-            M1(2,2) = _metric[5];
-        }
-
-        Eigen::SelfAdjointEigenSolver< Eigen::Matrix<treal_t, dim, dim> > solver1(M1);
-
-        Eigen::Matrix<treal_t, dim, 1> evalues = solver1.eigenvalues().real().cwiseAbs();
-        Eigen::Matrix<treal_t, dim, dim> evectors = solver1.eigenvectors().real();
+        Eigen::Matrix<treal_t, dim, 1> evalues;
+        Eigen::Matrix<treal_t, dim, dim> evectors;
+        symmetric_eigen(_metric, evalues, evectors);
+        evalues = evalues.cwiseAbs();
 
         if(dim==2) {
             if(evalues[0]<evalues[1]) {
@@ -453,34 +488,23 @@ public:
 
     void eigen_decomp(treal_t* eigenvalues, treal_t* eigenvectors) const
     {
-        Eigen::Matrix<treal_t, dim, dim> M;
-        if(dim==2)
-            M << _metric[0], _metric[1],
-                 _metric[1], _metric[2];
-        else if(dim==3)
-            M << _metric[0], _metric[1], _metric[2],
-                 _metric[1], _metric[3], _metric[4],
-                 _metric[2], _metric[4], _metric[5];
-
-        if(M.isZero()) {
+        if(is_zero(_metric)) {
             for(size_t i=0; i<dim; i++)
                 eigenvalues[i] = 0.0;
 
             for(size_t i=0; i<dim*dim; i++)
                 eigenvectors[i] = 0.0;
         } else {
-            Eigen::SelfAdjointEigenSolver< Eigen::Matrix<treal_t, dim, dim> > solver(M);
-
-            Eigen::Matrix<treal_t, dim, 1> evalues = solver.eigenvalues().real().cwiseAbs();
-            Eigen::Matrix<treal_t, dim, dim> evectors = solver.eigenvectors().real();
+            Eigen::Matrix<treal_t, dim, 1> evalues;
+            Eigen::Matrix<treal_t, dim, dim> evectors;
+            symmetric_eigen(_metric, evalues, evectors);
 
             for(size_t i=0; i<dim; i++)
-                eigenvalues[i] = evalues[i];
+                eigenvalues[i] = fabs(evalues[i]);
 
-            Eigen::Matrix<treal_t, dim, dim> Mp = evectors.transpose();
             for(size_t i=0; i<dim; i++)
               for(size_t j=0; j<dim; j++)
-                eigenvectors[i*dim+j] = Mp(i,j);
+                eigenvectors[i*dim+j] = evectors(j,i);
         }
     }
 
@@ -516,6 +540,54 @@ public:
     }
 
 private:
+    /// Upper bound on the Jacobi sweeps, which normally converge in fewer than ten.
+    static const int max_sweeps = 32;
+
+    /// Index of entry (i, j), i<=j, in the upper triangle storage.
+    static inline int index(int i, int j)
+    {
+        return i*dim - (i*(i-1))/2 + (j-i);
+    }
+
+    /// Same test as Eigen's isZero() on the full matrix.
+    static inline bool is_zero(const treal_t *metric)
+    {
+        for(int i=0; i<(dim==2?3:6); i++)
+            if(fabs(metric[i])>Eigen::NumTraits<treal_t>::dummy_precision())
+                return false;
+        return true;
+    }
+
+    /*! Applies the Jacobi rotation which annihilates A[p][q] to A, and
+     * accumulates it in the eigenvectors V.
+     */
+    static inline void jacobi_rotate(double A[dim][dim], double V[dim][dim], int p, int q)
+    {
+        // Tangent of the smaller rotation angle, t = tan(phi), where
+        // tan(2*phi) = 2*A[p][q]/(A[q][q]-A[p][p]).
+        double apq = A[p][q];
+        double d = A[q][q]-A[p][p];
+        double h = sqrt(d*d + 4.0*apq*apq);
+        double t = (d>=0.0?2.0:-2.0)*apq/(fabs(d)+h);
+        double c = sqrt(0.5*(1.0+fabs(d)/h));
+        double s = t*c;
+
+        A[p][p] -= t*apq;
+        A[q][q] += t*apq;
+        A[p][q] = A[q][p] = 0.0;
+        for(int r=0; r<dim; r++) {
+            if(r!=p && r!=q) {
+                double arp = A[r][p], arq = A[r][q];
+                A[r][p] = A[p][r] = c*arp - s*arq;
+                A[r][q] = A[q][r] = s*arp + c*arq;
+            }
+
+            double vrp = V[r][p], vrq = V[r][q];
+            V[r][p] = c*vrp - s*vrq;
+            V[r][q] = s*vrp + c*vrq;
+        }
+    }
+
     treal_t _metric[dim==2?3:(dim==3?6:-1)];
 };
 
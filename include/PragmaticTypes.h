@@ -38,8 +38,31 @@
 #ifndef PRAGMATICTYPES_H
 #define PRAGMATICTYPES_H
 
+#include <stdint.h>
+
+#include "pragmatic_config.h"
+#include "SmallSet.h"
+
+// Local (per partition) numbering of vertices and elements.
 typedef int index_t;
 
+// Global numbering across all MPI processes. Partitions stay well below
+// 2^31 vertices, but the sum over all partitions (in particular the gappy
+// numbering reserved during adaptivity) does not, so this can be widened
+// independently of index_t by configuring with PRAGMATIC_INDEX_64.
+#ifdef PRAGMATIC_INDEX_64
+typedef int64_t gnn_t;
+#else
+typedef int gnn_t;
+#endif
+
+// Sorted list of elements adjacent to a vertex, i.e. a row of NEList.
+typedef SmallSet<index_t, 8> element_set_t;
+
+// Sorted list of neighbouring vertices, e.g. the edges of a vertex that
+// are marked for another pass. Usually empty or nearly so.
+typedef SmallSet<index_t, 4> vertex_set_t;
+
 #ifdef HAVE_BOOST_UNORDERED_MAP_HPP
 #include <boost/unordered_map.hpp>
 typedef boost::unordered_map<index_t, std::set<index_t> > SNEList_t;
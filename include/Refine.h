@@ -39,6 +39,7 @@
 #define REFINE_H
 
 #include <algorithm>
+#include <iterator>
 #include <set>
 #include <vector>
 #include <queue>
@@ -86,7 +87,14 @@ public:
         MPI_Comm_size(comm, &nprocs);
         MPI_Comm_rank(comm, &rank);
         
-        def_ops = new DeferredOperations<real_t>(_mesh, 1, defOp_scaling_factor);
+        nthreads = pragmatic_nthreads();
+        def_ops = new DeferredOperations<real_t>(_mesh, nthreads, defOp_scaling_factor);
+
+        newElements.resize(nthreads);
+        newBoundaries.resize(nthreads);
+        newRegions.resize(nthreads);
+        newQualities.resize(nthreads);
+        threadIdx.resize(nthreads+1);
     }
 
     /// Default destructor.
@@ -111,9 +119,13 @@ public:
         size_t nbrSplits = 0;
         std::vector<int> state;
 
+        // New vertices and elements go into erased slots first.
+        _mesh->update_free_slots();
+
         nbrSplits = select_edges(L_max, state);
-        if (nbrSplits > 0)
+        if (nbrSplits > 0) {
             perform_refinement(nbrSplits, &state[0]);
+        }
 
         return nbrSplits;
     }
@@ -124,193 +136,185 @@ public:
         
         //-- I. Simulate the edge splits if edge length > sqrt(2)
         
-        //-- hash the edges + array of tags
-        //   edges are hashed by lnn1->lnn2 and we only store those where lnn1 < lnn2
+        //-- the edges are taken from the mesh's edge table, which stores edges
+        //   lnn1->lnn2 with lnn1 < lnn2 in CSR form and caches their lengths
         //   note that we could consider gnn1 < gnn2 for halo consistency, but not sure it's useful
-        
+        _mesh->update_edges(Mesh<real_t>::EDGE_LENGTH_LOG);
+
         int NNodes = _mesh->get_number_nodes();
-        std::vector<int> headV2E(NNodes+1);
-        headV2E[0] = 0;
-        for (int i=0; i<NNodes; ++i) {
-            headV2E[i+1] = headV2E[i];
-            for (int it=0; it<_mesh->NNList[i].size(); ++it) {
-                if (_mesh->NNList[i][it] > i) {
-                    headV2E[i+1]++;
-                }
-            }
-        }
-        int NEdges = headV2E[NNodes];  
+        const std::vector<index_t> &headV2E = _mesh->edge_head;
+        const std::vector<index_t> &ver2edg = _mesh->edge_nid; // this is the hashmap, corresponding to headV2E
+        int NEdges = headV2E[NNodes];
 
         //-- Loop over the edges
-        std::vector<int> ver2edg(NEdges); // this is the hashmap, corresponding to headV2E
-        std::vector<int> ver2edg_first(NEdges); // store 1st id of edges until I find better solution TODO
+        std::vector<int> ver2edg_first(NEdges); // first vertex of each edge
         std::vector<double> qualities(NEdges);
         std::vector<double> lengths(NEdges);
-        int cnt=0;
+        #pragma omp parallel for num_threads(nthreads) schedule(guided)
         for (int iVer=0; iVer<NNodes; ++iVer) {
-            for (int i=0; i<_mesh->NNList[iVer].size(); ++i) {
-                if (_mesh->NNList[iVer][i] > iVer) {
+            for (int cnt=headV2E[iVer]; cnt<headV2E[iVer+1]; ++cnt) {
+                int iVer2 = ver2edg[cnt];
+                ver2edg_first[cnt] = iVer;
+                double quality_old_cavity = compute_quality_cavity(iVer, iVer2);
 
-                    int iVer2 = _mesh->NNList[iVer][i];
-                    ver2edg[cnt] = iVer2;
-                    assert(cnt>=headV2E[iVer] && cnt<headV2E[iVer+1]);
-                    double quality_old_cavity = compute_quality_cavity(iVer, iVer2);
+                if (_mesh->is_halo_node(iVer) || _mesh->is_halo_node(iVer2)) {
+                    qualities[cnt] = -quality_old_cavity;
+                    continue;
+                }
 
-                    if (_mesh->is_halo_node(iVer) || _mesh->is_halo_node(iVer2)) {
+                double length = _mesh->edge_length_log[cnt];
+                lengths[cnt] = length;
+                if (length>L_max-1e-10) {
+                    //---- simulate edge split
+                    //---- compute and save quality of the resulting cavity
+                    double worst_new_quality, worst_new_volume;
+                    simulate_edge_split(iVer, iVer2, &worst_new_quality, &worst_new_volume);
+
+                    //---- if quality is too bad, reject refinement
+                    if (worst_new_quality < quality_old_cavity && worst_new_quality < 0.001) {// TODO set this threshold + check for slivers&co + change criteria
                         qualities[cnt] = -quality_old_cavity;
-                        cnt++;
-                        continue;
                     }
-
-                    double length = _mesh->calc_edge_length_log(iVer, iVer2);
-                    lengths[cnt] = length;
-                    if (length>L_max-1e-10) {
-                        //---- simulate edge split
-                        //---- compute and save quality of the resulting cavity
-                        double worst_new_quality, worst_new_volume;
-                        simulate_edge_split(iVer, iVer2, &worst_new_quality, &worst_new_volume);
-
-                        //---- if quality is too bad, reject refinement
-                        if (worst_new_quality < quality_old_cavity && worst_new_quality < 0.001) {// TODO set this threshold + check for slivers&co + change criteria
-                            qualities[cnt] = -quality_old_cavity;
-                        }
-                        if (worst_new_quality < 0.1*quality_old_cavity) {
-                            qualities[cnt] = -quality_old_cavity;
-                        }
-                        else {
-                            qualities[cnt] = worst_new_quality;
-                        }
+                    if (worst_new_quality < 0.1*quality_old_cavity) {
+                        qualities[cnt] = -quality_old_cavity;
                     }
                     else {
-                        qualities[cnt] = -quality_old_cavity;
+                        qualities[cnt] = worst_new_quality;
                     }
-                    assert(cnt<NEdges);
-                    cnt++;
+                }
+                else {
+                    qualities[cnt] = -quality_old_cavity;
                 }
             }
-            
         }
         
         //-- II. Select edges to split with local optim procedure
         
         //-- initialize state vector with UNKNOWN
-        //    -1 is UNKNOWN, 0 is NOT_IN, 1 is IN
+        //    -1 is UNKNOWN, 0 is NOT_IN, >0 is IN
+        //-- and build the graph of neighboring cavities (edges on neighboring elements)
+        //   restricted to the edges which are candidates for splitting.
         state.resize(NEdges);
-        std::fill(state.begin(), state.end(), -1);
-        for (int iEdg=0; iEdg<NEdges; ++iEdg) {
-            if (qualities[iEdg]<0) {
-                state[iEdg] = 0;
-            }
-        }
-        
-        //-- repeat following procedure until the state of all edges is not UNKNOWN
-        
-        //---- Loop over the edges v
-        int cntSplit = 0;
-        int stop = 0;
-        
-        while ( !stop ) {
-            stop = 1;
-            int e1, e2; // end vertices of current edge
-            e1 = 0;
+        std::vector<int> headE2E(NEdges+1);
+        std::vector< std::vector<int> > thread_edg2edg(nthreads);
+        std::vector<int> edg2edg;
+        headE2E[0] = 0;
+        #pragma omp parallel num_threads(nthreads)
+        {
+            const int tid = pragmatic_thread_id();
+            std::vector<int> edges_neighbor;
+
+            // Static scheduling: thread tid processes a contiguous range of edges, in thread order.
+            #pragma omp for schedule(static)
             for (int iEdg=0; iEdg<NEdges; ++iEdg) {
-                if (iEdg >= headV2E[e1+1]){
-                    while (iEdg >= headV2E[e1+1])
-                       e1++;
-                }
-                e2 = ver2edg[iEdg];
-
-                if (state[iEdg]>-1) {
-                    continue;
-                }
+                headE2E[iEdg+1] = 0;
                 if (qualities[iEdg] < 0) {
                     state[iEdg] = 0;
-                    stop = 0;
                     continue;
                 }
-                
-                // find neighboring cavities: edges on neighboring elements
-                std::set<int> edges_neighbor;
-                std::set<index_t> intersection; 
-                std::set_intersection(_mesh->NEList[e1].begin(), _mesh->NEList[e1].end(),
-                                      _mesh->NEList[e2].begin(), _mesh->NEList[e2].end(),
-                                      std::inserter(intersection, intersection.begin()));
-                typename std::set<index_t>::const_iterator elm_it;
+
+                cavity_edges(iEdg, ver2edg_first[iEdg], ver2edg[iEdg], headV2E, ver2edg, edges_neighbor);
+
                 double max_length_cavity = 0;
-                for(elm_it=intersection.begin(); elm_it!=intersection.end(); ++elm_it) {
-                    int iElm = *elm_it;
-                    for (int i=0; i<(dim==2?3:4); ++i) {
-                        for (int j=i+1; j<(dim==2?3:4); ++j) {
-                            int iVer1 = _mesh->_ENList[nloc*iElm+i];
-                            int iVer2 = _mesh->_ENList[nloc*iElm+j];
-                            if (iVer1 >= iVer2 ) {
-                                int tmp = iVer1;
-                                iVer1 = iVer2;
-                                iVer2 = tmp;
-                            }
-                            assert((iVer1+1)<headV2E.size());
-                            for (int k=headV2E[iVer1]; k<headV2E[iVer1+1]; ++k){
-                                if (ver2edg[k] == iVer2 && k!=iEdg) {
-                                    edges_neighbor.insert(k);
-                                    max_length_cavity = fmax(max_length_cavity, lengths[k]);
-                                }
-                            }
-                        }
-                    }
+                for (const auto &iEdgNgb : edges_neighbor) {
+                    max_length_cavity = fmax(max_length_cavity, lengths[iEdgNgb]);
                 }
                 // This value of 0.9 is what seems to make it work, but it reduces the interest of the algo...
                 // drawback is: if there is a long edge I can't split, I am stuck with its neighbours too
                 if (lengths[iEdg] < 0.9*max_length_cavity) {
                     state[iEdg] = 0;
-                    stop = 0;
                     continue;
                 }                
-                
-                //------ Loop over the neighboring cavities u
-                typename std::set<int>::const_iterator edge_it;
-                int cont = 0;
-                for(edge_it=edges_neighbor.begin(); edge_it!=edges_neighbor.end(); ++edge_it) {
-                    int iEdgNgb = *edge_it;
-
-                    if (state[iEdgNgb] == 1) {
-                        cont = 1;
-                        break;
+
+                state[iEdg] = -1;
+                for (const auto &iEdgNgb : edges_neighbor) {
+                    if (qualities[iEdgNgb] >= 0) {
+                        thread_edg2edg[tid].push_back(iEdgNgb);
+                        headE2E[iEdg+1]++;
                     }
                 }
-                if (cont==1) {
-                    state[iEdg] = 0;
-                    stop = 0;
-                    continue;
-                }
-                
-                //------ Loop over the neighboring cavities u
-                cont = 0;
-                for(edge_it=edges_neighbor.begin(); edge_it!=edges_neighbor.end(); ++edge_it) {
-                    int iEdgNgb = *edge_it;
-                
-                    if (state[iEdgNgb] == 0) {
+            }
+        }
+        for (int iEdg=0; iEdg<NEdges; ++iEdg) {
+            headE2E[iEdg+1] += headE2E[iEdg];
+        }
+        edg2edg.reserve(headE2E[NEdges]);
+        for (int t=0; t<nthreads; ++t) {
+            edg2edg.insert(edg2edg.end(), thread_edg2edg[t].begin(), thread_edg2edg[t].end());
+            std::vector<int>().swap(thread_edg2edg[t]);
+        }
+        assert(edg2edg.size()==headE2E[NEdges]);
+
+        //-- repeat following procedure until the state of all edges is not UNKNOWN:
+        //   an edge is IN if it has the best quality of all its UNKNOWN neighbors
+        //   (ties are broken by the highest edge index), and NOT_IN if one of its
+        //   neighbors is IN. Decisions are based on the state at the start of
+        //   each sweep, so the selection does not depend on the number of threads.
+        int cntSplit = 0;
+        int unknown = 1;
+        std::vector<char> decision(NEdges, 0);
+        
+        while ( unknown ) {
+            unknown = 0;
+
+            #pragma omp parallel num_threads(nthreads)
+            {
+                #pragma omp for schedule(guided)
+                for (int iEdg=0; iEdg<NEdges; ++iEdg) {
+                    decision[iEdg] = 0;
+                    if (state[iEdg] != -1) {
                         continue;
                     }
 
-                    if (qualities[iEdg]<qualities[iEdgNgb]) {
-                        cont = 1;
-                        break;
+                    //------ Loop over the neighboring cavities u
+                    int cont = 0;
+                    for (int k=headE2E[iEdg]; k<headE2E[iEdg+1]; ++k) {
+                        int iEdgNgb = edg2edg[k];
+
+                        if (state[iEdgNgb] > 0) {
+                            cont = 1;
+                            break;
+                        }
+                    }
+                    if (cont==1) {
+                        decision[iEdg] = 1;
+                        continue;
                     }
 
-                    // again we could consider gnn1 < gnn2 for halo consistency, but not sure it's useful
-                    if (qualities[iEdg]==qualities[iEdgNgb] && iEdgNgb>iEdg) {
-                        cont = 1;
-                        break;
+                    //------ Loop over the neighboring cavities u
+                    for (int k=headE2E[iEdg]; k<headE2E[iEdg+1]; ++k) {
+                        int iEdgNgb = edg2edg[k];
+
+                        if (state[iEdgNgb] == 0) {
+                            continue;
+                        }
+
+                        if (qualities[iEdg]<qualities[iEdgNgb]) {
+                            cont = 1;
+                            break;
+                        }
+
+                        // again we could consider gnn1 < gnn2 for halo consistency, but not sure it's useful
+                        if (qualities[iEdg]==qualities[iEdgNgb] && iEdgNgb>iEdg) {
+                            cont = 1;
+                            break;
+                        }
+                    }
+                    if (cont==0) {
+                        decision[iEdg] = 2;
                     }
-                }
-                if (cont==1) {
-                    continue;
                 }
 
-                assert(state[iEdg] != 0);
-                state[iEdg] = iEdg+1;
-                cntSplit++;
-                stop = 0;
+                #pragma omp for schedule(static) reduction(+:cntSplit,unknown)
+                for (int iEdg=0; iEdg<NEdges; ++iEdg) {
+                    if (decision[iEdg] == 1) {
+                        state[iEdg] = 0;
+                    } else if (decision[iEdg] == 2) {
+                        state[iEdg] = iEdg+1;
+                        cntSplit++;
+                    } else if (state[iEdg] == -1) {
+                        unknown++;
+                    }
+                }
             }
         }
         printf("DEBUG   Number of splits / total number of edges: %d / %d\n", cntSplit, NEdges);
@@ -325,16 +329,16 @@ public:
     void simulate_edge_split(int e1, int e2, double * worst_quality, double * worst_volume) {
         
         double quality = 1, volume = 1e10; // L1, Linf, volume
-        double newCoords[3], newMetric[6];
+        real_t newCoords[3], newMetric[6];
 
         // Calculate the position of the new point. From equation 16 in
         // Li et al, Comp Methods Appl Mech Engrg 194 (2005) 4915-4950.
         real_t x, m;
         const real_t *x0 = _mesh->get_coords(e1);
-        const double *m0 = _mesh->get_metric(e1);
+        const real_t *m0 = _mesh->get_metric(e1);
 
         const real_t *x1 = _mesh->get_coords(e2);
-        const double *m1 = _mesh->get_metric(e2);
+        const real_t *m1 = _mesh->get_metric(e2);
 
         real_t weight = 1.0/(1.0 + sqrt(property->template length<dim>(x0, x1, m0)/
                                         property->template length<dim>(x0, x1, m1)));
@@ -359,18 +363,18 @@ public:
         }
         
         // find the neighboring triangles
-        std::set<index_t> intersection;
+        std::vector<index_t> intersection;
         std::set_intersection(_mesh->NEList[e1].begin(), _mesh->NEList[e1].end(),
                               _mesh->NEList[e2].begin(), _mesh->NEList[e2].end(),
-                              std::inserter(intersection, intersection.begin()));
+                              std::back_inserter(intersection));
         
         if (dim==2) {
             
             // loop over these triangles and split them to compute quality
-            typename std::set<index_t>::const_iterator tri_it;
+            typename std::vector<index_t>::const_iterator tri_it;
             for(tri_it=intersection.begin(); tri_it!=intersection.end(); ++tri_it) {
                 const int * v = _mesh->get_element(*tri_it);
-                const double * x2, * m2;
+                const real_t *x2, *m2;
                 for (int i=0; i<3; ++i) {
                     if (v[i] != e1 && v[i] != e2)  {
                         x2 = _mesh->get_coords(v[i]);
@@ -390,10 +394,10 @@ public:
         }
         else {
             // loop over these tets and split them to compute quality
-            typename std::set<index_t>::const_iterator tet_it;
+            typename std::vector<index_t>::const_iterator tet_it;
             for(tet_it=intersection.begin(); tet_it!=intersection.end(); ++tet_it) {
                 const int * v = _mesh->get_element(*tet_it);
-                const double * x2, * m2, * x3, * m3;
+                const real_t *x2, *m2, *x3, *m3;
                 int i;
                 for (i=0; i<4; ++i) {
                     if (v[i] != e1 && v[i] != e2)  {
@@ -428,16 +432,16 @@ public:
         
         double quality = 1;
         // find the neighboring elements
-        std::set<index_t> intersection;
+        std::vector<index_t> intersection;
         std::set_intersection(_mesh->NEList[e1].begin(), _mesh->NEList[e1].end(),
                               _mesh->NEList[e2].begin(), _mesh->NEList[e2].end(),
-                              std::inserter(intersection, intersection.begin()));
+                              std::back_inserter(intersection));
         
         // loop over theese traingles and split them to compute quality
-        typename std::set<index_t>::const_iterator elm_it;
+        typename std::vector<index_t>::const_iterator elm_it;
         for(elm_it=intersection.begin(); elm_it!=intersection.end(); ++elm_it) {
             int iElm = *elm_it;
-            const double *x0, *x1, *x2, *x3, *m0, *m1, *m2, *m3;
+            const real_t *x0, *x1, *x2, *x3, *m0, *m1, *m2, *m3;
             const int * elm = _mesh->get_element(iElm);
             x0 = _mesh->get_coords(elm[0]);
             m0 = _mesh->get_metric(elm[0]);
@@ -472,130 +476,187 @@ public:
         origNElements = _mesh->get_number_elements();
         size_t origNNodes = _mesh->get_number_nodes();
 
-        splitCnt = 0;
-
         newVertices.resize(edgeSplitCnt);
-        size_t newNNodes = _mesh->NNodes+edgeSplitCnt;
-        if(_mesh->_coords.size()<newNNodes*dim) {
-            _mesh->_coords.resize(newNNodes*dim);
-            _mesh->metric.resize(newNNodes*msize);
-            _mesh->NNList.resize(newNNodes);
-            _mesh->NEList.resize(newNNodes);
-            _mesh->node_owner.resize(newNNodes);
-            _mesh->lnn2gnn.resize(newNNodes);
+
+        // The first new vertices take the slots of erased vertices.
+        size_t reuseCnt = std::min(edgeSplitCnt, _mesh->free_vertices.size());
+        const index_t *reuseSlots = _mesh->free_vertices.data()+_mesh->free_vertices.size()-reuseCnt;
+
+        size_t newNNodes = _mesh->NNodes+edgeSplitCnt-reuseCnt;
+        _mesh->resize_vertices(newNNodes);
+
+        /*
+         * Number the new vertices in the same order as the edges, i.e. by
+         * their first vertex: count the edges (i<j) and the splits of each
+         * vertex and prefix-sum the counts.
+         */
+        std::vector<size_t> edgeOffset(origNNodes+1), splitOffset(origNNodes+1);
+        edgeOffset[0] = 0;
+        splitOffset[0] = 0;
+        #pragma omp parallel for num_threads(nthreads) schedule(static)
+        for(size_t i=0; i<origNNodes; ++i) {
+            size_t cnt = 0;
+            for(size_t it=0; it<_mesh->NNList[i].size(); ++it) {
+                if (i < _mesh->NNList[i][it])
+                    cnt++;
+            }
+            edgeOffset[i+1] = cnt;
         }
+        for(size_t i=0; i<origNNodes; ++i)
+            edgeOffset[i+1] += edgeOffset[i];
 
-        int cnt = 0;
+        #pragma omp parallel for num_threads(nthreads) schedule(static)
         for(size_t i=0; i<origNNodes; ++i) {
+            size_t cnt = 0;
+            for(size_t k=edgeOffset[i]; k<edgeOffset[i+1]; ++k) {
+                if (state[k] > 0)
+                    cnt++;
+            }
+            splitOffset[i+1] = cnt;
+        }
+        for(size_t i=0; i<origNNodes; ++i)
+            splitOffset[i+1] += splitOffset[i];
+        assert(splitOffset[origNNodes]==edgeSplitCnt);
+
+        #pragma omp parallel for num_threads(nthreads) schedule(guided)
+        for(size_t i=0; i<origNNodes; ++i) {
+            size_t cnt = edgeOffset[i];
+            size_t splitId = splitOffset[i];
             for(size_t it=0; it<_mesh->NNList[i].size(); ++it) {
                 index_t otherVertex = _mesh->NNList[i][it];
                 if (i < otherVertex) {
                     if (state[cnt] > 0) {
-                        refine_edge(i, otherVertex);
-                        splitCnt++;
+                        index_t vid = splitId<reuseCnt ? reuseSlots[splitId] : origNNodes+splitId-reuseCnt;
+                        // The slot may still have rows in the edge table.
+                        _mesh->invalidate_edges(vid);
+                        refine_edge(i, otherVertex, vid, splitId);
+                        splitId++;
                     }
                     cnt++;
                 }
             }
         }
 
-        _mesh->NNodes += splitCnt;
-        assert(splitCnt==edgeSplitCnt);
-
-        // Fix IDs of new vertices
-        assert(newVertices.size()==splitCnt);
-        for(size_t i=0; i<splitCnt; i++) {
-            newVertices[i].id = origNNodes+i;
-        }
+        _mesh->NNodes = newNNodes;
+        _mesh->free_vertices.resize(_mesh->free_vertices.size()-reuseCnt);
 
         /*
          *   Element refinement: add new connectivity + elements
          *   The number of elements affected by the splits cannot be guessed a priori
-         *   so we choose to add them to a temporary buffer.
-         *   Another option would be to count them first to avoid moving memory...
+         *   so each thread adds them to its own temporary buffer. Once all threads
+         *   are done, the final IDs of the new elements are given by a prefix sum
+         *   over the buffer sizes and adjacency updates are committed.
          */
 
-        splitCnt = 0;
-        newElements.clear();
-        newBoundaries.clear();
-        newRegions.clear();
-        newQualities.clear();
-        newElements.reserve(dim*dim*origNElements);
-        newBoundaries.reserve(dim*dim*origNElements);
-        newRegions.reserve(origNElements);
-        newQualities.reserve(origNElements);
-
-        for(size_t i=0; i<edgeSplitCnt; ++i) {
-            index_t vid = newVertices[i].id;
-            index_t firstid = newVertices[i].edge.first;
-            index_t secondid = newVertices[i].edge.second;
-
-            /*
-             * Update NNList for newly created vertices. This has to be done here, it cannot be
-             * done during element refinement, because a split edge is shared between two elements
-             * and we run the risk that these updates will happen twice, once for each element.
-             */
-            addNN(vid,firstid);
-            addNN(vid,secondid);
+        for(int t=0; t<nthreads; ++t) {
+            newElements[t].clear();
+            newBoundaries[t].clear();
+            newRegions[t].clear();
+            newQualities[t].clear();
+        }
 
-            remNN(firstid, secondid);
-            addNN(firstid, vid);
-            remNN(secondid, firstid);
-            addNN(secondid, vid);
+        #pragma omp parallel num_threads(nthreads)
+        {
+            const int tid = pragmatic_thread_id();
+
+            newElements[tid].reserve(dim*dim*origNElements/nthreads);
+            newBoundaries[tid].reserve(dim*dim*origNElements/nthreads);
+            newRegions[tid].reserve(origNElements/nthreads);
+            newQualities[tid].reserve(origNElements/nthreads);
+
+            std::vector<index_t> elm_around_split_edge;
+
+            /* Static scheduling: the new elements of thread tid follow those of
+               thread tid-1, so the element numbering does not depend on the
+               number of threads. */
+            #pragma omp for schedule(static)
+            for(size_t i=0; i<edgeSplitCnt; ++i) {
+                index_t vid = newVertices[i].id;
+                index_t firstid = newVertices[i].edge.first;
+                index_t secondid = newVertices[i].edge.second;
+
+                /*
+                 * Update NNList for newly created vertices. This has to be done here, it cannot be
+                 * done during element refinement, because a split edge is shared between two elements
+                 * and we run the risk that these updates will happen twice, once for each element.
+                 */
+                def_ops->addNN(vid, firstid, tid);
+                def_ops->addNN(vid, secondid, tid);
+
+                def_ops->remNN(firstid, secondid, tid);
+                def_ops->addNN(firstid, vid, tid);
+                def_ops->remNN(secondid, firstid, tid);
+                def_ops->addNN(secondid, vid, tid);
+
+                /*
+                 * Actual element refinement
+                 */
+
+                // Find which elements share this edge and split them
+                elm_around_split_edge.clear();
+                std::set_intersection(_mesh->NEList[firstid].begin(), _mesh->NEList[firstid].end(),
+                                      _mesh->NEList[secondid].begin(), _mesh->NEList[secondid].end(),
+                                      std::back_inserter(elm_around_split_edge));
+                for(const auto &eid : elm_around_split_edge) {
+                    refine_element(eid, i, tid);
+                }
 
-            /*
-             * Actual element refinement
-             */
+                /*
+                 *  Fix new vertex ownership
+                 */
 
-            // Find which elements share this edge and split them
-            std::set<index_t> elm_around_split_edge;
-            std::set_intersection(_mesh->NEList[firstid].begin(), _mesh->NEList[firstid].end(),
-                                  _mesh->NEList[secondid].begin(), _mesh->NEList[secondid].end(),
-                                  std::inserter(elm_around_split_edge, elm_around_split_edge.begin()));
-            typename std::set<index_t>::const_iterator element;
-            for(element=elm_around_split_edge.begin(); element!=elm_around_split_edge.end(); ++element) {
-                index_t eid = *element;
-                refine_element(eid, i);
+                if(nprocs==1) {
+                    _mesh->node_owner[vid] = 0;
+                    _mesh->lnn2gnn[vid] = vid;
+                } else {
+                    int owner0 = _mesh->node_owner[firstid];
+                    int owner1 = _mesh->node_owner[secondid];
+                    assert(owner0 == owner1);
+                    int owner = std::min(owner0, owner1);
+                    _mesh->node_owner[vid] = owner;
+
+                    if(_mesh->node_owner[vid] == rank)
+                        _mesh->lnn2gnn[vid] = _mesh->gnn_offset+vid;
+                }
             }
 
-            /*
-             *  Fix new vertex ownership
-             */
+            #pragma omp single
+            {
+                threadIdx[0] = 0;
+                for(int t=0; t<nthreads; ++t)
+                    threadIdx[t+1] = threadIdx[t] + newRegions[t].size();
+
+                // Slots of the new elements: erased elements first, then the end of the arrays.
+                size_t newCnt = threadIdx[nthreads];
+                size_t reuseCnt = std::min(newCnt, _mesh->free_elements.size());
+                const index_t *reuseSlots = _mesh->free_elements.data()+_mesh->free_elements.size()-reuseCnt;
+                elementSlots.resize(newCnt);
+                for(size_t i=0; i<newCnt; ++i)
+                    elementSlots[i] = i<reuseCnt ? reuseSlots[i] : origNElements+i-reuseCnt;
+                _mesh->free_elements.resize(_mesh->free_elements.size()-reuseCnt);
+
+                _mesh->NElements = origNElements+newCnt-reuseCnt;
+
+                _mesh->resize_elements(_mesh->NElements);
+            }
 
-            if(nprocs==1) {
-                _mesh->node_owner[vid] = 0;
-                _mesh->lnn2gnn[vid] = vid;
-            } else {
-                int owner0 = _mesh->node_owner[firstid];
-                int owner1 = _mesh->node_owner[secondid];
-                assert(owner0 == owner1);
-                int owner = std::min(owner0, owner1);
-                _mesh->node_owner[vid] = owner;
-
-                if(_mesh->node_owner[vid] == rank)
-                    _mesh->lnn2gnn[vid] = _mesh->gnn_offset+vid;
+            // Store new elements in their slots and commit deferred operations
+            size_t splitCnt = newRegions[tid].size();
+            for(size_t i=0; i<splitCnt; ++i) {
+                index_t eid = elementSlots[threadIdx[tid]+i];
+                memcpy(&_mesh->_ENList[nloc*eid], &newElements[tid][nloc*i], nloc*sizeof(index_t));
+                memcpy(&_mesh->boundary[nloc*eid], &newBoundaries[tid][nloc*i], nloc*sizeof(int));
+                _mesh->regions[eid] = newRegions[tid][i];
+                _mesh->quality[eid] = newQualities[tid][i];
             }
-        }
 
-        _mesh->NElements += splitCnt;
-        
-        if(_mesh->_ENList.size()<_mesh->NElements*nloc) {
-            _mesh->_ENList.resize(_mesh->NElements*nloc);
-            _mesh->boundary.resize(_mesh->NElements*nloc);
-            _mesh->regions.resize(_mesh->NElements);
-            _mesh->quality.resize(_mesh->NElements);
+            def_ops->commit(threadIdx.data(), elementSlots.data());
         }
 
-        // Append new elements to the mesh and commit deferred operations
-        memcpy(&_mesh->_ENList[nloc*origNElements], &newElements[0], nloc*splitCnt*sizeof(index_t));
-        memcpy(&_mesh->boundary[nloc*origNElements], &newBoundaries[0], nloc*splitCnt*sizeof(int));
-        memcpy(&_mesh->regions[origNElements], &newRegions[0], splitCnt*sizeof(int));
-        memcpy(&_mesh->quality[origNElements], &newQualities[0], splitCnt*sizeof(double));
-
         // Update halo.
         if(nprocs>1) {
             
-            std::vector< std::set< DirectedEdge<index_t> > > recv_additional(nprocs), send_additional(nprocs);
+            std::vector< std::set< DirectedEdge<gnn_t> > > recv_additional(nprocs), send_additional(nprocs);
 
             for(size_t i=0; i<edgeSplitCnt; ++i)
             {
@@ -609,7 +670,7 @@ public:
                     for(typename std::vector<index_t>::const_iterator neigh=_mesh->NNList[vert->id].begin(); neigh!=_mesh->NNList[vert->id].end(); ++neigh) {
                         if(_mesh->is_owned_node(*neigh)) {
                             visible = true;
-                            DirectedEdge<index_t> gnn_edge(_mesh->lnn2gnn[vert->edge.first], _mesh->lnn2gnn[vert->edge.second], vert->id);
+                            DirectedEdge<gnn_t> gnn_edge(_mesh->lnn2gnn[vert->edge.first], _mesh->lnn2gnn[vert->edge.second], vert->id);
                             recv_additional[_mesh->node_owner[vert->id]].insert(gnn_edge);
                             break;
                         }
@@ -626,7 +687,7 @@ public:
                         processes.erase(rank);
 
                         for(typename std::set<int>::const_iterator proc=processes.begin(); proc!=processes.end(); ++proc) {
-                            DirectedEdge<index_t> gnn_edge(_mesh->lnn2gnn[vert->edge.first], _mesh->lnn2gnn[vert->edge.second], vert->id);
+                            DirectedEdge<gnn_t> gnn_edge(_mesh->lnn2gnn[vert->edge.first], _mesh->lnn2gnn[vert->edge.second], vert->id);
                             send_additional[*proc].insert(gnn_edge);
                         }
                     }
@@ -640,13 +701,13 @@ public:
             for(int i=0; i<nprocs; ++i)
             {
                 recv_cnt[i] = recv_additional[i].size();
-                for(typename std::set< DirectedEdge<index_t> >::const_iterator it=recv_additional[i].begin(); it!=recv_additional[i].end(); ++it) {
+                for(typename std::set< DirectedEdge<gnn_t> >::const_iterator it=recv_additional[i].begin(); it!=recv_additional[i].end(); ++it) {
                     _mesh->recv[i].push_back(it->id);
                     _mesh->recv_halo.insert(it->id);
                 }
 
                 send_cnt[i] = send_additional[i].size();
-                for(typename std::set< DirectedEdge<index_t> >::const_iterator it=send_additional[i].begin(); it!=send_additional[i].end(); ++it) {
+                for(typename std::set< DirectedEdge<gnn_t> >::const_iterator it=send_additional[i].begin(); it!=send_additional[i].end(); ++it) {
                     _mesh->send[i].push_back(it->id);
                     _mesh->send_halo.insert(it->id);
                 }
@@ -658,10 +719,10 @@ public:
             // Now that the global numbering has been updated, update send_map and recv_map.
             for(int i=0; i<nprocs; ++i)
             {
-                for(typename std::set< DirectedEdge<index_t> >::const_iterator it=recv_additional[i].begin(); it!=recv_additional[i].end(); ++it)
+                for(typename std::set< DirectedEdge<gnn_t> >::const_iterator it=recv_additional[i].begin(); it!=recv_additional[i].end(); ++it)
                     _mesh->recv_map[i][_mesh->lnn2gnn[it->id]] = it->id;
 
-                for(typename std::set< DirectedEdge<index_t> >::const_iterator it=send_additional[i].begin(); it!=send_additional[i].end(); ++it)
+                for(typename std::set< DirectedEdge<gnn_t> >::const_iterator it=send_additional[i].begin(); it!=send_additional[i].end(); ++it)
                     _mesh->send_map[i][_mesh->lnn2gnn[it->id]] = it->id;
             }
 
@@ -700,7 +761,42 @@ public:
 
 private:
 
-    inline void refine_edge(index_t n0, index_t n1)
+    /*! Find the edges of the elements sharing edge iEdg=(e1, e2), excluding iEdg itself.
+     */
+    inline void cavity_edges(int iEdg, int e1, int e2, const std::vector<index_t> &headV2E, const std::vector<index_t> &ver2edg,
+                             std::vector<int> &edges_neighbor) const
+    {
+        edges_neighbor.clear();
+
+        std::vector<index_t> intersection;
+        std::set_intersection(_mesh->NEList[e1].begin(), _mesh->NEList[e1].end(),
+                              _mesh->NEList[e2].begin(), _mesh->NEList[e2].end(),
+                              std::back_inserter(intersection));
+        for (const auto &iElm : intersection) {
+            for (int i=0; i<nloc; ++i) {
+                for (int j=i+1; j<nloc; ++j) {
+                    int iVer1 = _mesh->_ENList[nloc*iElm+i];
+                    int iVer2 = _mesh->_ENList[nloc*iElm+j];
+                    if (iVer1 >= iVer2 ) {
+                        int tmp = iVer1;
+                        iVer1 = iVer2;
+                        iVer2 = tmp;
+                    }
+                    assert((iVer1+1)<headV2E.size());
+                    for (int k=headV2E[iVer1]; k<headV2E[iVer1+1]; ++k) {
+                        if (ver2edg[k] == iVer2 && k!=iEdg) {
+                            edges_neighbor.push_back(k);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        std::sort(edges_neighbor.begin(), edges_neighbor.end());
+        edges_neighbor.erase(std::unique(edges_neighbor.begin(), edges_neighbor.end()), edges_neighbor.end());
+    }
+
+    inline void refine_edge(index_t n0, index_t n1, index_t vid, size_t splitId)
     {
         if(_mesh->lnn2gnn[n0] > _mesh->lnn2gnn[n1]) {
             // Needs to be swapped because we want the lesser gnn first.
@@ -708,16 +804,16 @@ private:
             n0=n1;
             n1=tmp_n0;
         }
-        newVertices[splitCnt] = DirectedEdge<index_t>(n0, n1);
+        newVertices[splitId] = DirectedEdge<index_t>(n0, n1, vid);
 
         // Calculate the position of the new point. From equation 16 in
         // Li et al, Comp Methods Appl Mech Engrg 194 (2005) 4915-4950.
         real_t x, m;
         const real_t *x0 = _mesh->get_coords(n0);
-        const double *m0 = _mesh->get_metric(n0);
+        const real_t *m0 = _mesh->get_metric(n0);
 
         const real_t *x1 = _mesh->get_coords(n1);
-        const double *m1 = _mesh->get_metric(n1);
+        const real_t *m1 = _mesh->get_metric(n1);
 
         real_t weight = 1.0/(1.0 + sqrt(property->template length<dim>(x0, x1, m0)/
                                         property->template length<dim>(x0, x1, m1)));
@@ -725,12 +821,12 @@ private:
         // Calculate position of new vertex and append it to OMP thread's temp storage
         for(size_t i=0; i<dim; i++) {
             x = x0[i]+weight*(x1[i] - x0[i]);
-            _mesh->_coords[(_mesh->NNodes+splitCnt)*dim+i] = x;
+            _mesh->_coords[vid*dim+i] = x;
         }
 
 #if 0
         // TODO HACK CAD
-        double newCrd[3];
+        real_t newCrd[3];
         for(size_t i=0; i<dim; i++)
             newCrd[i] = x0[i]+weight*(x1[i] - x0[i]);
         if (_mesh->get_isOnBoundary(n0) == 1 && _mesh->get_isOnBoundary(n1) == 1){
@@ -745,7 +841,7 @@ private:
         // Interpolate new metric and append it to OMP thread's temp storage
         for(size_t i=0; i<msize; i++) {
             m = m0[i]+weight*(m1[i] - m0[i]);
-            _mesh->metric[(_mesh->NNodes+splitCnt)*msize+i] = m;
+            _mesh->metric[vid*msize+i] = m;
             if(std::isnan(m))
                 std::cerr<<"ERROR: metric health is bad in "<<__FILE__<<std::endl
                          <<"m0[i] = "<<m0[i]<<std::endl
@@ -763,15 +859,15 @@ private:
     typedef std::map<index_t, int> boundary_t;
 #endif
 
-    inline void refine_element(size_t eid, int i)
+    inline void refine_element(size_t eid, int i, int tid)
     {
         if (dim==2)
-            refine2D_1(eid, i);
+            refine2D_1(eid, i, tid);
         else
-            refine3D_1(eid, i);
+            refine3D_1(eid, i, tid);
     }
 
-    inline void refine2D_1(int eid, int iEdgeSplit)
+    inline void refine2D_1(int eid, int iEdgeSplit, int tid)
     {
         // Single edge split.
 
@@ -807,34 +903,33 @@ private:
         const index_t ele0_boundary[] = {rotated_boundary[0], 0, rotated_boundary[2]};
         const index_t ele1_boundary[] = {rotated_boundary[0], rotated_boundary[1], 0};
 
-        index_t ele1ID;
-        ele1ID = splitCnt;
+        // ID of ele1 relative to the first element created by this thread.
+        index_t ele1ID = newRegions[tid].size();
 
         // Add rotated_ele[0] to vertexID's NNList
-        addNN(vertexID, rotated_ele[0]);
+        def_ops->addNN(vertexID, rotated_ele[0], tid);
         // Add vertexID to rotated_ele[0]'s NNList
-        addNN(rotated_ele[0], vertexID);
+        def_ops->addNN(rotated_ele[0], vertexID, tid);
 
         // Put ele1 in rotated_ele[0]'s NEList
-        addNE(rotated_ele[0], ele1ID+origNElements);
+        def_ops->addNE_fix(rotated_ele[0], ele1ID, tid);
 
         // Put eid and ele1 in vertexID's NEList
-        addNE(vertexID, eid);
-        addNE(vertexID, ele1ID+origNElements);
+        def_ops->addNE(vertexID, eid, tid);
+        def_ops->addNE_fix(vertexID, ele1ID, tid);
 
         // Replace eid with ele1 in rotated_ele[2]'s NEList
-        remNE(rotated_ele[2], eid);
-        addNE(rotated_ele[2], ele1ID+origNElements);
+        def_ops->remNE(rotated_ele[2], eid, tid);
+        def_ops->addNE_fix(rotated_ele[2], ele1ID, tid);
 
         assert(ele0[0]>=0 && ele0[1]>=0 && ele0[2]>=0);
         assert(ele1[0]>=0 && ele1[1]>=0 && ele1[2]>=0);
 
         replace_element(eid, ele0, ele0_boundary, region);
-        append_element(ele1, ele1_boundary, region);
-        splitCnt += 1;
+        append_element(ele1, ele1_boundary, region, tid);
     }
 
-    inline void refine3D_1(int eid, int iEdgeSplit)
+    inline void refine3D_1(int eid, int iEdgeSplit, int tid)
     {
         const int *n=_mesh->get_element(eid);
         const int *boundary=&(_mesh->boundary[eid*nloc]);
@@ -869,10 +964,10 @@ private:
             else {
                 // compute the triple product of 2 vectors of the facet, and a vector going to the 4th vertex
                 // this is a determinant, of which the explicit formula can be found in wikipedia
-                const double * f0 = &_mesh->_coords[facet[0]*3];
-                const double * f1 = &_mesh->_coords[facet[1]*3];
-                const double * f2 = &_mesh->_coords[facet[2]*3];
-                const double * ov = &_mesh->_coords[oe[(i+1)%2]*3];
+                const real_t *f0 = &_mesh->_coords[facet[0]*3];
+                const real_t *f1 = &_mesh->_coords[facet[1]*3];
+                const real_t *f2 = &_mesh->_coords[facet[2]*3];
+                const real_t *ov = &_mesh->_coords[oe[(i+1)%2]*3];
                 const double f0f1[3] = {f1[0]-f0[0], f1[1]-f0[1], f1[2]-f0[2]};
                 const double f0f2[3] = {f2[0]-f0[0], f2[1]-f0[1], f2[2]-f0[2]};
                 const double f0ov[3] = {ov[0]-f0[0], ov[1]-f0[1], ov[2]-f0[2]};
@@ -885,8 +980,8 @@ private:
             }
 
             if (flag) {
-                addNN(vid, oe[i]);
-                addNN(oe[i], vid);
+                def_ops->addNN(vid, oe[i], tid);
+                def_ops->addNN(oe[i], vid, tid);
             }
         }
 
@@ -898,26 +993,26 @@ private:
         const int ele0_boundary[] = {0, b[secondid], b[oe[0]], b[oe[1]]};
         const int ele1_boundary[] = {0, b[firstid], b[oe[0]], b[oe[1]]};
 
-        index_t ele1ID = splitCnt;
+        // ID of ele1 relative to the first element created by this thread.
+        index_t ele1ID = newRegions[tid].size();
 
         // Put ele1 in oe[0] and oe[1]'s NEList
-        addNE(oe[0], ele1ID+origNElements);
-        addNE(oe[1], ele1ID+origNElements);
+        def_ops->addNE_fix(oe[0], ele1ID, tid);
+        def_ops->addNE_fix(oe[1], ele1ID, tid);
 
         // Put eid and ele1 in newVertex[0]'s NEList
-        addNE(vid, eid);
-        addNE(vid, ele1ID+origNElements);
+        def_ops->addNE(vid, eid, tid);
+        def_ops->addNE_fix(vid, ele1ID, tid);
 
         // Replace eid with ele1 in splitEdges[0].edge.second's NEList
-        remNE(secondid, eid);
-        addNE(secondid, ele1ID+origNElements);
+        def_ops->remNE(secondid, eid, tid);
+        def_ops->addNE_fix(secondid, ele1ID, tid);
 
         replace_element(eid, ele0, ele0_boundary, region);
-        append_element(ele1, ele1_boundary, region);
-        splitCnt += 1;
+        append_element(ele1, ele1_boundary, region, tid);
     }
 
-    inline void append_element(const index_t *elem, const int *boundary, const int region)
+    inline void append_element(const index_t *elem, const int *boundary, const int region, int tid)
     {
         if(dim==3) {
             // Fix orientation of new element.
@@ -945,13 +1040,13 @@ private:
         }
 
         for(size_t i=0; i<nloc; ++i) {
-            newElements.push_back(elem[i]);
-            newBoundaries.push_back(boundary[i]);
+            newElements[tid].push_back(elem[i]);
+            newBoundaries[tid].push_back(boundary[i]);
         }
-        newRegions.push_back(region);
+        newRegions[tid].push_back(region);
 
         double q = _mesh->template calculate_quality<dim>(elem);
-        newQualities.push_back(q);
+        newQualities[tid].push_back(q);
     }
 
     inline void replace_element(const index_t eid, const index_t *n, const int *boundary, const int region)
@@ -990,34 +1085,6 @@ private:
         _mesh->template update_quality<dim>(eid);
     }
 
-    inline void addNN(const index_t i, const index_t n)
-    {
-        // In case things start breaking, check here... TODO
-        //if (std::find(_mesh->NNList[i].begin(), _mesh->NNList[i].end(), n) == _mesh->NNList[i].end())
-        //    _mesh->NNList[i].push_back(n);
-        _mesh->NNList[i].push_back(n);
-    }
-
-    inline void remNN(const index_t i, const index_t n)
-    {
-        
-        typename std::vector<index_t>::iterator position;
-        position = std::find(_mesh->NNList[i].begin(), _mesh->NNList[i].end(), n);
-        assert(position != _mesh->NNList[i].end());
-        _mesh->NNList[i].erase(position);
-    }
-
-    inline void addNE(const index_t i, const index_t n)
-    {
-        _mesh->NEList[i].insert(n);
-    }
-
-    inline void remNE(const index_t i, const index_t n)
-    {
-        assert(_mesh->NEList[i].count(n) != 0);
-        _mesh->NEList[i].erase(n);
-    }
-
     inline size_t edgeNumber(index_t eid, index_t v1, index_t v2) const
     {
         const int *n=_mesh->get_element(eid);
@@ -1065,13 +1132,14 @@ private:
     std::vector< DirectedEdge<index_t> > newVertices;
     std::vector<real_t>                  newCoords;
     std::vector<double>                  newMetric;
-    std::vector<index_t>                 newElements;
-    std::vector<int>                     newBoundaries;
-    std::vector<int>                     newRegions;
-    std::vector<double>                  newQualities;
+    std::vector< std::vector<index_t> >  newElements;
+    std::vector< std::vector<int> >      newBoundaries;
+    std::vector< std::vector<int> >      newRegions;
+    std::vector< std::vector<double> >   newQualities;
+    std::vector<size_t>                  threadIdx;
+    std::vector<index_t>                 elementSlots;
 
     size_t origNElements;
-    size_t splitCnt;
 
     DeferredOperations<real_t>* def_ops;
     static const int defOp_scaling_factor = 32;
@@ -1080,7 +1148,7 @@ private:
     ElementProperty<real_t> *property;
 
     const size_t nloc, msize, nedge;
-    int nprocs, rank;
+    int nprocs, rank, nthreads;
 };
 
 
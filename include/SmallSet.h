@@ -0,0 +1,290 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef SMALLSET_H
+#define SMALLSET_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+
+/*! \brief Sorted set of small integers stored in a flat array.
+ *
+ * Drop-in replacement for std::set for the short adjacency lists held
+ * by the mesh (e.g. node-element lists). Up to N values are stored
+ * inline; beyond that the values spill into a single heap buffer. This
+ * avoids a tree node per entry and keeps set_intersection and friends
+ * streaming over contiguous memory. Iterators are plain pointers and,
+ * as with std::set, are invalidated by insert/erase. Moves are
+ * noexcept so that a std::vector of sets moves its rows on reallocation
+ * instead of copying them.
+ */
+template<typename T, size_t N>
+class SmallSet
+{
+public:
+    typedef T value_type;
+    typedef size_t size_type;
+    typedef const T& reference;
+    typedef const T& const_reference;
+    typedef const T* iterator;
+    typedef const T* const_iterator;
+    typedef std::reverse_iterator<const_iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    SmallSet() : _data(_local), _size(0), _capacity(N)
+    {
+    }
+
+    template<typename InputIterator>
+    SmallSet(InputIterator first, InputIterator last) : _data(_local), _size(0), _capacity(N)
+    {
+        insert(first, last);
+    }
+
+    SmallSet(const SmallSet& other) : _data(_local), _size(0), _capacity(N)
+    {
+        reserve(other._size);
+        std::copy(other.begin(), other.end(), _data);
+        _size = other._size;
+    }
+
+    SmallSet(SmallSet&& other) noexcept : _data(_local), _size(0), _capacity(N)
+    {
+        steal(other);
+    }
+
+    ~SmallSet()
+    {
+        if(_data!=_local)
+            delete [] _data;
+    }
+
+    SmallSet& operator=(const SmallSet& other)
+    {
+        if(this!=&other) {
+            reserve(other._size);
+            std::copy(other.begin(), other.end(), _data);
+            _size = other._size;
+        }
+        return *this;
+    }
+
+    SmallSet& operator=(SmallSet&& other) noexcept
+    {
+        if(this!=&other) {
+            if(_data!=_local)
+                delete [] _data;
+            _data = _local;
+            _size = 0;
+            _capacity = N;
+            steal(other);
+        }
+        return *this;
+    }
+
+    const_iterator begin() const
+    {
+        return _data;
+    }
+
+    const_iterator end() const
+    {
+        return _data+_size;
+    }
+
+    const_reverse_iterator rbegin() const
+    {
+        return const_reverse_iterator(end());
+    }
+
+    const_reverse_iterator rend() const
+    {
+        return const_reverse_iterator(begin());
+    }
+
+    size_type size() const
+    {
+        return _size;
+    }
+
+    bool empty() const
+    {
+        return _size==0;
+    }
+
+    //! Remove all values; any heap buffer is kept for reuse.
+    void clear()
+    {
+        _size = 0;
+    }
+
+    const_iterator lower_bound(const T& value) const
+    {
+        return std::lower_bound(begin(), end(), value);
+    }
+
+    const_iterator find(const T& value) const
+    {
+        const_iterator it = lower_bound(value);
+        if(it!=end() && *it==value)
+            return it;
+        return end();
+    }
+
+    size_type count(const T& value) const
+    {
+        return find(value)==end()?0:1;
+    }
+
+    std::pair<iterator, bool> insert(const T& value)
+    {
+        size_type pos = lower_bound(value)-_data;
+        if(pos<_size && _data[pos]==value)
+            return std::pair<iterator, bool>(_data+pos, false);
+
+        reserve(_size+1);
+        std::copy_backward(_data+pos, _data+_size, _data+_size+1);
+        _data[pos] = value;
+        _size++;
+
+        return std::pair<iterator, bool>(_data+pos, true);
+    }
+
+    //! Hinted insert so that std::inserter can target a SmallSet.
+    iterator insert(const_iterator, const T& value)
+    {
+        return insert(value).first;
+    }
+
+    template<typename InputIterator>
+    void insert(InputIterator first, InputIterator last)
+    {
+        for(; first!=last; ++first) {
+            // Fast path for sorted input, e.g. when building from CSR rows.
+            if(_size==0 || _data[_size-1]<*first) {
+                reserve(_size+1);
+                _data[_size++] = *first;
+            } else {
+                insert(*first);
+            }
+        }
+    }
+
+    size_type erase(const T& value)
+    {
+        const_iterator it = find(value);
+        if(it==end())
+            return 0;
+
+        erase(it);
+        return 1;
+    }
+
+    iterator erase(const_iterator position)
+    {
+        size_type pos = position-_data;
+        std::copy(_data+pos+1, _data+_size, _data+pos);
+        _size--;
+
+        return _data+pos;
+    }
+
+    void swap(SmallSet& other) noexcept
+    {
+        SmallSet tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    //! Bytes of heap memory owned by this set.
+    size_type heap_size() const
+    {
+        return _data==_local?0:_capacity*sizeof(T);
+    }
+
+    bool operator==(const SmallSet& other) const
+    {
+        return _size==other._size && std::equal(begin(), end(), other.begin());
+    }
+
+    bool operator!=(const SmallSet& other) const
+    {
+        return !(*this==other);
+    }
+
+    bool operator<(const SmallSet& other) const
+    {
+        return std::lexicographical_compare(begin(), end(), other.begin(), other.end());
+    }
+
+private:
+    void reserve(size_type n)
+    {
+        if(n<=_capacity)
+            return;
+
+        size_type capacity = std::max<size_type>(n, 2*_capacity);
+        T* data = new T[capacity];
+        std::copy(_data, _data+_size, data);
+        if(_data!=_local)
+            delete [] _data;
+        _data = data;
+        _capacity = capacity;
+    }
+
+    void steal(SmallSet& other) noexcept
+    {
+        if(other._data==other._local) {
+            std::copy(other.begin(), other.end(), _local);
+        } else {
+            _data = other._data;
+            _capacity = other._capacity;
+            other._data = other._local;
+            other._capacity = N;
+        }
+        _size = other._size;
+        other._size = 0;
+    }
+
+    T* _data;
+    unsigned int _size, _capacity;
+    T _local[N];
+};
+
+#endif
@@ -50,6 +50,7 @@
 #include <Eigen/Dense>
 #include <errno.h>
 
+#include "Colouring.h"
 #include "ElementProperty.h"
 #include "Mesh.h"
 #include "MetricTensor.h"
@@ -71,7 +72,10 @@ public:
         MPI_Comm_size(_mesh->get_mpi_comm(), &mpi_nparts);
         MPI_Comm_rank(_mesh->get_mpi_comm(), &rank);
 
-        epsilon_q = DBL_EPSILON;
+        epsilon_q = std::numeric_limits<real_t>::epsilon();
+
+        nthreads = pragmatic_nthreads();
+        colouring = new Colouring<real_t>(_mesh, nthreads);
 
         // Set the orientation of elements.
         property = NULL;
@@ -100,6 +104,7 @@ public:
     ~Smooth()
     {
         delete property;
+        delete colouring;
     }
 
     // Smart laplacian mesh smoothing.
@@ -112,7 +117,7 @@ public:
             return;
 
         std::vector<bool> is_boundary(NNodes);
-        std::vector<bool> active_vertices(NNodes);
+        std::vector<char> active_vertices(NNodes);
 
         double qsum=0;
         good_q = quality_tol;
@@ -154,23 +159,36 @@ public:
             assert(std::isnormal(good_q));
         }
         
-        int iter=0;
-        while((iter++) < max_iterations) {
-
-            for(index_t node=0; node<NNodes; ++node) {
-                if(_mesh->is_halo_node(node) || is_boundary[node] || !active_vertices[node])
-                    continue;
+        // The colouring is kept between calls and only repaired where
+        // the topology has changed since it was last used.
+        colouring->update();
 
-                if(smart_laplacian_kernel(node)) {
-                    for(auto& it : _mesh->NNList[node]) {
-                        assert(!_mesh->NNList[node].empty());
-                        assert(!_mesh->NEList[node].empty());
-                        active_vertices[it] = true;
+#pragma omp parallel num_threads(nthreads)
+        {
+            for(int iter=0; iter<max_iterations; ++iter) {
+                // Vertices of the same colour are never adjacent, so they
+                // can be relocated concurrently.
+                for(int c=0; c<colouring->get_number_of_colours(); ++c) {
+                    const index_t *members = colouring->get_colour_class(c);
+                    index_t nmembers = colouring->get_class_size(c);
+#pragma omp for schedule(guided)
+                    for(index_t i=0; i<nmembers; ++i) {
+                        index_t node = members[i];
+                        if(_mesh->is_halo_node(node) || is_boundary[node] || !active_vertices[node])
+                            continue;
+
+                        if(smart_laplacian_kernel(node)) {
+                            for(auto& it : _mesh->NNList[node]) {
+                                assert(!_mesh->NNList[node].empty());
+                                assert(!_mesh->NEList[node].empty());
+#pragma omp atomic write
+                                active_vertices[it] = true;
+                            }
+                        } else {
+                            active_vertices[node] = false;
+                        }
                     }
                 }
-                else {
-                    active_vertices[node] = false;
-                }
             }
         }
 
@@ -187,7 +205,7 @@ public:
             return;
 
         std::vector<bool> is_boundary(NNodes);
-        std::vector<bool> active_vertices(NNodes);
+        std::vector<char> active_vertices(NNodes);
 
         double qsum=0;
         good_q = quality_tol;
@@ -233,20 +251,35 @@ public:
             
         }
 
-        int iter=0;
-        while((iter++) < max_iterations) {
-            for(index_t node=0; node<NNodes; ++node) {
-                if(_mesh->is_halo_node(node) || is_boundary[node] || !active_vertices[node])
-                    continue;
+        // The colouring is kept between calls and only repaired where
+        // the topology has changed since it was last used.
+        colouring->update();
 
-                if(optimisation_linf_kernel(node)) {
-                    for(auto& it : _mesh->NNList[node]) {
-                        assert(!_mesh->NNList[node].empty());
-                        assert(!_mesh->NEList[node].empty());
-                        active_vertices[it] = true;
+#pragma omp parallel num_threads(nthreads)
+        {
+            for(int iter=0; iter<max_iterations; ++iter) {
+                // Vertices of the same colour are never adjacent, so they
+                // can be relocated concurrently.
+                for(int c=0; c<colouring->get_number_of_colours(); ++c) {
+                    const index_t *members = colouring->get_colour_class(c);
+                    index_t nmembers = colouring->get_class_size(c);
+#pragma omp for schedule(guided)
+                    for(index_t i=0; i<nmembers; ++i) {
+                        index_t node = members[i];
+                        if(_mesh->is_halo_node(node) || is_boundary[node] || !active_vertices[node])
+                            continue;
+
+                        if(optimisation_linf_kernel(node)) {
+                            for(auto& it : _mesh->NNList[node]) {
+                                assert(!_mesh->NNList[node].empty());
+                                assert(!_mesh->NEList[node].empty());
+#pragma omp atomic write
+                                active_vertices[it] = true;
+                            }
+                        } else {
+                            active_vertices[node] = false;
+                        }
                     }
-                } else {
-                    active_vertices[node] = false;
                 }
             }
         }
@@ -261,7 +294,7 @@ public:
         int NElements = _mesh->get_number_elements();
 
         std::vector<bool> is_boundary(NNodes);
-        std::vector<bool> active_vertices(NNodes);
+        std::vector<char> active_vertices(NNodes);
 
         for(int n=0; n<NNodes; ++n) {
             is_boundary[n] = false;
@@ -287,22 +320,36 @@ public:
             }
         }
 
-        int iter=0;
-        while((iter++) < max_iterations) {
-            for(index_t node=0; node<NNodes; ++node) {
-                if(_mesh->is_halo_node(node) || is_boundary[node] || !active_vertices[node])
-                    continue;
+        // The colouring is kept between calls and only repaired where
+        // the topology has changed since it was last used.
+        colouring->update();
 
-                if(laplacian_kernel(node)) {
-                    for(auto& it : _mesh->NNList[node]) {
-                        assert(!_mesh->NNList[node].empty());
-                        assert(!_mesh->NEList[node].empty());
-                        active_vertices[it] = true;
+#pragma omp parallel num_threads(nthreads)
+        {
+            for(int iter=0; iter<max_iterations; ++iter) {
+                // Vertices of the same colour are never adjacent, so they
+                // can be relocated concurrently.
+                for(int c=0; c<colouring->get_number_of_colours(); ++c) {
+                    const index_t *members = colouring->get_colour_class(c);
+                    index_t nmembers = colouring->get_class_size(c);
+#pragma omp for schedule(guided)
+                    for(index_t i=0; i<nmembers; ++i) {
+                        index_t node = members[i];
+                        if(_mesh->is_halo_node(node) || is_boundary[node] || !active_vertices[node])
+                            continue;
+
+                        if(laplacian_kernel(node)) {
+                            for(auto& it : _mesh->NNList[node]) {
+                                assert(!_mesh->NNList[node].empty());
+                                assert(!_mesh->NEList[node].empty());
+#pragma omp atomic write
+                                active_vertices[it] = true;
+                            }
+                        } else {
+                            active_vertices[node] = false;
+                        }
                     }
-                } else {
-                    active_vertices[node] = false;
                 }
-
             }
         }
         return;
@@ -327,7 +374,7 @@ private:
         real_t p[2];
         laplacian_2d_kernel(node, p);
 
-        double mp[3];
+        real_t mp[3];
         bool valid = generate_location_2d(node, p, mp);
         if(!valid) {
             // Try the mid point.
@@ -347,6 +394,8 @@ private:
         for(size_t j=0; j<3; j++)
             _mesh->metric[node*3+j] = mp[j];
 
+        _mesh->invalidate_edges(node);
+
         for(auto& e : _mesh->NEList[node])
             update_quality(e);
 
@@ -358,7 +407,7 @@ private:
         real_t p[3];
         laplacian_3d_kernel(node, p);
 
-        double mp[6];
+        real_t mp[6];
         bool valid = generate_location_3d(node, p, mp);
         if(!valid) {
             // Try the mid point.
@@ -376,6 +425,8 @@ private:
         for(size_t j=0; j<6; j++)
             _mesh->metric[node*6+j] = mp[j];
 
+        _mesh->invalidate_edges(node);
+
         for(auto& e : _mesh->NEList[node])
             update_quality(e);
 
@@ -411,7 +462,7 @@ private:
 
         // Want to solve the system Ap=q to find the new position, p.
         Eigen::Matrix<real_t, 2, 1> b = Eigen::Matrix<real_t, 2, 1>::Zero(2);
-        Eigen::JacobiSVD<Eigen::Matrix2d, Eigen::HouseholderQRPreconditioner> svd(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
+        Eigen::JacobiSVD<Eigen::Matrix<real_t, 2, 2>, Eigen::HouseholderQRPreconditioner> svd(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
 
         b = svd.solve(q);
 
@@ -464,7 +515,7 @@ private:
 
         // Want to solve the system Ap=q to find the new position, p.
         Eigen::Matrix<real_t, 3, 1> b = Eigen::Matrix<real_t, 3, 1>::Zero(3);
-        Eigen::JacobiSVD<Eigen::Matrix3d, Eigen::HouseholderQRPreconditioner> svd(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
+        Eigen::JacobiSVD<Eigen::Matrix<real_t, 3, 3>, Eigen::HouseholderQRPreconditioner> svd(A, Eigen::ComputeThinU | Eigen::ComputeThinV);
 
         b = svd.solve(q);
 
@@ -495,7 +546,7 @@ private:
         real_t p[2];
         laplacian_2d_kernel(node, p);
 
-        double mp[3];
+        real_t mp[3];
         bool valid = generate_location_2d(node, p, mp);
         if(!valid) {
             // Try the mid point.
@@ -521,6 +572,8 @@ private:
         for(size_t j=0; j<3; j++)
             _mesh->metric[node*3+j] = mp[j];
 
+        _mesh->invalidate_edges(node);
+
         for(const auto& e : _mesh->NEList[node])
             update_quality(e);
 
@@ -532,7 +585,7 @@ private:
         real_t p[3];
         laplacian_3d_kernel(node, p);
 
-        double mp[6];
+        real_t mp[6];
         bool valid = generate_location_3d(node, p, mp);
         if(!valid) {
             // Try the mid point.
@@ -558,6 +611,8 @@ private:
         for(size_t j=0; j<6; j++)
             _mesh->metric[node*6+j] = mp[j];
 
+        _mesh->invalidate_edges(node);
+
         for(const auto& e : _mesh->NEList[node])
             update_quality(e);
 
@@ -582,8 +637,8 @@ private:
         assert(!_mesh->NNList[n0].empty());
         assert(!_mesh->NEList[n0].empty());
 
-        const double *m0 = _mesh->get_metric(n0);
-        const double *x0 = _mesh->get_coords(n0);
+        const real_t *m0 = _mesh->get_metric(n0);
+        const real_t *x0 = _mesh->get_coords(n0);
 
         // Find the worst element.
         std::pair<double, index_t> worst_element(DBL_MAX, -1);
@@ -609,8 +664,8 @@ private:
             int n1 = n[(loc+1)%3];
             int n2 = n[(loc+2)%3];
 
-            const double *x1 = _mesh->get_coords(n1);
-            const double *x2 = _mesh->get_coords(n2);
+            const real_t *x1 = _mesh->get_coords(n1);
+            const real_t *x2 = _mesh->get_coords(n2);
 
             property->lipnikov_grad(loc, x0, x1, x2, m0, grad_w);
 
@@ -639,13 +694,13 @@ private:
             for(const auto& it : _mesh->NEList[n0]) {
                 for (int i=0; i<3; ++i) {
                     int iVer = _mesh->_ENList[3*it+i];
-                    const double *x1 = _mesh->get_coords(iVer);
+                    const real_t *x1 = _mesh->get_coords(iVer);
 
-                    bbox[0] = std::min(bbox[0], x1[0]);
-                    bbox[1] = std::max(bbox[1], x1[0]);
+                    bbox[0] = std::min(bbox[0], (double)x1[0]);
+                    bbox[1] = std::max(bbox[1], (double)x1[0]);
 
-                    bbox[2] = std::min(bbox[2], x1[1]);
-                    bbox[3] = std::max(bbox[3], x1[1]);
+                    bbox[2] = std::min(bbox[2], (double)x1[1]);
+                    bbox[3] = std::max(bbox[3], (double)x1[1]);
                 }
             }
             alpha = (bbox[1]-bbox[0] + bbox[3]-bbox[2])/2.0;
@@ -664,8 +719,8 @@ private:
             int n1 = n[(loc+1)%3];
             int n2 = n[(loc+2)%3];
 
-            const double *x1 = _mesh->get_coords(n1);
-            const double *x2 = _mesh->get_coords(n2);
+            const real_t *x1 = _mesh->get_coords(n1);
+            const real_t *x2 = _mesh->get_coords(n2);
 
             double grad[2];
             property->lipnikov_grad(loc, x0, x1, x2, m0, grad);
@@ -686,14 +741,14 @@ private:
             // Only want to step half that distance so we do not degrade the other elements too much.
             alpha*=0.5;
 
-            double new_x0[2];
+            real_t new_x0[2];
             for(int i=0; i<2; i++) {
                 new_x0[i] = x0[i] + alpha*search[i];
                 if(!std::isnormal(new_x0[i]))
                     return false;
             }
 
-            double new_m0[3];
+            real_t new_m0[3];
             bool valid = generate_location_2d(n0, new_x0, new_m0);
 
             if(!valid)
@@ -712,11 +767,11 @@ private:
                 int n1 = n[(loc+1)%3];
                 int n2 = n[(loc+2)%3];
 
-                const double *x1 = _mesh->get_coords(n1);
-                const double *x2 = _mesh->get_coords(n2);
+                const real_t *x1 = _mesh->get_coords(n1);
+                const real_t *x2 = _mesh->get_coords(n2);
 
-                const double *m1 = _mesh->get_metric(n1);
-                const double *m2 = _mesh->get_metric(n2);
+                const real_t *m1 = _mesh->get_metric(n1);
+                const real_t *m2 = _mesh->get_metric(n2);
 
                 double new_q = property->lipnikov(new_x0, x1, x2, new_m0, m1, m2);
                 new_quality.push_back(new_q);
@@ -733,7 +788,7 @@ private:
             // Update information
             // go backwards and pop quality
             assert(_mesh->NEList[n0].size()==new_quality.size());
-            for(typename std::set<index_t>::const_reverse_iterator it=_mesh->NEList[n0].rbegin(); it!=_mesh->NEList[n0].rend(); ++it) {
+            for(typename element_set_t::const_reverse_iterator it=_mesh->NEList[n0].rbegin(); it!=_mesh->NEList[n0].rend(); ++it) {
                 _mesh->quality[*it] = new_quality.back();
                 new_quality.pop_back();
             }
@@ -745,6 +800,8 @@ private:
             for(size_t i=0; i<msize; i++)
                 _mesh->metric[n0*msize+i] = new_m0[i];
 
+            _mesh->invalidate_edges(n0);
+
             for(auto& e : _mesh->NEList[n0])
                 update_quality(e);
 
@@ -756,8 +813,8 @@ private:
 
     inline bool optimisation_linf_3d_kernel(index_t n0)
     {
-        const double *m0 = _mesh->get_metric(n0);
-        const double *x0 = _mesh->get_coords(n0);
+        const real_t *m0 = _mesh->get_metric(n0);
+        const real_t *x0 = _mesh->get_coords(n0);
 
         // Find the worst element.
         std::pair<double, index_t> worst_element(DBL_MAX, -1);
@@ -804,9 +861,9 @@ private:
                 break;
             }
 
-            const double *x1 = _mesh->get_coords(n1);
-            const double *x2 = _mesh->get_coords(n2);
-            const double *x3 = _mesh->get_coords(n3);
+            const real_t *x1 = _mesh->get_coords(n1);
+            const real_t *x2 = _mesh->get_coords(n2);
+            const real_t *x3 = _mesh->get_coords(n3);
 
             property->lipnikov_grad(loc, x0, x1, x2, x3, m0, grad_w);
 
@@ -834,16 +891,16 @@ private:
             for(const auto& it : _mesh->NEList[n0]) {
                 for (int i=0; i<4; ++i) {
                     int iVer = _mesh->_ENList[4*it+i];
-                    const double *x1 = _mesh->get_coords(iVer);
+                    const real_t *x1 = _mesh->get_coords(iVer);
 
-                    bbox[0] = std::min(bbox[0], x1[0]);
-                    bbox[1] = std::max(bbox[1], x1[0]);
+                    bbox[0] = std::min(bbox[0], (double)x1[0]);
+                    bbox[1] = std::max(bbox[1], (double)x1[0]);
 
-                    bbox[2] = std::min(bbox[2], x1[1]);
-                    bbox[3] = std::max(bbox[3], x1[1]);
+                    bbox[2] = std::min(bbox[2], (double)x1[1]);
+                    bbox[3] = std::max(bbox[3], (double)x1[1]);
 
-                    bbox[4] = std::min(bbox[4], x1[2]);
-                    bbox[5] = std::max(bbox[5], x1[2]);
+                    bbox[4] = std::min(bbox[4], (double)x1[2]);
+                    bbox[5] = std::max(bbox[5], (double)x1[2]);
                 }
             }
             alpha = (bbox[1]-bbox[0] + bbox[3]-bbox[2] + bbox[5]-bbox[4])/6.0;
@@ -882,9 +939,9 @@ private:
                 break;
             }
 
-            const double *x1 = _mesh->get_coords(n1);
-            const double *x2 = _mesh->get_coords(n2);
-            const double *x3 = _mesh->get_coords(n3);
+            const real_t *x1 = _mesh->get_coords(n1);
+            const real_t *x2 = _mesh->get_coords(n2);
+            const real_t *x3 = _mesh->get_coords(n3);
 
             double grad[3];
             property->lipnikov_grad(loc, x0, x1, x2, x3, m0, grad);
@@ -905,12 +962,12 @@ private:
             // Only want to step half that distance so we do not degrade the other elements too much.
             alpha*=0.5;
 
-            double new_x0[3];
+            real_t new_x0[3];
             for(int i=0; i<3; i++) {
                 new_x0[i] = x0[i] + alpha*search[i];
             }
 
-            double new_m0[6];
+            real_t new_m0[6];
             bool valid = generate_location_3d(n0, new_x0, new_m0);
 
             if(!valid)
@@ -950,14 +1007,14 @@ private:
                     break;
                 }
 
-                const double *x1 = _mesh->get_coords(n1);
-                const double *x2 = _mesh->get_coords(n2);
-                const double *x3 = _mesh->get_coords(n3);
+                const real_t *x1 = _mesh->get_coords(n1);
+                const real_t *x2 = _mesh->get_coords(n2);
+                const real_t *x3 = _mesh->get_coords(n3);
 
 
-                const double *m1 = _mesh->get_metric(n1);
-                const double *m2 = _mesh->get_metric(n2);
-                const double *m3 = _mesh->get_metric(n3);
+                const real_t *m1 = _mesh->get_metric(n1);
+                const real_t *m2 = _mesh->get_metric(n2);
+                const real_t *m3 = _mesh->get_metric(n3);
 
                 double new_q = property->lipnikov(new_x0, x1, x2, x3, new_m0, m1, m2, m3);
 
@@ -976,7 +1033,7 @@ private:
             // Update information
             // go backwards and pop quality
             assert(_mesh->NEList[n0].size()==new_quality.size());
-            for(typename std::set<index_t>::const_reverse_iterator it=_mesh->NEList[n0].rbegin(); it!=_mesh->NEList[n0].rend(); ++it) {
+            for(typename element_set_t::const_reverse_iterator it=_mesh->NEList[n0].rbegin(); it!=_mesh->NEList[n0].rend(); ++it) {
                 _mesh->quality[*it] = new_quality.back();
                 new_quality.pop_back();
             }
@@ -988,6 +1045,8 @@ private:
             for(size_t i=0; i<msize; i++)
                 _mesh->metric[n0*msize+i] = new_m0[i];
 
+            _mesh->invalidate_edges(n0);
+
             for(auto& e : _mesh->NEList[n0])
                 update_quality(e);
 
@@ -1037,7 +1096,7 @@ private:
 
     inline real_t functional_Linf_2d(index_t n0, const real_t *p, const real_t *mp) const
     {
-        real_t functional = DBL_MAX;
+        real_t functional = std::numeric_limits<real_t>::max();
         for(const auto& ie : _mesh->NEList[n0]) {
             const index_t *n=_mesh->get_element(ie);
             assert(n[0]>=0);
@@ -1052,8 +1111,8 @@ private:
             const real_t *x1 = _mesh->get_coords(n[loc1]);
             const real_t *x2 = _mesh->get_coords(n[loc2]);
 
-            const double *m1 = _mesh->get_metric(n[loc1]);
-            const double *m2 = _mesh->get_metric(n[loc2]);
+            const real_t *m1 = _mesh->get_metric(n[loc1]);
+            const real_t *m2 = _mesh->get_metric(n[loc2]);
 
             real_t fnl = property->lipnikov(p,  x1, x2,
                                             mp, m1, m2);
@@ -1065,7 +1124,7 @@ private:
 
     inline real_t functional_Linf_3d(index_t n0, const real_t *p, const real_t *mp) const
     {
-        real_t functional = DBL_MAX;
+        real_t functional = std::numeric_limits<real_t>::max();
         for(const auto& ie : _mesh->NEList[n0]) {
             const index_t *n=_mesh->get_element(ie);
             size_t loc=0;
@@ -1097,13 +1156,13 @@ private:
                 break;
             }
 
-            const double *x1 = _mesh->get_coords(n1);
-            const double *x2 = _mesh->get_coords(n2);
-            const double *x3 = _mesh->get_coords(n3);
+            const real_t *x1 = _mesh->get_coords(n1);
+            const real_t *x2 = _mesh->get_coords(n2);
+            const real_t *x3 = _mesh->get_coords(n3);
 
-            const double *m1 = _mesh->get_metric(n1);
-            const double *m2 = _mesh->get_metric(n2);
-            const double *m3 = _mesh->get_metric(n3);
+            const real_t *m1 = _mesh->get_metric(n1);
+            const real_t *m2 = _mesh->get_metric(n2);
+            const real_t *m3 = _mesh->get_metric(n3);
 
             real_t fnl = property->lipnikov(p, x1, x2, x3,
                                             mp,m1, m2, m3);
@@ -1113,7 +1172,7 @@ private:
         return functional;
     }
 
-    inline bool generate_location_2d(index_t node, const real_t *p, double *mp) const
+    inline bool generate_location_2d(index_t node, const real_t *p, real_t *mp) const
     {
         // Interpolate metric at this new position.
         real_t l[]= {-1, -1, -1};
@@ -1164,7 +1223,7 @@ private:
             }
         }
         assert(best_e!=-1);
-        assert(tol>-DBL_EPSILON);
+        assert(tol>-std::numeric_limits<real_t>::epsilon());
 
         const index_t *n=_mesh->get_element(best_e);
         assert(n[0]>=0);
@@ -1178,7 +1237,7 @@ private:
         return true;
     }
 
-    inline bool generate_location_3d(index_t node, const real_t *p, double *mp) const
+    inline bool generate_location_3d(index_t node, const real_t *p, real_t *mp) const
     {
         // Interpolate metric at this new position.
         real_t l[]= {-1, -1, -1, -1};
@@ -1234,10 +1293,10 @@ private:
         }
         assert(best_e!=-1);
 #ifndef NDEBUG
-        if(!(tol>-10*DBL_EPSILON)) {
+        if(!(tol>-10*std::numeric_limits<real_t>::epsilon())) {
             std::cerr<<__FILE__<<", "<<__LINE__<<" failing with tol="<<tol<<std::endl;
         }
-        assert(tol>-10*DBL_EPSILON);
+        assert(tol>-10*std::numeric_limits<real_t>::epsilon());
 #endif
 
         const index_t *n=_mesh->get_element(best_e);
@@ -1271,13 +1330,13 @@ private:
         assert(n[1]>=0);
         assert(n[2]>=0);
 
-        const double *x0 = _mesh->get_coords(n[0]);
-        const double *x1 = _mesh->get_coords(n[1]);
-        const double *x2 = _mesh->get_coords(n[2]);
+        const real_t *x0 = _mesh->get_coords(n[0]);
+        const real_t *x1 = _mesh->get_coords(n[1]);
+        const real_t *x2 = _mesh->get_coords(n[2]);
 
-        const double *m0 = _mesh->get_metric(n[0]);
-        const double *m1 = _mesh->get_metric(n[1]);
-        const double *m2 = _mesh->get_metric(n[2]);
+        const real_t *m0 = _mesh->get_metric(n[0]);
+        const real_t *m1 = _mesh->get_metric(n[1]);
+        const real_t *m2 = _mesh->get_metric(n[2]);
 
         _mesh->quality[element] = property->lipnikov(x0, x1, x2,
                                   m0, m1, m2);
@@ -1289,15 +1348,15 @@ private:
     {
         const index_t *n=_mesh->get_element(element);
 
-        const double *x0 = _mesh->get_coords(n[0]);
-        const double *x1 = _mesh->get_coords(n[1]);
-        const double *x2 = _mesh->get_coords(n[2]);
-        const double *x3 = _mesh->get_coords(n[3]);
+        const real_t *x0 = _mesh->get_coords(n[0]);
+        const real_t *x1 = _mesh->get_coords(n[1]);
+        const real_t *x2 = _mesh->get_coords(n[2]);
+        const real_t *x3 = _mesh->get_coords(n[3]);
 
-        const double *m0 = _mesh->get_metric(n[0]);
-        const double *m1 = _mesh->get_metric(n[1]);
-        const double *m2 = _mesh->get_metric(n[2]);
-        const double *m3 = _mesh->get_metric(n[3]);
+        const real_t *m0 = _mesh->get_metric(n[0]);
+        const real_t *m1 = _mesh->get_metric(n[1]);
+        const real_t *m2 = _mesh->get_metric(n[2]);
+        const real_t *m3 = _mesh->get_metric(n[3]);
 
         _mesh->quality[element] = property->lipnikov(x0, x1, x2, x3,
                                   m0, m1, m2, m3);
@@ -1326,6 +1385,9 @@ private:
 
     int mpi_nparts, rank;
     real_t good_q, epsilon_q;
+
+    Colouring<real_t> *colouring;
+    int nthreads;
 };
 
 #endif
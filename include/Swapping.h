@@ -39,19 +39,24 @@
 #define SWAPPING_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <set>
+#include <thread>
 #include <vector>
 
+#include "Arena.h"
 #include "Edge.h"
 #include "ElementProperty.h"
 #include "Mesh.h"
 
 #ifdef HAVE_BOOST_UNORDERED_MAP_HPP
 #include <boost/unordered_map.hpp>
-typedef boost::unordered_map< index_t, std::set<index_t> > propagation_map;
+typedef boost::unordered_map< index_t, arena_set<index_t>, boost::hash<index_t>, std::equal_to<index_t>,
+        ArenaAllocator< std::pair<const index_t, arena_set<index_t> > > > propagation_map;
 #else
 #include <map>
-typedef std::map< index_t, std::set<index_t> > propagation_map;
+typedef arena_map< index_t, arena_set<index_t> > propagation_map;
 #endif
 
 /*! \brief Performs edge/face swapping.
@@ -87,6 +92,14 @@ public:
         }
 
         nnodes_reserve = 0;
+
+        nthreads = pragmatic_nthreads();
+        queues = std::vector<work_queue_t>(nthreads);
+        overflow.resize(nthreads);
+        for(int t=0; t<nthreads; ++t) {
+            queues[t].busy.store(false);
+            queues[t].size.store(0);
+        }
     }
 
     /// Default destructor.
@@ -99,8 +112,13 @@ public:
     void swap(real_t quality_tolerance)
     {
         int nswaps  = 0;
+
+        // 3D swaps may need more elements than they remove; these go into
+        // erased slots first.
+        if(dim==3)
+            _mesh->update_free_slots();
+
         size_t NNodes = _mesh->get_number_nodes();
-        size_t NElements = _mesh->get_number_elements();
 
         min_Q = quality_tolerance;
 
@@ -108,15 +126,74 @@ public:
             nnodes_reserve = NNodes;
 
             marked_edges.resize(NNodes);
+            std::vector< std::atomic<bool> >(NNodes).swap(vertex_lock);
+            for(size_t i=0; i<NNodes; ++i)
+                vertex_lock[i].store(false);
+        }
+
+        // Every vertex is visited once. Each thread starts from a
+        // contiguous block of vertices so that threads begin working far
+        // apart from each other.
+        for(int t=0; t<nthreads; ++t) {
+            for(size_t i=t*NNodes/nthreads; i<(t+1)*NNodes/nthreads; ++i)
+                queues[t].seeds.push_back(i);
+            queues[t].size.store(queues[t].seeds.size());
+        }
+        pending.store(NNodes);
+
+        for(;;) {
+            reserve_elements();
+
+#pragma omp parallel num_threads(nthreads) reduction(+:nswaps)
+            {
+                const int tid = pragmatic_thread_id();
+
+                index_t node;
+                bool seed;
+                while(next_vertex(tid, node, seed)) {
+                    nswaps += swap_vertex(node, seed, tid);
+                    pending.fetch_sub(1);
+                }
+            }
+
+            // Swaps which did not fit into the element arrays are retried
+            // once the arrays have been enlarged.
+            std::vector<index_t> retry;
+            for(int t=0; t<nthreads; ++t) {
+                retry.insert(retry.end(), overflow[t].begin(), overflow[t].end());
+                overflow[t].clear();
+            }
+            if(retry.empty())
+                break;
+
+            std::sort(retry.begin(), retry.end());
+            retry.erase(std::unique(retry.begin(), retry.end()), retry.end());
+            queues[0].seeds.insert(queues[0].seeds.end(), retry.begin(), retry.end());
+            queues[0].size.store(queues[0].seeds.size()+queues[0].propagated.size());
+            pending.store(retry.size());
         }
 
-        // Vector "retry" is used to store aborted vertices.
-        // Vector "round" is used to store propagated vertices.
-        std::vector<index_t> this_round, next_round;
-        for(index_t node=0; node<NNodes; ++node) {
-            bool abort = false;
+        printf("DEBUG   Number of swaps: %d\n", nswaps);
+    }
 
-            std::set< Edge<index_t> > active_edges;
+private:
+
+    /// Process all active edges of vertex node. Returns the number of swaps performed.
+    int swap_vertex(index_t node, bool seed, int tid)
+    {
+        // Lock the vertex and all its neighbours. Every element touched by
+        // swapping an edge of node is formed from these vertices, and so are
+        // the new elements, so the cavities of two threads can never overlap.
+        ArenaScope scope;
+        arena_vector<index_t> locked;
+        if(!lock_vertex(node, locked)) {
+            requeue(node, seed, tid);
+            return 0;
+        }
+
+        int nswaps = 0;
+        if(seed || !marked_edges[node].empty()) {
+            arena_set< Edge<index_t> > active_edges;
             for(auto& ele : _mesh->NEList[node]) {
                 if(_mesh->quality[ele] < min_Q) {
                     const index_t* n = _mesh->get_element(ele);
@@ -130,13 +207,13 @@ public:
             for(auto& edge : active_edges) {
                 marked_edges[edge.edge.first].erase(edge.edge.second);
                 propagation_map pMap;
-                bool swapped = swap_kernel(edge, pMap);
+                bool swapped = swap_kernel(edge, pMap, tid);
 
                 if(swapped) {
                     for(auto& entry : pMap) {
                         for(auto& v : entry.second) {
                             marked_edges[entry.first].insert(v);
-                            next_round.push_back(entry.first);
+                            requeue(entry.first, false, tid);
                         }
                     }
                     nswaps++;
@@ -144,59 +221,118 @@ public:
             }
         }
 
-        while(!next_round.empty()) {
-            this_round.swap(next_round);
-            next_round.clear();
+        for(auto& v : locked)
+            vertex_lock[v].store(false, std::memory_order_release);
 
-            for(auto& node : this_round) {
-                if(marked_edges[node].empty())
-                    continue;
+        return nswaps;
+    }
 
-                bool abort = false;
+    /// Try to lock a vertex and its neighbours. On failure nothing is left locked.
+    bool lock_vertex(index_t node, arena_vector<index_t>& locked)
+    {
+        if(vertex_lock[node].exchange(true, std::memory_order_acquire))
+            return false;
+        locked.push_back(node);
 
-                std::set< Edge<index_t> > active_edges;
-                for(auto& ele : _mesh->NEList[node]) {
-                    if(_mesh->quality[ele] < min_Q) {
-                        const index_t* n = _mesh->get_element(ele);
-                        for(int i=0; i<nloc; ++i) {
-                            if(node < n[i])
-                                active_edges.insert(Edge<index_t>(node, n[i]));
-                        }
-                    }
-                }
+        for(auto& nn : _mesh->NNList[node]) {
+            if(vertex_lock[nn].exchange(true, std::memory_order_acquire)) {
+                for(auto& v : locked)
+                    vertex_lock[v].store(false, std::memory_order_release);
+                locked.clear();
+                return false;
+            }
+            locked.push_back(nn);
+        }
 
-                for(auto& edge : active_edges) {
-                    marked_edges[edge.edge.first].erase(edge.edge.second);
-                    propagation_map pMap;
-                    bool swapped = swap_kernel(edge, pMap);
-
-                    if(swapped) {
-                        for(auto& entry : pMap) {
-                            for(auto& v : entry.second) {
-                                marked_edges[entry.first].insert(v);
-                                next_round.push_back(entry.first);
-                            }
-                        }
-                        nswaps++;
+        return true;
+    }
+
+    /// Append a vertex to the work queue of thread tid.
+    void requeue(index_t node, bool seed, int tid)
+    {
+        pending.fetch_add(1);
+
+        work_queue_t& q = queues[tid];
+        while(q.busy.exchange(true, std::memory_order_acquire));
+        if(seed)
+            q.seeds.push_back(node);
+        else
+            q.propagated.push_back(node);
+        q.size.fetch_add(1, std::memory_order_relaxed);
+        q.busy.store(false, std::memory_order_release);
+    }
+
+    /// Fetch the next vertex for thread tid. The thread takes work from the
+    /// front of its own queue; when that is exhausted it steals from the back
+    /// of the other threads' queues. Returns false once all work is done.
+    bool next_vertex(int tid, index_t& node, bool& seed)
+    {
+        for(;;) {
+            for(int i=0; i<nthreads; ++i) {
+                const int victim = (tid+i)%nthreads;
+                work_queue_t& q = queues[victim];
+
+                // The deques may only be read under the lock; size lets
+                // empty queues be skipped without taking it.
+                if(q.size.load(std::memory_order_relaxed)==0)
+                    continue;
+
+                bool found = true;
+                while(q.busy.exchange(true, std::memory_order_acquire));
+                if(!q.seeds.empty()) {
+                    seed = true;
+                    if(victim==tid) {
+                        node = q.seeds.front();
+                        q.seeds.pop_front();
+                    } else {
+                        node = q.seeds.back();
+                        q.seeds.pop_back();
+                    }
+                } else if(!q.propagated.empty()) {
+                    seed = false;
+                    if(victim==tid) {
+                        node = q.propagated.front();
+                        q.propagated.pop_front();
+                    } else {
+                        node = q.propagated.back();
+                        q.propagated.pop_back();
                     }
+                } else {
+                    found = false;
                 }
-            }
+                if(found)
+                    q.size.fetch_sub(1, std::memory_order_relaxed);
+                q.busy.store(false, std::memory_order_release);
 
-            if(next_round.empty()) {
-                // TODO: Try to steal work
+                if(found)
+                    return true;
             }
+
+            // Vertices still being processed may propagate more work.
+            if(pending.load()==0)
+                return false;
+
+            std::this_thread::yield();
         }
-        printf("DEBUG   Number of swaps: %d\n", nswaps);
     }
 
-private:
+    /// Make sure there is room for new elements created by 3D swaps.
+    /// Free slots are used first, so the arrays only grow by a small margin.
+    void reserve_elements()
+    {
+        if(dim==2)
+            return;
+
+        size_t NElements = _mesh->get_number_elements();
+        _mesh->resize_elements(NElements+std::max(NElements/8, (size_t)1024));
+    }
 
-    inline bool swap_kernel(const Edge<index_t>& edge, propagation_map& pMap)
+    inline bool swap_kernel(const Edge<index_t>& edge, propagation_map& pMap, int tid)
     {
         if(dim==2)
             return swap_kernel2d(edge, pMap);
         else
-            return swap_kernel3d(edge, pMap);
+            return swap_kernel3d(edge, pMap, tid);
     }
 
     /*
@@ -379,7 +515,7 @@ private:
         index_t intersection[2];
         {
             size_t loc = 0;
-            std::set<index_t>::const_iterator it=_mesh->NEList[i].begin();
+            element_set_t::const_iterator it=_mesh->NEList[i].begin();
             while(loc<2 && it!=_mesh->NEList[i].end()) {
                 if(_mesh->NEList[j].find(*it)!=_mesh->NEList[j].end()) {
                     intersection[loc++] = *it;
@@ -494,7 +630,7 @@ private:
         return false;
     }
 
-    inline bool swap_kernel3d(const Edge<index_t>& edge, propagation_map& pMap)
+    inline bool swap_kernel3d(const Edge<index_t>& edge, propagation_map& pMap, int tid)
     {
         index_t nk = edge.edge.first;
         index_t nl = edge.edge.second;
@@ -503,10 +639,10 @@ private:
             return false;
         }
 
-        std::set<index_t> neigh_elements;
+        arena_vector<index_t> neigh_elements;
         set_intersection(_mesh->NEList[nk].begin(), _mesh->NEList[nk].end(),
                          _mesh->NEList[nl].begin(), _mesh->NEList[nl].end(),
-                         inserter(neigh_elements, neigh_elements.begin()));
+                         back_inserter(neigh_elements));
 
         bool abort = true;
         for(auto& e : neigh_elements) {
@@ -521,9 +657,9 @@ private:
         }
 
         double min_quality = 1.0;
-        std::vector<index_t> constrained_edges_unsorted;
-        std::map<int, std::map<index_t, int> > b;
-        std::vector<int> element_order, e_to_eid;
+        arena_vector<index_t> constrained_edges_unsorted;
+        arena_map<int, arena_map<index_t, int> > b;
+        arena_vector<int> element_order, e_to_eid;
         int region = -10;
 
         for(auto& it : neigh_elements) {
@@ -561,8 +697,8 @@ private:
         assert(b.size() == nelements);
 
         // Sort edges.
-        std::vector<index_t> constrained_edges;
-        std::vector<bool> sorted(nelements, false);
+        arena_vector<index_t> constrained_edges;
+        arena_vector<bool> sorted(nelements, false);
         constrained_edges.push_back(constrained_edges_unsorted[0]);
         constrained_edges.push_back(constrained_edges_unsorted[1]);
         element_order.push_back(e_to_eid[0]);
@@ -602,8 +738,8 @@ private:
                                          _mesh->get_coords(n[2]), _mesh->get_coords(n[3]));
         }
 
-        std::vector< std::vector<index_t> > new_elements;
-        std::vector< std::vector<int> > new_boundaries;
+        arena_vector< arena_vector<index_t> > new_elements;
+        arena_vector< arena_vector<int> > new_boundaries;
         if(nelements==3) {
             // This is the 3-element to 2-element swap.
             new_elements.resize(1);
@@ -989,8 +1125,8 @@ private:
         nelements = new_elements[0].size()/4;
 
         // Check new minimum quality.
-        std::vector<double> new_min_quality(new_elements.size());
-        std::vector< std::vector<double> > newq(new_elements.size());
+        arena_vector<double> new_min_quality(new_elements.size());
+        arena_vector< arena_vector<double> > newq(new_elements.size());
 
         for(size_t option=0; option<new_elements.size(); option++) {
             newq[option].resize(nelements);
@@ -1038,6 +1174,33 @@ private:
             return false;
         }
 
+        // Find how many new elements we have to allocate. Other threads may
+        // be allocating elements too, so take them from the free slots of
+        // the mesh and then from the space reserved by swap(). If it is
+        // exhausted the swap is retried later.
+        int extra_elements = nelements - neigh_elements.size();
+        arena_vector<index_t> extra_eids;
+        if(extra_elements > 0) {
+#pragma omp critical(swapping_allocate_elements)
+            {
+                size_t reuse = std::min((size_t)extra_elements, _mesh->free_elements.size());
+                size_t append = extra_elements-reuse;
+                if((_mesh->NElements+append)*nloc <= _mesh->_ENList.size()) {
+                    for(size_t i=0; i<reuse; ++i) {
+                        extra_eids.push_back(_mesh->free_elements.back());
+                        _mesh->free_elements.pop_back();
+                    }
+                    for(size_t i=0; i<append; ++i)
+                        extra_eids.push_back(_mesh->NElements++);
+                }
+            }
+
+            if(extra_eids.empty()) {
+                overflow[tid].push_back(nk);
+                return false;
+            }
+        }
+
         // Update NNList
         std::vector<index_t>::iterator vit = std::find(_mesh->NNList[nk].begin(), _mesh->NNList[nk].end(), nl);
         assert(vit != _mesh->NNList[nk].end());
@@ -1052,29 +1215,11 @@ private:
 
         // Add new elements and mark edges for propagation.
         // First, recycle element IDs.
-        std::deque<index_t> new_eids;
+        arena_deque<index_t> new_eids;
         for(auto& ele : neigh_elements)
             new_eids.push_back(ele);
 
-        // Next, find how many new elements we have to allocate
-        int extra_elements = nelements - neigh_elements.size();
-        if(extra_elements > 0) {
-            index_t new_eid;
-            new_eid = _mesh->NElements;
-            _mesh->NElements += extra_elements;
-
-            if(_mesh->_ENList.size() < (new_eid+extra_elements)*nloc) {
-                if(_mesh->_ENList.size() < (new_eid+extra_elements)*nloc) {
-                    _mesh->_ENList.resize(2*(new_eid+extra_elements)*nloc);
-                    _mesh->regions.resize(2*(new_eid+extra_elements));
-                    _mesh->boundary.resize(2*(new_eid+extra_elements)*nloc);
-                    _mesh->quality.resize(2*(new_eid+extra_elements)*nloc); // TODO why *nloc ?
-                }
-            }
-
-            for(int i=0; i<extra_elements; ++i)
-                new_eids.push_back(new_eid++);
-        }
+        new_eids.insert(new_eids.end(), extra_eids.begin(), extra_eids.end());
 
         for(size_t j=0; j<nelements; j++) {
             index_t eid = new_eids[0];
@@ -1103,6 +1248,12 @@ private:
             }
         }
 
+        // Elements left over when the swap removed more than it created.
+        if(!new_eids.empty()) {
+#pragma omp critical(swapping_allocate_elements)
+            _mesh->free_elements.insert(_mesh->free_elements.end(), new_eids.begin(), new_eids.end());
+        }
+
         return true;
     }
 
@@ -1115,8 +1266,21 @@ private:
     static const size_t nloc=dim+1;
     static const size_t msize=(dim==2?3:6);
 
-    std::vector< std::set<index_t> > marked_edges;
+    std::vector<vertex_set_t> marked_edges;
     real_t min_Q;
+
+    struct work_queue_t {
+        std::deque<index_t> seeds;      // Vertices visited in the first sweep.
+        std::deque<index_t> propagated; // Vertices with edges marked by a swap.
+        std::atomic<bool> busy;
+        std::atomic<size_t> size;       // seeds.size()+propagated.size(), updated under busy.
+    };
+    std::vector<work_queue_t> queues;
+    std::vector< std::vector<index_t> > overflow;
+    std::vector< std::atomic<bool> > vertex_lock;
+    std::atomic<size_t> pending;
+
+    int nthreads;
 };
 
 #endif
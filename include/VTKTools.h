@@ -70,6 +70,7 @@ typedef float vtkFloatingPointType;
 #include <vector>
 #include <string>
 #include <cfloat>
+#include <limits>
 #include <typeinfo>
 
 #include "Mesh.h"
@@ -222,8 +223,8 @@ public:
 
         if(nparts>1) {
             std::vector<index_t> owner_range;
-            std::vector<index_t> lnn2gnn;
-            std::map<index_t, index_t> gnn2lnn;
+            std::vector<gnn_t> lnn2gnn;
+            std::map<gnn_t, index_t> gnn2lnn;
             std::vector<int> node_owner;
 
             std::vector<int> epart(NElements, 0), npart(NNodes, 0);
@@ -458,7 +459,7 @@ public:
 
         for(index_t i=0; i<NNodes; i++) {
             const real_t *r = mesh->get_coords(i);
-            const double *m = mesh->get_metric(i);
+            const real_t *m = mesh->get_metric(i);
 
             if(vtk_psi!=NULL)
                 vtk_psi->SetTuple1(i, psi[i]);
@@ -478,10 +479,10 @@ public:
             int nedges=mesh->NNList[i].size();
             real_t mean_edge_length=0;
             real_t max_desired_edge_length=0;
-            real_t min_desired_edge_length=DBL_MAX;
+            real_t min_desired_edge_length=std::numeric_limits<real_t>::max();
 
             if(ndims==2) {
-                MetricTensor<double,2> M(m, false);
+                MetricTensor<real_t,2> M(m, false);
                 double maxL = M.max_length();
                 double minL = M.min_length();
                 for(typename std::vector<index_t>::const_iterator it=mesh->NNList[i].begin(); it!=mesh->NNList[i].end(); ++it) {
@@ -493,7 +494,7 @@ public:
                 }
             }
             else if(ndims==3) {
-                MetricTensor<double,3> M(m, false);
+                MetricTensor<real_t,3> M(m, false);
                 double maxL = M.max_length();
                 double minL = M.min_length();
 
@@ -1,19 +1,32 @@
 #ifndef CPRAGMATIC_H
 #define CPRAGMATIC_H
 
+#include <stdint.h>
+
+#include "pragmatic_config.h"
+
+/* Global node numbers, 64 bit if configured with PRAGMATIC_INDEX_64. */
+#ifdef PRAGMATIC_INDEX_64
+typedef int64_t pragmatic_gnn_t;
+#else
+typedef int pragmatic_gnn_t;
+#endif
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
 void pragmatic_2d_init(const int *NNodes, const int *NElements, const int *enlist, const double *x, const double *y);
-void pragmatic_2d_mpi_init(const int *NNodes, const int *NElements, const int *enlist, const double *x, const double *y, const int *lnn2gnn, const int NPNodes, MPI_Comm mpi_comm);
+void pragmatic_2d_mpi_init(const int *NNodes, const int *NElements, const int *enlist, const double *x, const double *y, const pragmatic_gnn_t *lnn2gnn, const int NPNodes, MPI_Comm mpi_comm);
 void pragmatic_3d_init(const int *NNodes, const int *NElements, const int *enlist, const double *x, const double *y, const double *z);
-void pragmatic_3d_mpi_init(const int *NNodes, const int *NElements, const int *enlist, const double *x, const double *y, const double *z, const int *lnn2gnn, const int NPNodes, MPI_Comm mpi_comm);
+void pragmatic_3d_mpi_init(const int *NNodes, const int *NElements, const int *enlist, const double *x, const double *y, const double *z, const pragmatic_gnn_t *lnn2gnn, const int NPNodes, MPI_Comm mpi_comm);
 void pragmatic_init_light(void* mesh);
 void pragmatic_set_boundary(const int *nfacets, const int *facets, const int *ids);
 void pragmatic_set_metric(const double *metric);
 void pragmatic_add_field(const double *psi, const double *error, int *pnorm);
+void pragmatic_add_fields(const int *nfields, const double *psi, const double *errors, int *pnorm);
 void pragmatic_set_regions(const int *element_tags);
 void pragmatic_set_internal_boundaries();
+void pragmatic_set_sfc_renumbering(int enable);
 void pragmatic_adapt(int coarsen_surface, int coarsen_int_surface);
 void pragmatic_coarsen(int coarsen_surface);
 void pragmatic_get_info(int *NNodes, int *NElements);
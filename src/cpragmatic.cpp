@@ -36,6 +36,7 @@
  */
 
 #include <cassert>
+#include <vector>
 
 #include "Mesh.h"
 #include "MetricField.h"
@@ -100,7 +101,7 @@ extern "C" {
       @param [in] mpi_comm is the mpi comm.
       */
     void pragmatic_2d_mpi_init(const int *NNodes, const int *NElements, const int *enlist, const double *x, const double *y,
-                               const int *lnn2gnn, const int NPNodes, MPI_Comm mpi_comm)
+                               const gnn_t *lnn2gnn, const int NPNodes, MPI_Comm mpi_comm)
     {
         if(_pragmatic_mesh!=NULL) {
             throw new std::string("PRAgMaTIc: only one mesh can be adapted at a time");
@@ -148,7 +149,7 @@ extern "C" {
 
       */
     void pragmatic_3d_mpi_init(const int *NNodes, const int *NElements, const int *enlist, const double *x, const double *y, const double *z,
-                           const int *lnn2gnn, const int NPNodes, MPI_Comm mpi_comm)
+                           const gnn_t *lnn2gnn, const int NPNodes, MPI_Comm mpi_comm)
     {
         assert(_pragmatic_mesh==NULL);
         assert(_pragmatic_metric_field==NULL);
@@ -177,40 +178,60 @@ extern "C" {
         _pragmatic_mesh = mesh;
     }
 
-    /** Add field which should be adapted to.
+    /** Add fields which should be adapted to. The metric is the
+      intersection of the metrics of all of the fields, and of any
+      metric already set or added. The least squares fit at each node
+      is shared by all of the fields.
 
-      @param [in] psi Node centred field variable
-      @param [in] error Error target
-      @param [in] pnorm P-norm value for error measure. Applies the
-      p-norm scaling to the metric, as in Chen, Sun and Xu,
-      Mathematics of Computation, Volume 76, Number 257, January
-      2007. Set to -1 to default to absolute error measure.
+      @param [in] nfields Number of fields
+      @param [in] psi Node centred field variables, stored one field after the other
+      @param [in] errors Error target for each field
+      @param [in] pnorm P-norm value for error measure, as for pragmatic_add_field.
       */
-    void pragmatic_add_field(const double *psi, const double *error, int *pnorm)
+    void pragmatic_add_fields(const int *nfields, const double *psi, const double *errors, int *pnorm)
     {
         assert(_pragmatic_mesh!=NULL);
 
         Mesh<double> *mesh = (Mesh<double> *)_pragmatic_mesh;
 
-        if(_pragmatic_metric_field==NULL) {
-            if(((Mesh<double> *)_pragmatic_mesh)->get_number_dimensions()==2) {
-                MetricField<double,2> *metric_field = new MetricField<double,2>(*mesh);
-                metric_field->add_field(psi, *error, *pnorm);
-                metric_field->update_mesh();
+        size_t NNodes = mesh->get_number_nodes();
+        std::vector<const double *> fields(*nfields);
+        for(int i=0; i<*nfields; i++)
+            fields[i] = psi+i*NNodes;
 
-                _pragmatic_metric_field = metric_field;
-            } else {
-                MetricField<double,3> *metric_field = new MetricField<double,3>(*mesh);
-                metric_field->add_field(psi, *error, *pnorm);
-                metric_field->update_mesh();
+        if(((Mesh<double> *)_pragmatic_mesh)->get_number_dimensions()==2) {
+            if(_pragmatic_metric_field==NULL)
+                _pragmatic_metric_field = new MetricField<double,2>(*mesh);
 
-                _pragmatic_metric_field = metric_field;
-            }
+            MetricField<double,2> *metric_field = (MetricField<double,2> *)_pragmatic_metric_field;
+            metric_field->add_fields(fields.data(), *nfields, errors, *pnorm);
+            metric_field->update_mesh();
         } else {
-            std::cerr<<"WARNING: Fortran interface currently only supports adding a single field.\n";
+            if(_pragmatic_metric_field==NULL)
+                _pragmatic_metric_field = new MetricField<double,3>(*mesh);
+
+            MetricField<double,3> *metric_field = (MetricField<double,3> *)_pragmatic_metric_field;
+            metric_field->add_fields(fields.data(), *nfields, errors, *pnorm);
+            metric_field->update_mesh();
         }
     }
 
+    /** Add field which should be adapted to. May be called once for each
+      field; to add several fields at once use pragmatic_add_fields.
+
+      @param [in] psi Node centred field variable
+      @param [in] error Error target
+      @param [in] pnorm P-norm value for error measure. Applies the
+      p-norm scaling to the metric, as in Chen, Sun and Xu,
+      Mathematics of Computation, Volume 76, Number 257, January
+      2007. Set to -1 to default to absolute error measure.
+      */
+    void pragmatic_add_field(const double *psi, const double *error, int *pnorm)
+    {
+        int nfields = 1;
+        pragmatic_add_fields(&nfields, psi, error, pnorm);
+    }
+
     /** Set the node centred metric field
 
       @param [in] metric Metric tensor field.
@@ -280,6 +301,18 @@ extern "C" {
         mesh->set_internal_boundaries();
     }
 
+    /** Renumber vertices and elements along a Hilbert curve whenever the
+      mesh is defragmented (see Mesh::set_sfc_renumbering()). With this
+      enabled, pragmatic_adapt() also defragments every fifth iteration.
+      */
+    void pragmatic_set_sfc_renumbering(int enable)
+    {
+        assert(_pragmatic_mesh!=NULL);
+
+        Mesh<double> *mesh = (Mesh<double> *)_pragmatic_mesh;
+        mesh->set_sfc_renumbering(enable!=0);
+    }
+
     /** Adapt the mesh.
     */
     void pragmatic_adapt(int coarsen_surface, int coarsen_int_surface)
@@ -325,6 +358,10 @@ extern "C" {
                     }                    
                 }
 
+                // Long adapt loops scramble the numbering; restore its locality now and then.
+                if(mesh->get_sfc_renumbering() && i%5==4)
+                    mesh->defragment();
+
                 L_max = mesh->mean_edge_length();
             }
             mesh->defragment();
@@ -384,6 +421,10 @@ extern "C" {
                     }                    
                 }
 
+                // Long adapt loops scramble the numbering; restore its locality now and then.
+                if(mesh->get_sfc_renumbering() && i%5==4)
+                    mesh->defragment();
+
                 L_max = mesh->mean_edge_length();
 
 #if 0                
@@ -502,11 +543,11 @@ extern "C" {
         Mesh<double> *mesh = (Mesh<double> *)_pragmatic_mesh;
         
         size_t NNodes = mesh->get_number_nodes();
-        int offset = mesh->get_gnn_offset();
+        gnn_t offset = mesh->get_gnn_offset();
         
         for(size_t i=0; i<NNodes; i++) {
             if (mesh->is_owned_node(i)) {
-                int gnn = mesh->get_global_numbering(i) - offset;
+                index_t gnn = mesh->get_global_numbering(i) - offset;
                 x[gnn] = mesh->get_coords(i)[0];
                 y[gnn] = mesh->get_coords(i)[1];
             }
@@ -521,10 +562,10 @@ extern "C" {
         Mesh<double> *mesh = (Mesh<double> *)_pragmatic_mesh;
         
         size_t NNodes = mesh->get_number_nodes();
-        int offset = mesh->get_gnn_offset();
+        gnn_t offset = mesh->get_gnn_offset();
         for(size_t i=0; i<NNodes; i++) {
             if (mesh->is_owned_node(i)) {
-                int gnn = mesh->get_global_numbering(i) - offset;
+                index_t gnn = mesh->get_global_numbering(i) - offset;
                 x[gnn] = mesh->get_coords(i)[0];
                 y[gnn] = mesh->get_coords(i)[1];
                 z[gnn] = mesh->get_coords(i)[2];
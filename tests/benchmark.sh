@@ -1,15 +1,11 @@
 #!/bin/bash
 
+# Usage: benchmark.sh benchmark ntrials max_threads
+# Sweeps 1..max_threads threads; see run_benchmarks.py for more options.
+
 benchmark=$1
-input=$2
-ntrials=$3
-max_threads=$4
+ntrials=$2
+max_threads=$3
 
-for((n=0;n<ntrials;n++))
-do
-    for((i=1;i<=max_threads;i++))
-    do
-        echo "Running trial $n on $i threads."
-        OMP_NUM_THREADS=$i ${benchmark} ${input}
-    done
-done
+threads=$(seq -s, 1 ${max_threads})
+python $(dirname $0)/run_benchmarks.py -t ${threads} -n ${ntrials} -o $(basename ${benchmark}) ${benchmark}
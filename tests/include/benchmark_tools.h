@@ -0,0 +1,143 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#ifndef BENCHMARK_TOOLS_H
+#define BENCHMARK_TOOLS_H
+
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+#include "Mesh.h"
+
+#include <mpi.h>
+
+/* Helpers shared by the benchmarks and tests which run on structured
+ * meshes rather than on a mesh read from file.
+ */
+
+/*! Structured mesh of the unit square with n x n cells, each cut into
+ * two triangles.
+ */
+template<typename real_t=double>
+Mesh<real_t> *create_square(int n)
+{
+    std::vector<real_t> x, y;
+    std::vector<int> ENList;
+    for(int j=0; j<=n; j++) {
+        for(int i=0; i<=n; i++) {
+            x.push_back((real_t)i/n);
+            y.push_back((real_t)j/n);
+        }
+    }
+
+    for(int j=0; j<n; j++) {
+        for(int i=0; i<n; i++) {
+            int v0 = j*(n+1)+i, v1 = v0+1, v2 = v0+n+2, v3 = v0+n+1;
+            int tris[] = {v0, v1, v2, v0, v2, v3};
+            ENList.insert(ENList.end(), tris, tris+6);
+        }
+    }
+
+    return new Mesh<real_t>(x.size(), ENList.size()/3, ENList.data(), x.data(), y.data());
+}
+
+/*! Structured mesh of the unit cube with n x n x n cells, each cut into
+ * six tetrahedra sharing the main diagonal of the cell.
+ */
+template<typename real_t=double>
+Mesh<real_t> *create_box(int n)
+{
+    std::vector<real_t> x, y, z;
+    std::vector<int> ENList;
+    for(int k=0; k<=n; k++) {
+        for(int j=0; j<=n; j++) {
+            for(int i=0; i<=n; i++) {
+                x.push_back((real_t)i/n);
+                y.push_back((real_t)j/n);
+                z.push_back((real_t)k/n);
+            }
+        }
+    }
+
+    const int m = n+1;
+    const int tets[6][4] = {{0,1,2,6}, {0,2,3,6}, {0,3,7,6}, {0,7,4,6}, {0,4,5,6}, {0,5,1,6}};
+    for(int k=0; k<n; k++) {
+        for(int j=0; j<n; j++) {
+            for(int i=0; i<n; i++) {
+                int v0 = k*m*m+j*m+i;
+                int v[] = {v0, v0+1, v0+m+1, v0+m, v0+m*m, v0+m*m+1, v0+m*m+m+1, v0+m*m+m};
+                for(int t=0; t<6; t++)
+                    for(int l=0; l<4; l++)
+                        ENList.push_back(v[tets[t][l]]);
+            }
+        }
+    }
+
+    return new Mesh<real_t>(x.size(), ENList.size()/4, ENList.data(), x.data(), y.data(), z.data());
+}
+
+/*! Initialises MPI without thread support, as all of the tests do, and
+ * returns the rank of this process.
+ */
+inline int benchmark_init(int *argc, char ***argv)
+{
+    int rank=0;
+    int required_thread_support=MPI_THREAD_SINGLE;
+    int provided_thread_support;
+    MPI_Init_thread(argc, argv, required_thread_support, &provided_thread_support);
+    assert(required_thread_support==provided_thread_support);
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    return rank;
+}
+
+/*! Prints the two BENCHMARK: lines read by run_benchmarks.py; the first
+ * names the phases, separated by spaces, and the second holds their
+ * timings.
+ */
+inline void print_benchmark(const char *phases, const double *times, int ntimes)
+{
+    std::cout<<"BENCHMARK: "<<phases<<"\n";
+    std::cout<<"BENCHMARK:";
+    for(int k=0; k<ntimes; k++)
+        std::cout<<" "<<times[k];
+    std::cout<<std::endl;
+}
+
+#endif
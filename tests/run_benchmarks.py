@@ -1,79 +1,150 @@
 #!/usr/bin/env python
 
+"""Thread-scaling driver for the PRAgMaTIc benchmarks.
+
+Runs a benchmark (e.g. benchmark_adapt_2d, benchmark_adapt_3d) for a range
+of thread counts and collects the per-phase timings it reports on its
+"BENCHMARK:" lines. The first such line names the phases, the last one
+holds the final averaged timings.
+
+Threads are pinned with the standard OpenMP affinity controls
+(OMP_PROC_BIND and OMP_PLACES), so no hwloc or vendor specific settings
+such as KMP_AFFINITY are needed.
+
+Results are written as:
+  <output>.csv  - one row per benchmark, thread count, trial and phase.
+  <output>.json - mean time, speedup and parallel efficiency per phase.
+Use benchmark-analysis.py to plot them.
+
+Example:
+  ./run_benchmarks.py -t 1,2,4,8 -n 5 -o adapt_2d bin/benchmark_adapt_2d
+"""
+
+from __future__ import print_function
+
+import getopt
+import json
+import multiprocessing
+import os
 import subprocess
+import sys
+
 
-def kmp(nthreads, type=None):
-        env=""
-        if type:
-                if(nthreads>1):
-                        env="KMP_AFFINITY=\"verbose,granularity=core,%s\""%type
+def usage():
+    print("""Usage: run_benchmarks.py [options] benchmark [benchmark ...]
+
+Options:
+  -t threads    Comma separated list of thread counts (default 1..ncores).
+  -n ntrials    Number of trials for each thread count (default 3).
+  -b binding    OpenMP thread binding: close, spread or none (default close).
+  -o output     Basename of the CSV and JSON files (default benchmark).
+  -h            Print this message.""")
+
+
+def run(benchmark, nthreads, binding):
+    """Run benchmark on nthreads and return a dictionary of phase timings."""
+    env = dict(os.environ)
+    env["OMP_NUM_THREADS"] = str(nthreads)
+    if binding != "none":
+        env["OMP_PROC_BIND"] = binding
+        env["OMP_PLACES"] = "cores"
+
+    # Benchmarks read their input from ../data relative to the binary.
+    path = os.path.abspath(benchmark)
+    p = subprocess.Popen([path], cwd=os.path.dirname(path), env=env,
+                         stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                         universal_newlines=True)
+    stdout, stderr = p.communicate()
+    if p.returncode != 0:
+        sys.stderr.write(stderr)
+        raise RuntimeError("%s failed on %d threads" % (benchmark, nthreads))
+
+    phases = None
+    timings = None
+    for line in stdout.split("\n"):
+        if not line.startswith("BENCHMARK:"):
+            continue
+        fields = line.split()[1:]
+        if phases is None:
+            phases = fields
         else:
-                if nthreads==1:
-                        return ""
-                elif nthreads==2:
-                        cores="0,6"
-                elif nthreads==4:
-                        cores="0,1,6,7"
-                elif nthreads==6:
-                        cores="0,1,2,6,7,8"
-                elif nthreads==8:
-                        cores="0,1,2,3,6,7,8,9"
-                elif nthreads==10:
-                        cores="0,1,2,3,4,6,7,8,9,10"
-                elif nthreads==12:
-                        cores="0,1,2,3,4,5,6,7,8,9,10,11"
-                else:
-                        print "ERROR: unexpected thread cnt, ", nthreads
-                        return ""
-                env="KMP_AFFINITY=\"verbose,granularity=core,proclist=["+cores+"],explicit\""
-
-        return env
-
-cx1_resources = {"harpers": (8, "select=1:ncpus=8:harpers=true"),
-                 "nehalem": (8, "select=1:ncpus=8:nehalem=true"),
-                 "westmere": (12, "select=1:ncpus=12:westmere=true"),
-                 "nehalem_hyperthreads": (16, "select=1:ncpus=8:ompthreads=16:nehalem=true"),
-                 "westmere_hyperthreads": (24, "select=1:ncpus=12:ompthreads=24:westmere=true")}
-
-benchmarks = ("test_hessian_2d", "test_hessian_3d",
-             "test_smooth_simple_2d", "test_smooth_simple_3d",
-             "test_smooth_constrained_2d", "test_smooth_constrained_3d")
-
-
-def qsub(benchmark, resources, nthreads, ntrials=5):
-        basename=benchmark
-        filename_pbs = basename+".pbs"
-	file_pbs = open(filename_pbs, "w")
-	file_pbs.write("""#PBS -N pragmatic
-#PBS -l %s
-#PBS -l place=scatter:excl
-
-# Time required in hh:mm:ss
-#PBS -l walltime=2:00:00
-
-module load intel-suite/11.1
-module load vtk
-
-cd $PBS_O_WORKDIR/bin
-
-log=../%s.log
-likwid-topology -g &> $log
-ps -eo user,psr,pcpu,comm --sort pcpu | tail >> $log
-
-for((n=0;n<%d;n++))
-do
-"""%(resources, basename, ntrials))
-	for nthread in nthreads:
-		file_pbs.write("echo \"Running trial $n on %d threads.\" >> $log\n"%nthread)
-                file_pbs.write("OMP_NUM_THREADS=%d ./%s >> $log 2>&1\n"%(nthread, benchmark))
-                file_pbs.write("%s OMP_NUM_THREADS=%d ./%s >> $log 2>&1\n"%(kmp(nthread), nthread, benchmark))
-                file_pbs.write("%s OMP_NUM_THREADS=%d ./%s >> $log 2>&1\n"%(kmp(nthread, type="scatter"), nthread, benchmark))
-        file_pbs.write("""
-    done
-done
-""")
-        file_pbs.close()
-        # subprocess.Popen(["qsub", "-q", "pqcvcsm", filename_pbs])
-
-for benchmark in benchmarks[5],:
-	qsub(benchmark=benchmark, resources=cx1_resources["westmere"][1], nthreads=[1,2,4,6,8,10,12])
+            timings = [float(f) for f in fields]
+
+    if phases is None or timings is None:
+        raise RuntimeError("%s did not report any timings" % benchmark)
+
+    return dict(zip(phases, timings))
+
+
+def main():
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "t:n:b:o:h")
+    except getopt.GetoptError as err:
+        print(err)
+        usage()
+        sys.exit(1)
+
+    thread_cnt = list(range(1, multiprocessing.cpu_count()+1))
+    ntrials = 3
+    binding = "close"
+    output = "benchmark"
+    for o, a in opts:
+        if o == "-t":
+            thread_cnt = [int(t) for t in a.split(",")]
+        elif o == "-n":
+            ntrials = int(a)
+        elif o == "-b":
+            binding = a
+        elif o == "-o":
+            output = a
+        elif o == "-h":
+            usage()
+            sys.exit(0)
+
+    if not args or binding not in ("close", "spread", "none"):
+        usage()
+        sys.exit(1)
+
+    csv = open(output+".csv", "w")
+    csv.write("benchmark,nthreads,trial,phase,time\n")
+
+    summary = {}
+    for benchmark in args:
+        name = os.path.basename(benchmark)
+        mean = {}
+        for nthreads in thread_cnt:
+            total = {}
+            for trial in range(ntrials):
+                print("Running %s trial %d on %d threads." % (name, trial, nthreads))
+                timings = run(benchmark, nthreads, binding)
+                for phase, time in sorted(timings.items()):
+                    csv.write("%s,%d,%d,%s,%g\n" % (name, nthreads, trial, phase, time))
+                    total[phase] = total.get(phase, 0.0) + time
+            for phase in total:
+                mean.setdefault(phase, {})[nthreads] = total[phase]/ntrials
+
+        # Speedup and efficiency are relative to the smallest thread count.
+        summary[name] = {}
+        base = min(thread_cnt)
+        for phase in mean:
+            t = [mean[phase][n] for n in thread_cnt]
+            speedup = [mean[phase][base]/tn if tn > 0 else 0.0 for tn in t]
+            efficiency = [s*base/n for s, n in zip(speedup, thread_cnt)]
+            summary[name][phase] = {"nthreads": thread_cnt,
+                                    "time": t,
+                                    "speedup": speedup,
+                                    "efficiency": efficiency}
+
+            print("%s %s" % (name, phase))
+            for n, tn, s, e in zip(thread_cnt, t, speedup, efficiency):
+                print("  %3d threads: %10.4g s  speedup %6.2f  efficiency %5.2f" % (n, tn, s, e))
+
+    csv.close()
+
+    file_json = open(output+".json", "w")
+    json.dump(summary, file_json, indent=2, sort_keys=True)
+    file_json.close()
+
+
+if __name__ == "__main__":
+    main()
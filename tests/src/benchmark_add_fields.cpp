@@ -0,0 +1,136 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "Mesh.h"
+#include "MetricField.h"
+#include "ticker.h"
+
+#include "benchmark_tools.h"
+
+#include <mpi.h>
+
+/* Builds the metric of several fields on structured meshes of the unit
+ * square and cube, once by calling MetricField::add_field() for each
+ * field in turn and once with a single call to MetricField::add_fields(),
+ * and reports the time taken by each.
+ */
+
+/* Time building the metric of nfields fields field by field, times[0],
+ * and all at once, times[1]. Returns true if both give the same metric.
+ */
+template<int dim>
+bool time_add_fields(Mesh<double> *mesh, int nfields, int ntrials, double *times)
+{
+    size_t NNodes = mesh->get_number_nodes();
+    std::vector< std::vector<double> > psi(nfields, std::vector<double>(NNodes));
+    std::vector<const double *> fields(nfields);
+    std::vector<double> errors(nfields);
+    for(int f=0; f<nfields; f++) {
+        for(size_t i=0; i<NNodes; i++) {
+            const double *x = mesh->get_coords(i);
+            double r = 0.0;
+            for(int d=0; d<dim; d++)
+                r += (x[d]-0.5)*(x[d]-0.5)*(d+f+1);
+            psi[f][i] = tanh(20*(f+1)*(sqrt(r)-0.25))+x[f%dim]*x[f%dim];
+        }
+        fields[f] = psi[f].data();
+        errors[f] = 0.01*(f+1);
+    }
+
+    std::vector<double> metric_single(NNodes*(dim==2?3:6)), metric_multi(NNodes*(dim==2?3:6));
+
+    times[0] = 0.0;
+    times[1] = 0.0;
+    for(int t=0; t<ntrials; t++) {
+        MetricField<double,dim> single(*mesh);
+        double tic = get_wtime();
+        for(int f=0; f<nfields; f++)
+            single.add_field(fields[f], errors[f], 2);
+        times[0] += get_wtime()-tic;
+        single.get_metric(metric_single.data());
+
+        MetricField<double,dim> multi(*mesh);
+        tic = get_wtime();
+        multi.add_fields(fields.data(), nfields, errors.data(), 2);
+        times[1] += get_wtime()-tic;
+        multi.get_metric(metric_multi.data());
+    }
+    times[0] /= ntrials;
+    times[1] /= ntrials;
+
+    return metric_single==metric_multi;
+}
+
+int main(int argc, char **argv)
+{
+    int rank = benchmark_init(&argc, &argv);
+
+    const int ntrials = 5;
+    const int nfields = 4;
+    double times_2d[2], times_3d[2];
+
+    Mesh<double> *mesh = create_square(300);
+    bool identical_2d = time_add_fields<2>(mesh, nfields, ntrials, times_2d);
+    delete mesh;
+
+    mesh = create_box(25);
+    bool identical_3d = time_add_fields<3>(mesh, nfields, ntrials, times_3d);
+    delete mesh;
+
+    if(rank==0) {
+        std::cout<<"INFO: "<<nfields<<" fields"<<std::endl;
+        double times[] = {times_2d[0], times_2d[1], times_3d[0], times_3d[1]};
+        print_benchmark("add_field_2d add_fields_2d add_field_3d add_fields_3d", times, 4);
+
+        std::cout<<"Speedup of add_fields over add_field (2D, 3D): ("
+                 <<times_2d[0]/times_2d[1]<<", "<<times_3d[0]/times_3d[1]<<")"<<std::endl;
+
+        std::cout<<"Expecting metric from add_fields identical to add_field: ";
+        if(identical_2d && identical_3d)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail"<<std::endl;
+    }
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <set>
+#include <vector>
+
+#include "Mesh.h"
+#include "DeferredOperations.h"
+#include "ticker.h"
+
+#include <mpi.h>
+
+/* Measures the throughput of committing deferred adjacency updates as a
+ * function of the number of threads. Every thread queues, for its share
+ * of the vertices, the removal and re-insertion of each neighbour in
+ * NNList, so the mesh is unchanged after each commit.
+ */
+int main(int argc, char **argv)
+{
+    int rank=0;
+    int required_thread_support=MPI_THREAD_SINGLE;
+    int provided_thread_support;
+    MPI_Init_thread(&argc, &argv, required_thread_support, &provided_thread_support);
+    assert(required_thread_support==provided_thread_support);
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    int n = 1000;
+    if(argc>1)
+        n = atoi(argv[1]);
+
+    std::vector<double> x, y;
+    std::vector<int> ENList;
+    for(int j=0; j<=n; j++) {
+        for(int i=0; i<=n; i++) {
+            x.push_back((double)i/n);
+            y.push_back((double)j/n);
+        }
+    }
+    for(int j=0; j<n; j++) {
+        for(int i=0; i<n; i++) {
+            int v0 = j*(n+1)+i, v1 = v0+1, v2 = v0+n+1, v3 = v2+1;
+            int t[] = {v0, v1, v3, v0, v3, v2};
+            ENList.insert(ENList.end(), t, t+6);
+        }
+    }
+    Mesh<double> *mesh = new Mesh<double>(x.size(), ENList.size()/3, ENList.data(), x.data(), y.data());
+    int NNodes = mesh->get_number_nodes();
+
+    size_t nops = 0;
+    for(int i=0; i<NNodes; i++)
+        nops += 2*mesh->get_node_patch(i).size();
+
+    const int ntrials = 5;
+    const int max_threads = pragmatic_nthreads();
+
+    if(rank==0)
+        std::cout<<"BENCHMARK: nthreads operations time_queue time_commit commits_per_second\n";
+    for(int nthreads=1; nthreads<=max_threads; nthreads++) {
+        DeferredOperations<double> def_ops(mesh, nthreads, 32);
+
+        double time_queue=0, time_commit=0;
+        for(int trial=0; trial<ntrials; trial++) {
+            double tic = get_wtime();
+#pragma omp parallel num_threads(nthreads)
+            {
+                const int tid = pragmatic_thread_id();
+
+#pragma omp for schedule(static)
+                for(int i=0; i<NNodes; i++) {
+                    std::set<index_t> patch = mesh->get_node_patch(i);
+                    for(auto& nn : patch) {
+                        def_ops.remNN(i, nn, tid);
+                        def_ops.addNN(i, nn, tid);
+                    }
+                }
+            }
+            double toc = get_wtime();
+            time_queue += toc-tic;
+
+#pragma omp parallel num_threads(nthreads)
+            {
+                def_ops.commit();
+            }
+            time_commit += get_wtime()-toc;
+        }
+
+        if(rank==0)
+            std::cout<<"BENCHMARK: "<<nthreads<<" "<<nops<<" "<<time_queue/ntrials<<" "
+                     <<time_commit/ntrials<<" "<<nops*ntrials/time_commit<<std::endl;
+    }
+
+    delete mesh;
+
+    MPI_Finalize();
+
+    return 0;
+}
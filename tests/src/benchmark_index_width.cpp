@@ -0,0 +1,216 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <stdint.h>
+
+#include "Mesh.h"
+#include "ticker.h"
+
+#include <mpi.h>
+
+/* Measures what it costs to widen indices to 64 bits. Local indices are
+ * used by every kernel to walk the element list and the node adjacency,
+ * so their width sets the memory traffic of the whole library. Global
+ * numbers are only looked up when the halo is rebuilt, which is why
+ * PRAGMATIC_INDEX_64 widens gnn_t only.
+ *
+ * The adjacency of a structured mesh is copied into 32 and 64 bit
+ * arrays and, for each width, the benchmark times a sweep over the
+ * element list, a sweep over the node adjacency, and building plus
+ * querying a global-to-local map as done during halo construction.
+ * The 64 bit global numbers are offset past 2^31.
+ */
+template<typename T>
+struct IndexWidth
+{
+    std::vector<T> ENList, NNIndex, NNList, lnn2gnn;
+};
+
+template<typename T>
+void copy_mesh(Mesh<double> *mesh, T offset, IndexWidth<T> &out)
+{
+    int NElements = mesh->get_number_elements();
+    int NNodes = mesh->get_number_nodes();
+
+    out.ENList.resize(NElements*3);
+    for(int i=0; i<NElements; i++) {
+        const index_t *n = mesh->get_element(i);
+        for(int j=0; j<3; j++)
+            out.ENList[i*3+j] = n[j];
+    }
+
+    out.NNIndex.resize(NNodes+1);
+    out.NNIndex[0] = 0;
+    out.NNList.clear();
+    out.lnn2gnn.resize(NNodes);
+    for(int i=0; i<NNodes; i++) {
+        std::set<index_t> patch = mesh->get_node_patch(i);
+        out.NNList.insert(out.NNList.end(), patch.begin(), patch.end());
+        out.NNIndex[i+1] = out.NNList.size();
+        out.lnn2gnn[i] = offset+i;
+    }
+}
+
+template<typename T>
+double element_sweep(const IndexWidth<T> &w, const double *x)
+{
+    double area = 0.0;
+    size_t NElements = w.ENList.size()/3;
+    for(size_t i=0; i<NElements; i++) {
+        const double *x0 = x+2*w.ENList[i*3];
+        const double *x1 = x+2*w.ENList[i*3+1];
+        const double *x2 = x+2*w.ENList[i*3+2];
+        area += 0.5*((x1[0]-x0[0])*(x2[1]-x0[1])-(x2[0]-x0[0])*(x1[1]-x0[1]));
+    }
+    return area;
+}
+
+template<typename T>
+double adjacency_sweep(const IndexWidth<T> &w, const double *x)
+{
+    double length = 0.0;
+    size_t NNodes = w.NNIndex.size()-1;
+    for(size_t i=0; i<NNodes; i++) {
+        for(T k=w.NNIndex[i]; k<w.NNIndex[i+1]; k++) {
+            T j = w.NNList[k];
+            double dx = x[2*j]-x[2*i], dy = x[2*j+1]-x[2*i+1];
+            length += sqrt(dx*dx+dy*dy);
+        }
+    }
+    return length;
+}
+
+template<typename T>
+size_t gnn_lookup(const IndexWidth<T> &w)
+{
+    std::map<T, index_t> gnn2lnn;
+    for(size_t i=0; i<w.lnn2gnn.size(); i++)
+        gnn2lnn[w.lnn2gnn[i]] = i;
+
+    size_t found = 0;
+    for(size_t i=0; i<w.lnn2gnn.size(); i+=7)
+        found += gnn2lnn.count(w.lnn2gnn[i]);
+    return found;
+}
+
+template<typename T>
+void run(Mesh<double> *mesh, T offset, int ntrials, double *timings, double *megabytes)
+{
+    IndexWidth<T> w;
+    copy_mesh(mesh, offset, w);
+    const double *x = mesh->get_coords(0);
+
+    double check = 0.0;
+    double tic = get_wtime();
+    for(int t=0; t<ntrials; t++)
+        check += element_sweep(w, x);
+    timings[0] = (get_wtime()-tic)/ntrials;
+
+    tic = get_wtime();
+    for(int t=0; t<ntrials; t++)
+        check += adjacency_sweep(w, x);
+    timings[1] = (get_wtime()-tic)/ntrials;
+
+    tic = get_wtime();
+    size_t found = gnn_lookup(w);
+    timings[2] = get_wtime()-tic;
+
+    megabytes[0] = (w.ENList.size()+w.NNIndex.size()+w.NNList.size())*sizeof(T)/1048576.0;
+    megabytes[1] = w.lnn2gnn.size()*sizeof(T)/1048576.0;
+
+    // Keep the sweeps from being optimised away.
+    if(check<0 || found==0)
+        std::cerr<<"Unexpected result\n";
+}
+
+int main(int argc, char **argv)
+{
+    int rank=0;
+    int required_thread_support=MPI_THREAD_SINGLE;
+    int provided_thread_support;
+    MPI_Init_thread(&argc, &argv, required_thread_support, &provided_thread_support);
+    assert(required_thread_support==provided_thread_support);
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    int n = 1000;
+    if(argc>1)
+        n = atoi(argv[1]);
+    const int ntrials = 10;
+
+    std::vector<double> x, y;
+    std::vector<int> ENList;
+    for(int j=0; j<=n; j++) {
+        for(int i=0; i<=n; i++) {
+            x.push_back((double)i/n);
+            y.push_back((double)j/n);
+        }
+    }
+    for(int j=0; j<n; j++) {
+        for(int i=0; i<n; i++) {
+            int v0 = j*(n+1)+i, v1 = v0+1, v2 = v0+n+1, v3 = v2+1;
+            int t[] = {v0, v1, v3, v0, v3, v2};
+            ENList.insert(ENList.end(), t, t+6);
+        }
+    }
+    Mesh<double> *mesh = new Mesh<double>(x.size(), ENList.size()/3, ENList.data(), x.data(), y.data());
+
+    double t32[3], t64[3], mb32[2], mb64[2];
+    run<int32_t>(mesh, 0, ntrials, t32, mb32);
+    run<int64_t>(mesh, (int64_t)1<<32, ntrials, t64, mb64);
+
+    if(rank==0) {
+        std::cout<<"Memory (MB)        32 bit   64 bit\n"
+                 <<"  local adjacency  "<<mb32[0]<<"  "<<mb64[0]<<std::endl
+                 <<"  lnn2gnn          "<<mb32[1]<<"  "<<mb64[1]<<std::endl;
+        std::cout<<"BENCHMARK: element_sweep_32 element_sweep_64 adjacency_sweep_32 adjacency_sweep_64 gnn_lookup_32 gnn_lookup_64\n";
+        std::cout<<"BENCHMARK: "<<t32[0]<<" "<<t64[0]<<" "<<t32[1]<<" "<<t64[1]<<" "<<t32[2]<<" "<<t64[2]<<std::endl;
+    }
+
+    delete mesh;
+
+    MPI_Finalize();
+
+    return 0;
+}
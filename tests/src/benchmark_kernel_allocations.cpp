@@ -0,0 +1,138 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include "Mesh.h"
+#include "MetricField.h"
+#include "Coarsen.h"
+#include "Swapping.h"
+#include "ticker.h"
+
+#include "benchmark_tools.h"
+
+#include <mpi.h>
+
+/* Counts the number of heap allocations made by coarsening and swapping
+ * on a structured tetrahedral mesh of the unit cube, refined towards the
+ * plane z=0.5 by an anisotropic metric. The kernels are expected to take
+ * their temporaries from the per-thread Arena, so only the containers
+ * which persist between kernel calls (adjacency lists, work queues,
+ * deferred operations) should show up in the counts.
+ */
+
+static std::atomic<size_t> nallocs(0);
+
+void *operator new(size_t bytes)
+{
+    nallocs++;
+    void *ptr = malloc(bytes==0?1:bytes);
+    if(ptr==NULL)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void *operator new[](size_t bytes)
+{
+    return operator new(bytes);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    free(ptr);
+}
+
+int main(int argc, char **argv)
+{
+    int rank = benchmark_init(&argc, &argv);
+
+    int n = 20;
+    if(argc>1)
+        n = atoi(argv[1]);
+
+    Mesh<double> *mesh = create_box(n);
+    mesh->create_boundary();
+
+    MetricField<double,3> metric_field(*mesh);
+    size_t NNodes = mesh->get_number_nodes();
+    for(size_t i=0; i<NNodes; i++) {
+        double z = mesh->get_coords(i)[2];
+        double hz = 0.02+0.5*fabs(z-0.5);
+        double m[] = {4.0, 0.0, 0.0, 4.0, 0.0, 1.0/(hz*hz)};
+        metric_field.set_metric(m, i);
+    }
+    metric_field.update_mesh();
+
+    Coarsen<double,3> adapt(*mesh);
+    Swapping<double,3> swapping(*mesh);
+
+    double L_up = sqrt(2.0);
+    double L_low = L_up*0.5;
+
+    size_t before = nallocs.load();
+    double tic = get_wtime();
+    adapt.coarsen(L_low, L_up);
+    double time_coarsen = get_wtime()-tic;
+    size_t allocs_coarsen = nallocs.load()-before;
+
+    before = nallocs.load();
+    tic = get_wtime();
+    swapping.swap(0.7);
+    double time_swap = get_wtime()-tic;
+    size_t allocs_swap = nallocs.load()-before;
+
+    if(rank==0) {
+        double results[] = {time_coarsen, (double)allocs_coarsen, time_swap, (double)allocs_swap};
+        print_benchmark("time_coarsen allocations_coarsen time_swap allocations_swap", results, 4);
+    }
+
+    delete mesh;
+
+    MPI_Finalize();
+
+    return 0;
+}
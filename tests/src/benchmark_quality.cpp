@@ -0,0 +1,208 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "Mesh.h"
+#include "MetricField.h"
+#include "ElementProperty.h"
+#include "ticker.h"
+
+#include "benchmark_tools.h"
+
+#include <mpi.h>
+
+/* Times whole-mesh recomputation of the Lipnikov quality on structured
+ * meshes of the unit square and cube with an anisotropic metric, one
+ * element at a time with ElementProperty::lipnikov() and in batches
+ * with ElementProperty::lipnikov_batch_2d()/lipnikov_batch_3d().
+ * Mesh::get_qmean() and get_qmin(), which reduce the cached element
+ * qualities, are timed as well.
+ *
+ * The whole-mesh timings compare the serial path, which updated every
+ * element with the scalar functional and then evaluated it twice more
+ * for qmean and qmin, against Mesh::update_quality(qmean, qmin).
+ */
+
+/* Set a metric which varies from vertex to vertex so that no two
+ * elements have the same quality.
+ */
+template<int dim>
+void set_metric(Mesh<double> *mesh)
+{
+    MetricField<double,dim> metric_field(*mesh);
+    size_t NNodes = mesh->get_number_nodes();
+    for(size_t i=0; i<NNodes; i++) {
+        const double *x = mesh->get_coords(i);
+        double h = 0.01+0.1*x[0];
+        double m2[] = {1.0/(h*h), 0.1/(h*h), 4.0/(h*h)};
+        double m3[] = {1.0/(h*h), 0.1/(h*h), 0.0, 4.0/(h*h), 0.0, 2.0/(h*h)};
+        metric_field.set_metric(dim==2?m2:m3, i);
+    }
+    metric_field.update_mesh();
+}
+
+/* Scalar Lipnikov quality of the element with vertices n. */
+template<int dim>
+double lipnikov(ElementProperty<double> *property, const index_t *n, const double *coords, const double *metric)
+{
+    if(dim==2)
+        return property->lipnikov(coords+n[0]*2, coords+n[1]*2, coords+n[2]*2,
+                                  metric+n[0]*3, metric+n[1]*3, metric+n[2]*3);
+    else
+        return property->lipnikov(coords+n[0]*3, coords+n[1]*3, coords+n[2]*3, coords+n[3]*3,
+                                  metric+n[0]*6, metric+n[1]*6, metric+n[2]*6, metric+n[3]*6);
+}
+
+/* Time ntrials recomputations of the quality of every element. Returns
+ * the time per recomputation of the scalar and batched kernels in
+ * times[0] and times[1], of get_qmean()+get_qmin() in times[2], and of
+ * the serial and batched whole-mesh updates in times[3] and times[4].
+ */
+template<int dim>
+bool time_quality(Mesh<double> *mesh, int ntrials, double *times)
+{
+    const int nloc = dim+1;
+    size_t NElements = mesh->get_number_elements();
+    const index_t *ENList = mesh->get_element(0);
+    const double *coords = mesh->get_coords(0);
+    const double *metric = mesh->get_metric(0);
+
+    ElementProperty<double> *property;
+    if(dim==2)
+        property = new ElementProperty<double>(mesh->get_coords(ENList[0]), mesh->get_coords(ENList[1]), mesh->get_coords(ENList[2]));
+    else
+        property = new ElementProperty<double>(mesh->get_coords(ENList[0]), mesh->get_coords(ENList[1]), mesh->get_coords(ENList[2]), mesh->get_coords(ENList[3]));
+
+    std::vector<double> scalar(NElements), batched(NElements);
+    double qmean[2] = {0, 0}, qmin[2] = {1, 1};
+
+    for(int k=0; k<5; k++)
+        times[k] = 0.0;
+
+    for(int t=0; t<ntrials; t++) {
+        double tic = get_wtime();
+        for(size_t i=0; i<NElements; i++) {
+            scalar[i] = lipnikov<dim>(property, ENList+i*nloc, coords, metric);
+        }
+        times[0] += get_wtime()-tic;
+
+        tic = get_wtime();
+        if(dim==2)
+            property->lipnikov_batch_2d(NElements, ENList, coords, metric, batched.data());
+        else
+            property->lipnikov_batch_3d(NElements, ENList, coords, metric, batched.data());
+        times[1] += get_wtime()-tic;
+
+        tic = get_wtime();
+        mesh->get_qmean();
+        mesh->get_qmin();
+        times[2] += get_wtime()-tic;
+
+        // Serial whole-mesh update: one scalar pass to update the element
+        // qualities and one each for the mean and the minimum.
+        tic = get_wtime();
+        for(size_t i=0; i<NElements; i++)
+            scalar[i] = lipnikov<dim>(property, ENList+i*nloc, coords, metric);
+        double sum = 0;
+        for(size_t i=0; i<NElements; i++)
+            sum += lipnikov<dim>(property, ENList+i*nloc, coords, metric);
+        qmean[0] = sum/NElements;
+        qmin[0] = 1;
+        for(size_t i=0; i<NElements; i++)
+            qmin[0] = std::min(qmin[0], lipnikov<dim>(property, ENList+i*nloc, coords, metric));
+        times[3] += get_wtime()-tic;
+
+        tic = get_wtime();
+        mesh->update_quality(qmean[1], qmin[1]);
+        times[4] += get_wtime()-tic;
+    }
+
+    for(int k=0; k<5; k++)
+        times[k] /= ntrials;
+
+    delete property;
+
+    // The mean is summed in a different order when threaded.
+    return scalar==batched && std::abs(qmean[0]-qmean[1])<1.0e-12 && qmin[0]==qmin[1];
+}
+
+int main(int argc, char **argv)
+{
+    int rank = benchmark_init(&argc, &argv);
+
+    const int ntrials = 10;
+    double times_2d[5], times_3d[5];
+
+    Mesh<double> *mesh = create_square(700);
+    set_metric<2>(mesh);
+    size_t NElements_2d = mesh->get_number_elements();
+    bool identical_2d = time_quality<2>(mesh, ntrials, times_2d);
+    delete mesh;
+
+    mesh = create_box(45);
+    set_metric<3>(mesh);
+    size_t NElements_3d = mesh->get_number_elements();
+    bool identical_3d = time_quality<3>(mesh, ntrials, times_3d);
+    delete mesh;
+
+    if(rank==0) {
+        std::cout<<"INFO: "<<NElements_2d<<" triangles, "<<NElements_3d<<" tetrahedra"<<std::endl;
+        double times[] = {times_2d[0], times_2d[1], times_2d[2], times_2d[3], times_2d[4],
+                          times_3d[0], times_3d[1], times_3d[2], times_3d[3], times_3d[4]};
+        print_benchmark("scalar_2d batched_2d reducers_2d whole_serial_2d whole_batched_2d "
+                        "scalar_3d batched_3d reducers_3d whole_serial_3d whole_batched_3d", times, 10);
+
+        std::cout<<"Speedup of batched over scalar (2D, 3D): ("
+                 <<times_2d[0]/times_2d[1]<<", "<<times_3d[0]/times_3d[1]<<")"<<std::endl;
+
+        std::cout<<"Speedup of whole-mesh update over serial (2D, 3D): ("
+                 <<times_2d[3]/times_2d[4]<<", "<<times_3d[3]/times_3d[4]<<")"<<std::endl;
+
+        std::cout<<"Expecting batched quality and statistics identical to scalar: ";
+        if(identical_2d && identical_3d)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail"<<std::endl;
+    }
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -1,7 +1,3 @@
-#include <vtkXMLUnstructuredGridReader.h>
-#include <vtkUnstructuredGrid.h>
-#include <vtkCell.h>
-
 #include <list>
 #include <vector>
 #include <iostream>
@@ -9,24 +5,53 @@
 #include <unordered_set>
 #include <algorithm>
 
+#include "benchmark_tools.h"
 #include "ticker.h"
+#include "SmallSet.h"
 
-int main()
+// Build the node-element adjacency list for a set type.
+template<typename set_t>
+void build_NEList(const std::vector<int> &ENList, std::vector<set_t> &NEList)
 {
-    vtkXMLUnstructuredGridReader *reader = vtkXMLUnstructuredGridReader::New();
-    reader->SetFileName("../data/box200x200.vtu");
-    reader->Update();
-
-    vtkUnstructuredGrid *ug = reader->GetOutput();
-    int NCells = ug->GetNumberOfCells();
-    int NPoints = ug->GetNumberOfPoints();
-    std::vector<int> ENList;
+    int NCells = ENList.size()/3;
     for(int i=0; i<NCells; i++) {
         for(int j=0; j<3; j++) {
-            ENList.push_back(ug->GetCell(i)->GetPointId(j));
+            NEList[ENList[i*3+j]].insert(i);
         }
     }
-    reader->Delete();
+}
+
+// Intersect the node-element lists of the end points of every edge,
+// as done when looking up the elements sharing an edge.
+template<typename set_t>
+size_t intersect_edges(const std::vector<int> &ENList, const std::vector<set_t> &NEList)
+{
+    size_t cnt=0;
+    int NCells = ENList.size()/3;
+    std::vector<int> shared;
+    for(int i=0; i<NCells; i++) {
+        for(int j=0; j<3; j++) {
+            int n1 = ENList[i*3+j];
+            int n2 = ENList[i*3+(j+1)%3];
+            shared.clear();
+            std::set_intersection(NEList[n1].begin(), NEList[n1].end(),
+                                  NEList[n2].begin(), NEList[n2].end(),
+                                  std::back_inserter(shared));
+            cnt += shared.size();
+        }
+    }
+    return cnt;
+}
+
+int main(int argc, char **argv)
+{
+    benchmark_init(&argc, &argv);
+
+    Mesh<double> *mesh=create_square(600);
+    int NCells = mesh->get_number_elements();
+    int NPoints = mesh->get_number_nodes();
+    std::vector<int> ENList(mesh->get_element(0), mesh->get_element(0)+NCells*3);
+    delete mesh;
 
     // Test 1 - std::set
     std::vector< std::set<int> > NNList1(NPoints);
@@ -41,7 +66,7 @@ int main()
     std::cout<<"time std::set "<<get_wtime()-tic<<std::endl;
     for(std::set<int>::const_iterator it=NNList1[0].begin(); it!=NNList1[0].end(); ++it)
         std::cout<<*it<<" ";
-    std::cout<<endl;
+    std::cout<<std::endl;
 
     // Test 2 - std::unordered_set
     std::vector< std::unordered_set<int> > NNList2(NPoints);
@@ -95,6 +120,57 @@ int main()
         std::cout<<*it<<" ";
     std::cout<<std::endl;
 
+    // Test 5 - SmallSet
+    std::vector< SmallSet<int, 8> > NNList5(NPoints);
+    tic = get_wtime();
+    for(int i=0; i<NCells; i++) {
+        for(int j=0; j<3; j++) {
+            for(int k=0; k<3; k++) {
+                NNList5[ENList[i*3+j]].insert(ENList[i*3+k]);
+            }
+        }
+    }
+    std::cout<<"time SmallSet "<<get_wtime()-tic<<std::endl;
+    for(SmallSet<int, 8>::const_iterator it=NNList5[0].begin(); it!=NNList5[0].end(); ++it)
+        std::cout<<*it<<" ";
+    std::cout<<std::endl;
+
+    // NEList - std::set vs SmallSet: construction, edge intersections and memory.
+    std::vector< std::set<int> > NEList1(NPoints);
+    tic = get_wtime();
+    build_NEList(ENList, NEList1);
+    double time_build1 = get_wtime()-tic;
+
+    tic = get_wtime();
+    size_t cnt1 = intersect_edges(ENList, NEList1);
+    double time_intersect1 = get_wtime()-tic;
+
+    // Each std::set entry is a red-black tree node: three pointers and a
+    // colour in front of the value.
+    size_t bytes1 = NPoints*sizeof(std::set<int>);
+    for(int i=0; i<NPoints; i++)
+        bytes1 += NEList1[i].size()*(3*sizeof(void *)+sizeof(int)+sizeof(int));
+
+    std::vector< SmallSet<int, 8> > NEList2(NPoints);
+    tic = get_wtime();
+    build_NEList(ENList, NEList2);
+    double time_build2 = get_wtime()-tic;
+
+    tic = get_wtime();
+    size_t cnt2 = intersect_edges(ENList, NEList2);
+    double time_intersect2 = get_wtime()-tic;
+
+    size_t bytes2 = NPoints*sizeof(SmallSet<int, 8>);
+    for(int i=0; i<NPoints; i++)
+        bytes2 += NEList2[i].heap_size();
+
+    std::cout<<"NEList std::set: build "<<time_build1<<", intersect "<<time_intersect1
+             <<", bytes "<<bytes1<<" ("<<cnt1<<")"<<std::endl;
+    std::cout<<"NEList SmallSet: build "<<time_build2<<", intersect "<<time_intersect2
+             <<", bytes "<<bytes2<<" ("<<cnt2<<")"<<std::endl;
+
+    MPI_Finalize();
+
     return 0;
 }
 
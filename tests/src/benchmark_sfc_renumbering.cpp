@@ -0,0 +1,168 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include "Mesh.h"
+#include "MetricField.h"
+#include "Coarsen.h"
+#include "Refine.h"
+#include "Smooth.h"
+#include "Swapping.h"
+#include "ticker.h"
+
+#include "benchmark_tools.h"
+
+#include <mpi.h>
+
+/* Times mesh kernels on an adapted tetrahedral mesh of the unit cube,
+ * first with the numbering left behind by defragment() and then after
+ * renumbering the mesh along a Hilbert curve. The mesh is adapted to a
+ * moving anisotropic metric for several cycles first, so that the
+ * numbering has lost most of its spatial locality.
+ */
+
+void adapt(Mesh<double> *mesh, int t)
+{
+    MetricField<double,3> metric_field(*mesh);
+    size_t NNodes = mesh->get_number_nodes();
+    for(size_t i=0; i<NNodes; i++) {
+        const double *x = mesh->get_coords(i);
+        double r = sqrt(pow(x[0]-0.5, 2)+pow(x[1]-0.5, 2)+pow(x[2]-0.5, 2));
+        double h = 0.03+0.2*fabs(r-0.1-0.05*t);
+        double m[] = {1.0/(h*h), 0.0, 0.0, 1.0/(h*h), 0.0, 1.0/(h*h)};
+        metric_field.set_metric(m, i);
+    }
+    metric_field.update_mesh();
+
+    Coarsen<double,3> coarsen(*mesh);
+    Refine<double,3> refine(*mesh);
+    Swapping<double,3> swapping(*mesh);
+
+    double L_up = sqrt(2.0);
+    double L_low = L_up*0.5;
+    double L_max = mesh->maximal_edge_length();
+    double alpha = sqrt(2.0)/2;
+    for(int i=0; i<10; i++) {
+        double L_ref = std::max(alpha*L_max, L_up);
+        coarsen.coarsen(L_low, L_ref);
+        swapping.swap(0.7);
+        refine.refine(L_ref);
+
+        L_max = mesh->maximal_edge_length();
+        if((L_max-L_up)<0.01)
+            break;
+    }
+
+    mesh->defragment();
+}
+
+/* Time each kernel over ntrials calls: the edge table (edge lengths),
+ * element-element adjacency, volume and Laplacian smoothing.
+ */
+void time_kernels(Mesh<double> *mesh, int ntrials, double *times)
+{
+    for(int k=0; k<4; k++)
+        times[k] = 0.0;
+
+    std::vector<index_t> EEList;
+    Smooth<double,3> smooth(*mesh);
+    for(int t=0; t<ntrials; t++) {
+        double tic = get_wtime();
+        mesh->invalidate_edges();
+        mesh->update_edges(Mesh<double>::EDGE_LENGTH|Mesh<double>::EDGE_LENGTH_LOG);
+        times[0] += get_wtime()-tic;
+
+        tic = get_wtime();
+        mesh->calculate_EEList(EEList);
+        times[1] += get_wtime()-tic;
+
+        tic = get_wtime();
+        mesh->calculate_volume();
+        times[2] += get_wtime()-tic;
+
+        tic = get_wtime();
+        smooth.laplacian(1);
+        times[3] += get_wtime()-tic;
+    }
+
+    for(int k=0; k<4; k++)
+        times[k] /= ntrials;
+}
+
+int main(int argc, char **argv)
+{
+    int rank = benchmark_init(&argc, &argv);
+
+    int n = 20;
+    if(argc>1)
+        n = atoi(argv[1]);
+
+    Mesh<double> *mesh = create_box(n);
+    mesh->create_boundary();
+
+    for(int t=0; t<6; t++)
+        adapt(mesh, t);
+
+    const int ntrials = 10;
+    double time_default[4], time_sfc[4];
+
+    time_kernels(mesh, ntrials, time_default);
+
+    mesh->set_sfc_renumbering(true);
+    mesh->defragment();
+    time_kernels(mesh, ntrials, time_sfc);
+
+    if(rank==0) {
+        std::cout<<"INFO: "<<mesh->get_number_nodes()<<" vertices, "<<mesh->get_number_elements()<<" elements"<<std::endl;
+        double times[8];
+        for(int k=0; k<4; k++) {
+            times[2*k] = time_default[k];
+            times[2*k+1] = time_sfc[k];
+        }
+        print_benchmark("edges edges_sfc EEList EEList_sfc volume volume_sfc laplacian laplacian_sfc", times, 8);
+    }
+
+    delete mesh;
+
+    MPI_Finalize();
+
+    return 0;
+}
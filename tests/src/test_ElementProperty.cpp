@@ -35,6 +35,8 @@
  *  SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 #include "ElementProperty.h"
@@ -98,6 +100,36 @@ int main()
             std::cout<<"pass\n";
         else
             std::cout<<"fail\n";
+
+        // Check the gradient against a central difference, for elements
+        // smaller and larger than the ideal element.
+        std::cout<<"Test ElementProperty<double>::lipnikov_grad 2D:"<<std::endl;
+        {
+            bool pass=true;
+            for(double h=0.5; h<=5.0; h*=10) {
+                double y0[] = {0.2*h, 0.1*h};
+                double y1[] = {h, 0.0};
+                double y2[] = {0.3*h, 0.9*h};
+                double m[] = {1.3, 0.2, 0.8};
+
+                double grad[2];
+                triangle.lipnikov_grad(0, y0, y1, y2, m, grad);
+                for(int i=0; i<2; i++) {
+                    double dx = 1.0e-6*h;
+                    double yp[] = {y0[0], y0[1]}, yn[] = {y0[0], y0[1]};
+                    yp[i] += dx;
+                    yn[i] -= dx;
+                    double fd = (triangle.lipnikov(yp, y1, y2, m[0], m[1], m[2])-
+                                 triangle.lipnikov(yn, y1, y2, m[0], m[1], m[2]))/(2*dx);
+                    if(fabs(grad[i]-fd)>1.0e-6*std::max(1.0, fabs(fd)))
+                        pass=false;
+                }
+            }
+            if(pass)
+                std::cout<<"pass\n";
+            else
+                std::cout<<"fail\n";
+        }
     }
 
     // Check tetrahedra
@@ -165,6 +197,35 @@ int main()
             std::cout<<"pass\n";
         else
             std::cout<<"fail\n";
+
+        std::cout<<"Test ElementProperty<double>::lipnikov_grad 3D:"<<std::endl;
+        {
+            bool pass=true;
+            for(double h=0.5; h<=5.0; h*=10) {
+                double y0[] = {0.2*h, 0.1*h, -0.1*h};
+                double y1[] = {h, 0.0, 0.1*h};
+                double y2[] = {0.3*h, 0.9*h, 0.0};
+                double y3[] = {0.1*h, 0.8*h, 0.9*h};
+                double m[] = {1.3, 0.2, 0.1, 0.8, -0.1, 1.1};
+
+                double grad[3];
+                tetrahedron.lipnikov_grad(0, y0, y1, y2, y3, m, grad);
+                for(int i=0; i<3; i++) {
+                    double dx = 1.0e-6*h;
+                    double yp[] = {y0[0], y0[1], y0[2]}, yn[] = {y0[0], y0[1], y0[2]};
+                    yp[i] += dx;
+                    yn[i] -= dx;
+                    double fd = (tetrahedron.lipnikov(yp, y1, y2, y3, m)-
+                                 tetrahedron.lipnikov(yn, y1, y2, y3, m))/(2*dx);
+                    if(fabs(grad[i]-fd)>1.0e-6*std::max(1.0, fabs(fd)))
+                        pass=false;
+                }
+            }
+            if(pass)
+                std::cout<<"pass\n";
+            else
+                std::cout<<"fail\n";
+        }
     }
 
     return 0;
@@ -0,0 +1,176 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+
+#include "MetricTensor.h"
+
+/* Random symmetric tensor, V*diag(D)*V^T, where V is a random rotation
+ * and the magnitude of the eigenvalues D spans the given anisotropy.
+ */
+template<int dim>
+Eigen::Matrix<double, dim, dim> random_tensor(double anisotropy, bool definite)
+{
+    Eigen::Matrix<double, dim, dim> R = Eigen::Matrix<double, dim, dim>::Random();
+    Eigen::HouseholderQR< Eigen::Matrix<double, dim, dim> > qr(R);
+    Eigen::Matrix<double, dim, dim> V = qr.householderQ();
+
+    Eigen::Matrix<double, dim, 1> D;
+    for(int i=0; i<dim; i++) {
+        D[i] = pow(anisotropy, (double)rand()/RAND_MAX);
+        if(!definite && rand()%2)
+            D[i] = -D[i];
+    }
+
+    return V*D.asDiagonal()*V.transpose();
+}
+
+template<int dim>
+void pack(const Eigen::Matrix<double, dim, dim> &M, double *m)
+{
+    int k=0;
+    for(int i=0; i<dim; i++)
+        for(int j=i; j<dim; j++)
+            m[k++] = M(i,j);
+}
+
+/* Check the eigendecomposition of M against Eigen::SelfAdjointEigenSolver
+ * and that it reproduces M.
+ */
+template<int dim>
+bool check_eigen(const Eigen::Matrix<double, dim, dim> &M)
+{
+    double m[dim==2?3:6];
+    pack<dim>(M, m);
+
+    Eigen::Matrix<double, dim, 1> D;
+    Eigen::Matrix<double, dim, dim> V;
+    MetricTensor<double,dim>::symmetric_eigen(m, D, V);
+
+    Eigen::SelfAdjointEigenSolver< Eigen::Matrix<double, dim, dim> > solver(M);
+
+    double norm = std::max(M.norm(), 1.0e-300);
+    for(int i=0; i<dim; i++) {
+        if(i>0 && D[i]<D[i-1])
+            return false;
+        if(fabs(D[i]-solver.eigenvalues()[i])>1.0e-12*norm)
+            return false;
+    }
+
+    if((V.transpose()*V-Eigen::Matrix<double, dim, dim>::Identity()).norm()>1.0e-12)
+        return false;
+
+    if(M.norm()>0 && (V*D.asDiagonal()*V.transpose()-M).norm()>1.0e-12*norm)
+        return false;
+
+    return true;
+}
+
+/* The intersection of two metrics must not allow longer edges than
+ * either of them, i.e. Mc-M1 and Mc-M2 must be positive semi-definite.
+ */
+template<int dim>
+bool check_constrain(const Eigen::Matrix<double, dim, dim> &M1, const Eigen::Matrix<double, dim, dim> &M2)
+{
+    double m1[dim==2?3:6], m2[dim==2?3:6], mc[dim==2?3:6];
+    pack<dim>(M1, m1);
+    pack<dim>(M2, m2);
+
+    MetricTensor<double,dim> metric(m1);
+    metric.constrain(m2);
+    metric.get_metric(mc);
+
+    Eigen::Matrix<double, dim, dim> Mc;
+    int k=0;
+    for(int i=0; i<dim; i++)
+        for(int j=i; j<dim; j++)
+            Mc(i,j) = Mc(j,i) = mc[k++];
+
+    double tol = 1.0e-8*std::max(M1.norm(), M2.norm());
+    Eigen::SelfAdjointEigenSolver< Eigen::Matrix<double, dim, dim> > solver1(Mc-M1), solver2(Mc-M2);
+    return solver1.eigenvalues().minCoeff()>-tol && solver2.eigenvalues().minCoeff()>-tol;
+}
+
+template<int dim>
+void test(const char *name)
+{
+    srand(1);
+    const int ntests = 10000;
+
+    std::cout<<"Test MetricTensor<double,"<<dim<<">::symmetric_eigen ("<<name<<"):"<<std::endl;
+    bool pass = true;
+    for(int i=0; i<ntests; i++) {
+        pass = pass && check_eigen<dim>(random_tensor<dim>(1.0e8, false));
+        pass = pass && check_eigen<dim>(random_tensor<dim>(1.0, true));
+    }
+
+    // Diagonal, isotropic and zero tensors.
+    Eigen::Matrix<double, dim, dim> M = Eigen::Matrix<double, dim, dim>::Zero();
+    pass = pass && check_eigen<dim>(M);
+    M = Eigen::Matrix<double, dim, dim>::Identity();
+    pass = pass && check_eigen<dim>(M);
+    M(0,0) = 1.0e6;
+    pass = pass && check_eigen<dim>(M);
+
+    if(pass)
+        std::cout<<"pass\n";
+    else
+        std::cout<<"fail\n";
+
+    std::cout<<"Test MetricTensor<double,"<<dim<<">::constrain ("<<name<<"):"<<std::endl;
+    pass = true;
+    for(int i=0; i<ntests; i++)
+        pass = pass && check_constrain<dim>(random_tensor<dim>(1.0e4, true), random_tensor<dim>(1.0e4, true));
+
+    if(pass)
+        std::cout<<"pass\n";
+    else
+        std::cout<<"fail\n";
+}
+
+int main()
+{
+    test<2>("2D");
+    test<3>("3D");
+
+    return 0;
+}
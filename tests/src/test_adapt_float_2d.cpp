@@ -0,0 +1,162 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "Mesh.h"
+#include "MetricField.h"
+#include "Coarsen.h"
+#include "Refine.h"
+#include "Smooth.h"
+#include "Swapping.h"
+#include "ticker.h"
+
+#include "benchmark_tools.h"
+
+#include <mpi.h>
+
+/* Adapts a triangulated unit square to the same field with Mesh<float>
+ * and Mesh<double>. Coordinates and metric are stored in single
+ * precision in the former while quality is accumulated in double in
+ * both, so the adapted meshes should be of comparable quality.
+ */
+
+template<typename real_t>
+void adapt(Mesh<real_t> *mesh, double &qmean, double &qmin, long double &area, long double &perimeter, double &time_adapt)
+{
+    time_adapt = get_wtime();
+
+    MetricField<real_t,2> metric_field(*mesh);
+
+    size_t NNodes = mesh->get_number_nodes();
+    std::vector<real_t> psi(NNodes);
+    for(size_t i=0; i<NNodes; i++) {
+        double x = 2*mesh->get_coords(i)[0]-1;
+        double y = 2*mesh->get_coords(i)[1]-1;
+
+        psi[i] = 0.1*sin(20*x) + atan2(-0.1, (double)(2*x - sin(5*y)));
+    }
+
+    metric_field.add_field(&(psi[0]), 0.001, 2);
+    metric_field.update_mesh();
+
+    double L_up = sqrt(2.0);
+    double L_low = L_up/2;
+
+    Coarsen<real_t, 2> coarsen(*mesh);
+    Smooth<real_t, 2> smooth(*mesh);
+    Refine<real_t, 2> refine(*mesh);
+    Swapping<real_t, 2> swapping(*mesh);
+
+    double L_max = mesh->maximal_edge_length();
+
+    double alpha = sqrt(2.0)/2.0;
+    for(size_t i=0; i<20; i++) {
+        double L_ref = std::max(alpha*L_max, L_up);
+
+        coarsen.coarsen(L_low, L_ref);
+        swapping.swap(0.7);
+        refine.refine(L_ref);
+
+        L_max = mesh->maximal_edge_length();
+
+        if((L_max-L_up)<0.01)
+            break;
+    }
+
+    mesh->defragment();
+
+    smooth.smart_laplacian(10);
+    smooth.optimisation_linf(10);
+
+    time_adapt = get_wtime()-time_adapt;
+
+    qmean = mesh->get_qmean();
+    qmin = mesh->get_qmin();
+    area = mesh->calculate_area();
+    perimeter = mesh->calculate_perimeter();
+}
+
+int main(int argc, char **argv)
+{
+    int rank = benchmark_init(&argc, &argv);
+
+    double qmean_float, qmin_float, time_float;
+    long double area_float, perimeter_float;
+    Mesh<float> *mesh_float = create_square<float>(50);
+    mesh_float->create_boundary();
+    adapt(mesh_float, qmean_float, qmin_float, area_float, perimeter_float, time_float);
+    delete mesh_float;
+
+    double qmean_double, qmin_double, time_double;
+    long double area_double, perimeter_double;
+    Mesh<double> *mesh_double = create_square<double>(50);
+    mesh_double->create_boundary();
+    adapt(mesh_double, qmean_double, qmin_double, area_double, perimeter_double, time_double);
+    delete mesh_double;
+
+    if(rank==0) {
+        double times[] = {time_float, time_double};
+        print_benchmark("time_float time_double", times, 2);
+
+        std::cout<<"Quality (mean, min) float: ("<<qmean_float<<", "<<qmin_float<<"), double: ("<<qmean_double<<", "<<qmin_double<<")"<<std::endl;
+
+        std::cout<<"Expecting float qmean within 0.05 of double: ";
+        if(std::abs(qmean_float-qmean_double)<0.05)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail (qmean="<<qmean_float<<")"<<std::endl;
+
+        std::cout<<"Expecting perimeter == 4: ";
+        if(std::abs(perimeter_float-4)<4*FLT_EPSILON)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail (perimeter="<<perimeter_float<<")"<<std::endl;
+
+        std::cout<<"Expecting area == 1: ";
+        if(std::abs(area_float-1)<100*FLT_EPSILON)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail (area="<<area_float<<")"<<std::endl;
+    }
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include <set>
+#include <vector>
+
+#include "Mesh.h"
+#include "Colouring.h"
+
+#include <mpi.h>
+
+// Check that no two adjacent vertices share a colour and that every
+// connected vertex appears in exactly one colour class.
+bool valid_colouring(Mesh<double> *mesh, Colouring<double> &colouring)
+{
+    int *node_colour = colouring.get_node_colour();
+    size_t NNodes = mesh->get_number_nodes();
+
+    for(size_t i=0; i<NNodes; i++) {
+        if(node_colour[i]<0)
+            return false;
+
+        std::set<index_t> patch = mesh->get_node_patch(i);
+        for(auto& nn : patch)
+            if(node_colour[nn]==node_colour[i])
+                return false;
+    }
+
+    std::vector<int> seen(NNodes, 0);
+    for(int c=0; c<colouring.get_number_of_colours(); c++) {
+        const index_t *members = colouring.get_colour_class(c);
+        for(index_t i=0; i<colouring.get_class_size(c); i++) {
+            if(node_colour[members[i]]!=c)
+                return false;
+            seen[members[i]]++;
+        }
+    }
+    for(size_t i=0; i<NNodes; i++)
+        if(seen[i]!=1)
+            return false;
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int rank=0;
+    int required_thread_support=MPI_THREAD_SINGLE;
+    int provided_thread_support;
+    MPI_Init_thread(&argc, &argv, required_thread_support, &provided_thread_support);
+    assert(required_thread_support==provided_thread_support);
+
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    // Structured mesh of the unit square.
+    int n = 50;
+    std::vector<double> x, y;
+    std::vector<int> ENList;
+    for(int j=0; j<=n; j++) {
+        for(int i=0; i<=n; i++) {
+            x.push_back((double)i/n);
+            y.push_back((double)j/n);
+        }
+    }
+    for(int j=0; j<n; j++) {
+        for(int i=0; i<n; i++) {
+            int v0 = j*(n+1)+i, v1 = v0+1, v2 = v0+n+1, v3 = v2+1;
+            int t[] = {v0, v1, v3, v0, v3, v2};
+            ENList.insert(ENList.end(), t, t+6);
+        }
+    }
+    Mesh<double> *mesh = new Mesh<double>(x.size(), ENList.size()/3, ENList.data(), x.data(), y.data());
+
+    Colouring<double> colouring(mesh, pragmatic_nthreads());
+    colouring.colour();
+
+    bool initial_pass = valid_colouring(mesh, colouring);
+    std::vector<int> initial_colour(colouring.get_node_colour(), colouring.get_node_colour()+mesh->get_number_nodes());
+
+    // Create clashes and reset a few vertices. Only these, and possibly
+    // their neighbours, should be recoloured.
+    int *node_colour = colouring.get_node_colour();
+    std::vector<bool> touched(mesh->get_number_nodes(), false);
+    for(size_t i=0; i<mesh->get_number_nodes(); i+=7) {
+        index_t nn = *mesh->get_node_patch(i).begin();
+        node_colour[std::max<index_t>(i, nn)] = node_colour[std::min<index_t>(i, nn)];
+        touched[std::max<index_t>(i, nn)] = true;
+    }
+    for(size_t i=3; i<mesh->get_number_nodes(); i+=11) {
+        colouring.reset(i);
+        touched[i] = true;
+    }
+    colouring.update();
+
+    bool update_pass = valid_colouring(mesh, colouring);
+    bool incremental_pass = true;
+    for(size_t i=0; i<mesh->get_number_nodes(); i++) {
+        if(touched[i] || colouring.get_node_colour()[i]==initial_colour[i])
+            continue;
+
+        std::set<index_t> patch = mesh->get_node_patch(i);
+        bool near_touched = false;
+        for(auto& nn : patch)
+            near_touched = near_touched || touched[nn];
+        if(!near_touched)
+            incremental_pass = false;
+    }
+
+    delete mesh;
+
+    if(rank==0) {
+        std::cout<<"Checking initial colouring: ";
+        if(initial_pass)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail"<<std::endl;
+
+        std::cout<<"Checking repaired colouring: ";
+        if(update_pass)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail"<<std::endl;
+
+        std::cout<<"Checking vertices away from changes keep their colour: ";
+        if(incremental_pass)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail"<<std::endl;
+    }
+
+    MPI_Finalize();
+
+    return 0;
+}
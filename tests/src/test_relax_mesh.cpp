@@ -0,0 +1,124 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "Mesh.h"
+#include "MetricField.h"
+
+#include "benchmark_tools.h"
+
+#include <mpi.h>
+
+/* Sets a metric on the unit square and cube, then relaxes it towards
+ * the metric of a second field. get_qmean() and get_qmin() read the
+ * cached element qualities, so after relax_mesh() they must agree with
+ * a full recomputation of the qualities with the relaxed metric.
+ */
+
+template<int dim>
+void set_field(Mesh<double> *mesh, MetricField<double,dim> &metric_field, double freq)
+{
+    size_t NNodes = mesh->get_number_nodes();
+    std::vector<double> psi(NNodes);
+    for(size_t i=0; i<NNodes; i++) {
+        const double *X = mesh->get_coords(i);
+        double x = 2*X[0]-1;
+        double y = 2*X[1]-1;
+
+        psi[i] = 0.1*sin(freq*x) + atan2(-0.1, (double)(2*x - sin(5*y)));
+    }
+
+    metric_field.add_field(&(psi[0]), dim==2?0.001:0.02, 2);
+}
+
+template<int dim>
+bool test_relax(Mesh<double> *mesh)
+{
+    mesh->create_boundary();
+
+    MetricField<double,dim> metric_field(*mesh);
+    set_field<dim>(mesh, metric_field, 20);
+    metric_field.update_mesh();
+    double qmean_initial = mesh->get_qmean();
+
+    MetricField<double,dim> relaxed_field(*mesh);
+    set_field<dim>(mesh, relaxed_field, 50);
+    relaxed_field.relax_mesh(0.5);
+
+    double qmean_cached = mesh->get_qmean();
+    double qmin_cached = mesh->get_qmin();
+
+    double qmean, qmin;
+    mesh->update_quality(qmean, qmin);
+
+    // The mean is summed in a different order by the two reducers.
+    return qmean!=qmean_initial &&
+           std::abs(qmean_cached-qmean)<1.0e-12 && qmin_cached==qmin;
+}
+
+int main(int argc, char **argv)
+{
+    int rank = benchmark_init(&argc, &argv);
+
+    Mesh<double> *mesh = create_square(50);
+    bool pass_2d = test_relax<2>(mesh);
+    delete mesh;
+
+    mesh = create_box(10);
+    bool pass_3d = test_relax<3>(mesh);
+    delete mesh;
+
+    if(rank==0) {
+        std::cout<<"Expecting 2D cached quality to match the relaxed metric: ";
+        if(pass_2d)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail"<<std::endl;
+
+        std::cout<<"Expecting 3D cached quality to match the relaxed metric: ";
+        if(pass_3d)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail"<<std::endl;
+    }
+
+    MPI_Finalize();
+
+    return 0;
+}
@@ -0,0 +1,167 @@
+/*  Copyright (C) 2010 Imperial College London and others.
+ *
+ *  Please see the AUTHORS file in the main source directory for a
+ *  full list of copyright holders.
+ *
+ *  Gerard Gorman
+ *  Applied Modelling and Computation Group
+ *  Department of Earth Science and Engineering
+ *  Imperial College London
+ *
+ *  g.gorman@imperial.ac.uk
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *  1. Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above
+ *  copyright notice, this list of conditions and the following
+ *  disclaimer in the documentation and/or other materials provided
+ *  with the distribution.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *  CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *  INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *  MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ *  BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ *  EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *  DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ *  ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ *  TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ *  THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "Mesh.h"
+#include "MetricField.h"
+#include "Coarsen.h"
+#include "Refine.h"
+#include "Swapping.h"
+
+#include "benchmark_tools.h"
+
+#include <mpi.h>
+
+/* Adapts the unit square and cube, then defragments them with Hilbert
+ * curve renumbering enabled. Renumbering only permutes vertices and
+ * elements, so the mesh must still verify and its quality, volume and
+ * boundary measure must be those of the mesh before renumbering.
+ */
+
+struct mesh_stats {
+    size_t NNodes, NElements;
+    double qmean, qmin;
+    long double volume, boundary;
+};
+
+template<int dim>
+mesh_stats get_stats(Mesh<double> *mesh)
+{
+    mesh_stats stats;
+    stats.NNodes = mesh->get_number_nodes();
+    stats.NElements = mesh->get_number_elements();
+    stats.qmean = mesh->get_qmean();
+    stats.qmin = mesh->get_qmin();
+    stats.volume = dim==2?mesh->calculate_area():mesh->calculate_volume();
+    stats.boundary = dim==2?mesh->calculate_perimeter():mesh->calculate_area();
+    return stats;
+}
+
+template<int dim>
+bool test_renumbering(Mesh<double> *mesh)
+{
+    mesh->create_boundary();
+
+    MetricField<double,dim> metric_field(*mesh);
+
+    size_t NNodes = mesh->get_number_nodes();
+    std::vector<double> psi(NNodes);
+    for(size_t i=0; i<NNodes; i++) {
+        const double *X = mesh->get_coords(i);
+        double x = 2*X[0]-1;
+        double y = 2*X[1]-1;
+
+        psi[i] = 0.1*sin(20*x) + atan2(-0.1, (double)(2*x - sin(5*y)));
+    }
+
+    metric_field.add_field(&(psi[0]), dim==2?0.001:0.02, 2);
+    metric_field.update_mesh();
+
+    double L_up = sqrt(2.0);
+    double L_low = L_up/2;
+
+    Coarsen<double, dim> coarsen(*mesh);
+    Refine<double, dim> refine(*mesh);
+    Swapping<double, dim> swapping(*mesh);
+
+    double L_max = mesh->maximal_edge_length();
+
+    double alpha = sqrt(2.0)/2.0;
+    for(size_t i=0; i<10; i++) {
+        double L_ref = std::max(alpha*L_max, L_up);
+
+        coarsen.coarsen(L_low, L_ref);
+        swapping.swap(0.7);
+        refine.refine(L_ref);
+
+        L_max = mesh->maximal_edge_length();
+
+        if((L_max-L_up)<0.01)
+            break;
+    }
+
+    // Compact with the default numbering first so that both meshes have
+    // no erased vertices or elements.
+    mesh->defragment();
+    mesh_stats before = get_stats<dim>(mesh);
+    std::vector<index_t> ENList(mesh->get_element(0), mesh->get_element(0)+before.NElements*(dim+1));
+
+    mesh->set_sfc_renumbering(true);
+    mesh->defragment();
+    mesh_stats after = get_stats<dim>(mesh);
+
+    bool renumbered = !std::equal(ENList.begin(), ENList.end(), mesh->get_element(0));
+
+    // Sums are accumulated in a different order after renumbering.
+    return mesh->verify() && renumbered &&
+           before.NNodes==after.NNodes && before.NElements==after.NElements &&
+           std::abs(before.qmean-after.qmean)<1.0e-12 && before.qmin==after.qmin &&
+           std::abs(before.volume-after.volume)<1.0e-12 && std::abs(before.boundary-after.boundary)<1.0e-12;
+}
+
+int main(int argc, char **argv)
+{
+    int rank = benchmark_init(&argc, &argv);
+
+    Mesh<double> *mesh = create_square(50);
+    bool pass_2d = test_renumbering<2>(mesh);
+    delete mesh;
+
+    mesh = create_box(10);
+    bool pass_3d = test_renumbering<3>(mesh);
+    delete mesh;
+
+    if(rank==0) {
+        std::cout<<"Expecting 2D mesh unchanged by SFC renumbering: ";
+        if(pass_2d)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail"<<std::endl;
+
+        std::cout<<"Expecting 3D mesh unchanged by SFC renumbering: ";
+        if(pass_3d)
+            std::cout<<"pass"<<std::endl;
+        else
+            std::cout<<"fail"<<std::endl;
+    }
+
+    MPI_Finalize();
+
+    return 0;
+}
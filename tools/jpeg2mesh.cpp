@@ -52,6 +52,10 @@
 
 #include <mpi.h>
 
+// Pixel intensities do not need double precision, so the mesh and metric
+// are stored in single precision; quality is still accumulated in double.
+typedef float image_real_t;
+
 void usage(char *cmd)
 {
     std::cout<<"Usage: "<<cmd<<" [options] infile\n"
@@ -124,7 +128,7 @@ int parse_arguments(int argc, char **argv, std::string &infilename, bool &verbos
     return 0;
 }
 
-void cout_quality(const Mesh<double> *mesh, std::string operation)
+void cout_quality(const Mesh<image_real_t> *mesh, std::string operation)
 {
     double qmean = mesh->get_qmean();
     double qmin = mesh->get_qmin();
@@ -185,7 +189,7 @@ int main(int argc, char **argv)
 #endif
 
     size_t NNodes = ug->GetNumberOfPoints();
-    std::vector<double> x(NNodes),y(NNodes), imageR(NNodes), imageG(NNodes), imageB(NNodes);
+    std::vector<image_real_t> x(NNodes),y(NNodes), imageR(NNodes), imageG(NNodes), imageB(NNodes);
     for(size_t i=0; i<NNodes; i++) {
         double r[3];
         ug->GetPoints()->GetPoint(i, r);
@@ -218,7 +222,7 @@ int main(int argc, char **argv)
     }
 
     int nparts=1;
-    Mesh<double> *mesh=NULL;
+    Mesh<image_real_t> *mesh=NULL;
 
     // Handle mpi parallel run.
     MPI_Comm_size(MPI_COMM_WORLD, &nparts);
@@ -338,7 +342,7 @@ int main(int argc, char **argv)
         }
 
         // Construct local mesh.
-        std::vector<double> lx(NNodes), ly(NNodes), lz(NNodes), limageR(NNodes), limageG(NNodes), limageB(NNodes);
+        std::vector<image_real_t> lx(NNodes), ly(NNodes), lz(NNodes), limageR(NNodes), limageG(NNodes), limageB(NNodes);
         for(size_t i=0; i<NNodes; i++) {
             lx[i] = x[node_partition[rank][i]];
             ly[i] = y[node_partition[rank][i]];
@@ -368,15 +372,15 @@ int main(int argc, char **argv)
         MPI_Comm comm = MPI_COMM_WORLD;
 
         int pNNodes = node_partition[rank].size();
-        mesh = new Mesh<double>(NNodes, NElements, &(ENList[0]), &(x[0]), &(y[0]), &(lnn2gnn[0]), pNNodes, comm);
+        mesh = new Mesh<image_real_t>(NNodes, NElements, &(ENList[0]), &(x[0]), &(y[0]), &(lnn2gnn[0]), pNNodes, comm);
     } else
     {
-        mesh = new Mesh<double>(NNodes, NElements, &(ENList[0]), &(x[0]), &(y[0]));
+        mesh = new Mesh<image_real_t>(NNodes, NElements, &(ENList[0]), &(x[0]), &(y[0]));
     }
 
     mesh->create_boundary();
 
-    MetricField<double, 2> metric_field(*mesh);
+    MetricField<image_real_t, 2> metric_field(*mesh);
 
     double time_metric = get_wtime();
     metric_field.add_field(imageR.data(), 5.0, 1);
@@ -403,14 +407,14 @@ int main(int argc, char **argv)
 
     if(verbose) {
         cout_quality(mesh, "Initial quality");
-        VTKTools<double>::export_vtu("initial_mesh_3d", mesh);
+        VTKTools<image_real_t>::export_vtu("initial_mesh_3d", mesh);
     }
 
     double L_up = sqrt(2.0);
 
-    Coarsen<double, 2> coarsen(*mesh);
-    Smooth<double, 2> smooth(*mesh);
-    Swapping<double, 2> swapping(*mesh);
+    Coarsen<image_real_t, 2> coarsen(*mesh);
+    Smooth<image_real_t, 2> smooth(*mesh);
+    Swapping<image_real_t, 2> swapping(*mesh);
 
     double time_coarsen=0, time_swapping=0;
     for(size_t i=0; i<5; i++) {
@@ -443,9 +447,9 @@ int main(int argc, char **argv)
         std::cout<<"Times for metric, coarsen, swapping, smoothing = "<<time_metric<<", "<<time_coarsen<<", "<<time_swapping<<", "<<time_smooth<<std::endl;
 
     if(outfilename.size()==0)
-        VTKTools<double>::export_vtu("scaled_mesh_3d", mesh);
+        VTKTools<image_real_t>::export_vtu("scaled_mesh_3d", mesh);
     else
-        VTKTools<double>::export_vtu(outfilename.c_str(), mesh);
+        VTKTools<image_real_t>::export_vtu(outfilename.c_str(), mesh);
 
     delete mesh;
 #else